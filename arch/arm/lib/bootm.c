@@ -187,6 +187,14 @@ static int do_bootm_linux(struct image_data *data)
 	if (ret)
 		return ret;
 
+	/*
+	 * The uncompressed size of compressed images may only be known now,
+	 * keep the initrd and oftree out of the kernel.
+	 */
+	if (data->os_compression)
+		mem_free = max_t(unsigned long, mem_free,
+				PAGE_ALIGN(data->os_res->end + SZ_1M));
+
 	return __do_bootm_linux(data, mem_free, 0);
 }
 
@@ -201,6 +209,7 @@ static struct image_handler rawimage_handler = {
 	.name = "ARM raw image",
 	.bootm = do_bootm_linux,
 	.filetype = filetype_unknown,
+	.compressed = 1,
 };
 
 struct zimage_header {
@@ -377,6 +386,7 @@ static struct image_handler barebox_handler = {
 	.name = "ARM barebox",
 	.bootm = do_bootm_linux,
 	.filetype = filetype_arm_barebox,
+	.compressed = 1,
 };
 
 #include <aimage.h>
@@ -247,7 +247,7 @@ static void *am33xx_net_boot(void)
 
 	memset(&dhcp_param, 0, sizeof(struct dhcp_req_param));
 	dhcp_param.vendor_id = "am335x barebox-mlo";
-	err = dhcp(20, &dhcp_param);
+	err = dhcp(NULL, 20, &dhcp_param);
 	if (err) {
 		printf("dhcp failed\n");
 		return NULL;
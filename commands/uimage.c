@@ -60,7 +60,10 @@ static int do_uimage(int argc, char *argv[])
 		uimage_print_contents(handle);
 	}
 
-	if (verify) {
+	if (verify && extract) {
+		/* checked by uimage_load() while extracting */
+		handle->verify = 1;
+	} else if (verify) {
 		printf("verifying data CRC... ");
 		ret = uimage_verify(handle);
 		if (ret)
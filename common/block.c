@@ -22,6 +22,7 @@
 #include <linux/err.h>
 #include <linux/list.h>
 #include <dma.h>
+#include <linux/log2.h>
 
 #define BLOCKSIZE(blk)	(1 << blk->blockbits)
 
@@ -32,11 +33,43 @@ struct chunk {
 	void *data; /* data buffer */
 	int block_start; /* first block in this chunk */
 	int dirty; /* need to write back to device */
-	int num; /* number of chunk, debugging only */
+	int num; /* number of chunk, also its slot in the cache buffer */
 	struct list_head list;
+	struct hlist_node hash; /* lookup table entry while cached */
 };
 
 #define BUFSIZE (PAGE_SIZE * 16)
+#define BLOCK_CACHE_CHUNKS	8
+#define BLOCK_READAHEAD		3
+
+static inline int chunk_index(struct block_device *blk, int block)
+{
+	return block >> blk->chunkbits;
+}
+
+static struct hlist_head *chunk_hash_head(struct block_device *blk, int block)
+{
+	return &blk->chunk_hash[chunk_index(blk, block) & blk->chunk_hash_mask];
+}
+
+static int chunk_writeback(struct block_device *blk, struct chunk *chunk)
+{
+	size_t num_blocks;
+	int ret;
+
+	if (!chunk->dirty)
+		return 0;
+
+	num_blocks = min(blk->rdbufsize, blk->num_blocks - chunk->block_start);
+
+	ret = blk->ops->write(blk, chunk->data, chunk->block_start, num_blocks);
+	if (ret)
+		return ret;
+
+	chunk->dirty = 0;
+
+	return 0;
+}
 
 /*
  * Write all dirty chunks back to the device
@@ -44,15 +77,15 @@ struct chunk {
 static int writebuffer_flush(struct block_device *blk)
 {
 	struct chunk *chunk;
+	int ret;
 
 	if (!IS_ENABLED(CONFIG_BLOCK_WRITE))
 		return 0;
 
 	list_for_each_entry(chunk, &blk->buffered_blocks, list) {
-		if (chunk->dirty) {
-			blk->ops->write(blk, chunk->data, chunk->block_start, blk->rdbufsize);
-			chunk->dirty = 0;
-		}
+		ret = chunk_writeback(blk, chunk);
+		if (ret)
+			return ret;
 	}
 
 	if (blk->ops->flush)
@@ -62,28 +95,45 @@ static int writebuffer_flush(struct block_device *blk)
 }
 
 /*
- * get the chunk containing a given block. Will return NULL if the
- * block is not cached, the chunk otherwise.
+ * find the chunk containing a given block in the lookup table.
+ * Will return NULL if the block is not cached.
  */
-static struct chunk *chunk_get_cached(struct block_device *blk, int block)
+static struct chunk *chunk_lookup(struct block_device *blk, int block)
 {
 	struct chunk *chunk;
+	struct hlist_node *pos;
+	int block_start = block & ~blk->blkmask;
 
-	list_for_each_entry(chunk, &blk->buffered_blocks, list) {
-		if (block >= chunk->block_start &&
-				block < chunk->block_start + blk->rdbufsize) {
-			debug("%s: found %d in %d\n", __func__, block, chunk->num);
-			/*
-			 * move most recently used entry to the head of the list
-			 */
-			list_move(&chunk->list, &blk->buffered_blocks);
+	hlist_for_each_entry(chunk, pos, chunk_hash_head(blk, block), hash) {
+		if (chunk->block_start == block_start)
 			return chunk;
-		}
 	}
 
 	return NULL;
 }
 
+/*
+ * get the chunk containing a given block. Will return NULL if the
+ * block is not cached, the chunk otherwise.
+ */
+static struct chunk *chunk_get_cached(struct block_device *blk, int block)
+{
+	struct chunk *chunk;
+
+	chunk = chunk_lookup(blk, block);
+	if (!chunk)
+		return NULL;
+
+	debug("%s: found %d in %d\n", __func__, block, chunk->num);
+
+	/*
+	 * move most recently used entry to the head of the list
+	 */
+	list_move(&chunk->list, &blk->buffered_blocks);
+
+	return chunk;
+}
+
 /*
  * Get the data pointer for a given block. Will return NULL if
  * the block is not cached, the data pointer otherwise.
@@ -99,6 +149,35 @@ static void *block_get_cached(struct block_device *blk, int block)
 	return chunk->data + (block - chunk->block_start) * BLOCKSIZE(blk);
 }
 
+/*
+ * Remove a chunk from the cache, writing it back to disk if
+ * necessary. The chunk is unlinked from all lists afterwards.
+ * If the write back fails the chunk stays cached and dirty.
+ */
+static int chunk_evict(struct block_device *blk, struct chunk *chunk)
+{
+	int ret;
+
+	if (!hlist_unhashed(&chunk->hash)) {
+		ret = chunk_writeback(blk, chunk);
+		if (ret)
+			return ret;
+		hlist_del_init(&chunk->hash);
+	}
+
+	list_del(&chunk->list);
+
+	return 0;
+}
+
+static void chunk_insert(struct block_device *blk, struct chunk *chunk,
+		int block_start)
+{
+	chunk->block_start = block_start;
+	hlist_add_head(&chunk->hash, chunk_hash_head(blk, block_start));
+	list_add(&chunk->list, &blk->buffered_blocks);
+}
+
 /*
  * Get a data chunk, either from the idle list or if the idle list
  * is empty, the least recently used is written back to disk and
@@ -107,56 +186,130 @@ static void *block_get_cached(struct block_device *blk, int block)
 static struct chunk *get_chunk(struct block_device *blk)
 {
 	struct chunk *chunk;
+	int ret;
 
-	if (list_empty(&blk->idle_blocks)) {
+	if (list_empty(&blk->idle_blocks))
 		/* use last entry which is the most unused */
 		chunk = list_last_entry(&blk->buffered_blocks, struct chunk, list);
-		if (chunk->dirty) {
-			size_t num_blocks = min(blk->rdbufsize,
-					blk->num_blocks - chunk->block_start);
-			blk->ops->write(blk, chunk->data, chunk->block_start,
-					num_blocks);
-			chunk->dirty = 0;
-		}
-
-		list_del(&chunk->list);
-	} else {
+	else
 		chunk = list_first_entry(&blk->idle_blocks, struct chunk, list);
-		list_del(&chunk->list);
-	}
+
+	ret = chunk_evict(blk, chunk);
+	if (ret)
+		return ERR_PTR(ret);
 
 	return chunk;
 }
 
 /*
- * read a block into the cache. This assumes that the block is
- * not cached already. By definition block_get_cached() for
- * the same block will succeed after this call.
+ * read a single chunk into the cache.
  */
-static int block_cache(struct block_device *blk, int block)
+static int block_cache_one(struct block_device *blk, int block)
 {
 	struct chunk *chunk;
+	int block_start = block & ~blk->blkmask;
 	size_t num_blocks;
 	int ret;
 
 	chunk = get_chunk(blk);
-	chunk->block_start = block & ~blk->blkmask;
+	if (IS_ERR(chunk))
+		return PTR_ERR(chunk);
 
-	debug("%s: %d to %d\n", __func__, chunk->block_start,
-			chunk->num);
+	debug("%s: %d to %d\n", __func__, block_start, chunk->num);
 
-	num_blocks = min(blk->rdbufsize, blk->num_blocks - chunk->block_start);
+	num_blocks = min(blk->rdbufsize, blk->num_blocks - block_start);
 
-	ret = blk->ops->read(blk, chunk->data, chunk->block_start, num_blocks);
+	ret = blk->ops->read(blk, chunk->data, block_start, num_blocks);
 	if (ret) {
 		list_add_tail(&chunk->list, &blk->idle_blocks);
 		return ret;
 	}
-	list_add(&chunk->list, &blk->buffered_blocks);
+
+	chunk_insert(blk, chunk, block_start);
+	blk->ra_next = chunk_index(blk, block) + 1;
 
 	return 0;
 }
 
+/*
+ * Sequential access detected: read the requested chunk and up to
+ * blk->readahead chunks following it with a single device request.
+ * The chunks are taken from a window of adjacent slots in the cache
+ * buffer which rotates through the cache, so that a streaming reader
+ * effectively uses the cache as a ring buffer.
+ */
+static int block_cache_readahead(struct block_device *blk, int block)
+{
+	int block_start = block & ~blk->blkmask;
+	int n, i, slot, ret;
+	size_t num_blocks;
+
+	n = min(blk->readahead + 1, blk->cache_chunks / 2);
+
+	/* stop at the end of the device or at data we already have */
+	for (i = 1; i < n; i++) {
+		int b = block_start + i * blk->rdbufsize;
+
+		if (b >= blk->num_blocks || chunk_lookup(blk, b))
+			break;
+	}
+
+	n = i;
+	if (n < 2)
+		return block_cache_one(blk, block);
+
+	slot = blk->ra_slot;
+	if (slot + n > blk->cache_chunks)
+		slot = 0;
+
+	for (i = 0; i < n; i++) {
+		ret = chunk_evict(blk, &blk->chunks[slot + i]);
+		if (ret) {
+			while (i--)
+				list_add_tail(&blk->chunks[slot + i].list,
+						&blk->idle_blocks);
+			return ret;
+		}
+	}
+
+	debug("%s: %d to %d-%d\n", __func__, block_start, slot, slot + n - 1);
+
+	num_blocks = min(n * blk->rdbufsize, blk->num_blocks - block_start);
+
+	ret = blk->ops->read(blk, blk->chunks[slot].data, block_start,
+			num_blocks);
+	if (ret) {
+		for (i = 0; i < n; i++)
+			list_add_tail(&blk->chunks[slot + i].list,
+					&blk->idle_blocks);
+		return ret;
+	}
+
+	/* insert backwards so that the requested chunk is the most recent */
+	for (i = n - 1; i >= 0; i--)
+		chunk_insert(blk, &blk->chunks[slot + i],
+				block_start + i * blk->rdbufsize);
+
+	blk->ra_slot = slot + n;
+	blk->ra_next = chunk_index(blk, block) + n;
+	blk->cache_prefetched += n - 1;
+
+	return 0;
+}
+
+/*
+ * read a block into the cache. This assumes that the block is
+ * not cached already. By definition block_get_cached() for
+ * the same block will succeed after this call.
+ */
+static int block_cache(struct block_device *blk, int block)
+{
+	if (blk->readahead && chunk_index(blk, block) == blk->ra_next)
+		return block_cache_readahead(blk, block);
+
+	return block_cache_one(blk, block);
+}
+
 /*
  * Get the data for a block, either from the cache or from
  * the device.
@@ -170,8 +323,12 @@ static void *block_get(struct block_device *blk, int block)
 		return ERR_PTR(-ENXIO);
 
 	outdata = block_get_cached(blk, block);
-	if (outdata)
+	if (outdata) {
+		blk->cache_hits++;
 		return outdata;
+	}
+
+	blk->cache_misses++;
 
 	ret = block_cache(blk, block);
 	if (ret)
@@ -184,6 +341,64 @@ static void *block_get(struct block_device *blk, int block)
 	return outdata;
 }
 
+/*
+ * Return the number of blocks starting at @block which can be read
+ * directly into the caller's buffer, bypassing the cache. This is the
+ * case for reads of at least two whole chunks into a buffer suitable
+ * for DMA.
+ */
+static int block_direct_blocks(struct block_device *blk, void *buf,
+		int block, int num_blocks)
+{
+	if (!IS_ALIGNED((unsigned long)buf, DMA_ALIGNMENT))
+		return 0;
+
+	if (block & blk->blkmask)
+		return 0;
+
+	num_blocks &= ~blk->blkmask;
+	if (num_blocks < 2 * blk->rdbufsize)
+		return 0;
+
+	if (block + num_blocks > blk->num_blocks)
+		return 0;
+
+	return num_blocks;
+}
+
+/*
+ * Read whole chunks directly from the device into @buf. Dirty chunks
+ * in the cache are newer than the data on the device, so they are
+ * copied over the freshly read data afterwards.
+ */
+static int block_read_direct(struct block_device *blk, void *buf,
+		int block, int num_blocks)
+{
+	struct chunk *chunk;
+	int ret;
+
+	debug("%s: %d blocks at %d\n", __func__, num_blocks, block);
+
+	ret = blk->ops->read(blk, buf, block, num_blocks);
+	if (ret)
+		return ret;
+
+	blk->cache_misses += num_blocks;
+
+	list_for_each_entry(chunk, &blk->buffered_blocks, list) {
+		if (!chunk->dirty || chunk->block_start < block ||
+				chunk->block_start >= block + num_blocks)
+			continue;
+
+		memcpy(buf + ((chunk->block_start - block) << blk->blockbits),
+				chunk->data, blk->rdbufsize << blk->blockbits);
+	}
+
+	blk->ra_next = chunk_index(blk, block + num_blocks);
+
+	return 0;
+}
+
 static ssize_t block_op_read(struct cdev *cdev, void *buf, size_t count,
 		loff_t offset, unsigned long flags)
 {
@@ -211,8 +426,23 @@ static ssize_t block_op_read(struct cdev *cdev, void *buf, size_t count,
 	blocks = count >> blk->blockbits;
 
 	while (blocks) {
-		void *iobuf = block_get(blk, block);
+		int direct = block_direct_blocks(blk, buf, block, blocks);
+		void *iobuf;
+
+		if (direct) {
+			int ret = block_read_direct(blk, buf, block, direct);
+
+			if (ret)
+				return ret;
 
+			buf += direct << blk->blockbits;
+			blocks -= direct;
+			block += direct;
+			count -= direct << blk->blockbits;
+			continue;
+		}
+
+		iobuf = block_get(blk, block);
 		if (IS_ERR(iobuf))
 			return PTR_ERR(iobuf);
 
@@ -316,6 +546,7 @@ static ssize_t block_op_write(struct cdev *cdev, const void *buf, size_t count,
 
 	return icount;
 }
+
 #endif
 
 static int block_op_close(struct cdev *cdev)
@@ -342,31 +573,174 @@ static struct file_operations block_ops = {
 	.lseek	= dev_lseek_default,
 };
 
+/*
+ * Allocate the chunk cache according to blk->cache_chunks and
+ * blk->chunk_size. All chunks live in one contiguous buffer so that
+ * adjacent slots can be filled with a single device request. The
+ * sizes can be set by the user, so the buffers are allocated with
+ * functions which fail instead of panicking when out of memory.
+ * A cache allocated before is not freed.
+ */
+static int block_cache_alloc(struct block_device *blk)
+{
+	struct hlist_head *chunk_hash;
+	struct chunk *chunks;
+	void *cache;
+	int i, hash_size;
+
+	if (blk->cache_chunks > INT_MAX / blk->chunk_size)
+		return -EINVAL;
+
+	hash_size = roundup_pow_of_two(blk->cache_chunks);
+	chunk_hash = calloc(hash_size, sizeof(*chunk_hash));
+	chunks = calloc(blk->cache_chunks, sizeof(*chunks));
+	cache = memalign(DMA_ALIGNMENT, blk->cache_chunks * blk->chunk_size);
+	if (!chunk_hash || !chunks || !cache) {
+		free(chunk_hash);
+		free(chunks);
+		free(cache);
+		return -ENOMEM;
+	}
+
+	blk->rdbufsize = blk->chunk_size >> blk->blockbits;
+	blk->blkmask = blk->rdbufsize - 1;
+	blk->chunkbits = ilog2(blk->rdbufsize);
+
+	blk->chunk_hash = chunk_hash;
+	blk->chunk_hash_mask = hash_size - 1;
+	blk->chunks = chunks;
+	blk->cache = cache;
+
+	INIT_LIST_HEAD(&blk->buffered_blocks);
+	INIT_LIST_HEAD(&blk->idle_blocks);
+
+	for (i = 0; i < blk->cache_chunks; i++) {
+		struct chunk *chunk = &blk->chunks[i];
+
+		chunk->data = blk->cache + i * blk->chunk_size;
+		chunk->num = i;
+		INIT_HLIST_NODE(&chunk->hash);
+		list_add_tail(&chunk->list, &blk->idle_blocks);
+	}
+
+	blk->ra_slot = 0;
+	blk->ra_next = -1;
+
+	debug("%s: rdbufsize: %d blockbits: %d blkmask: 0x%08x chunks: %d\n",
+			__func__, blk->rdbufsize, blk->blockbits, blk->blkmask,
+			blk->cache_chunks);
+
+	return 0;
+}
+
+static void block_cache_free(void *cache, struct chunk *chunks,
+		struct hlist_head *chunk_hash)
+{
+	free(cache);
+	free(chunks);
+	free(chunk_hash);
+}
+
+static int block_cache_param_set(struct param_d *p, void *priv)
+{
+	struct block_device *blk = priv;
+	struct hlist_head *chunk_hash = blk->chunk_hash;
+	struct chunk *chunks = blk->chunks;
+	void *cache = blk->cache;
+	int ret;
+
+	if (blk->cache_chunks < 2 || blk->chunk_size < BLOCKSIZE(blk) ||
+			!is_power_of_2(blk->chunk_size))
+		return -EINVAL;
+
+	ret = writebuffer_flush(blk);
+	if (ret)
+		return ret;
+
+	/*
+	 * On failure the old cache stays in use, the parameter code
+	 * restores the old value.
+	 */
+	ret = block_cache_alloc(blk);
+	if (ret)
+		return ret;
+
+	block_cache_free(cache, chunks, chunk_hash);
+
+	return 0;
+}
+
+static int block_readahead_param_set(struct param_d *p, void *priv)
+{
+	struct block_device *blk = priv;
+
+	if (blk->readahead < 0)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int block_stat_param_set(struct param_d *p, void *priv)
+{
+	return -EPERM;
+}
+
+static void block_add_param(struct block_device *blk, int idx,
+		const char *name, int (*set)(struct param_d *p, void *priv),
+		int *value)
+{
+	struct param_d *p;
+	char *pname;
+
+	/* block devices may share a device, e.g. MMC boot partitions */
+	if (blk->cdev.partname)
+		pname = asprintf("%s_%s", blk->cdev.partname, name);
+	else
+		pname = xstrdup(name);
+
+	p = dev_add_param_int(blk->dev, pname, set, NULL, value, "%d", blk);
+	if (!IS_ERR(p))
+		blk->params[idx] = p;
+
+	free(pname);
+}
+
+static void block_add_params(struct block_device *blk)
+{
+	if (!blk->dev)
+		return;
+
+	block_add_param(blk, 0, "cache_chunks", block_cache_param_set,
+			&blk->cache_chunks);
+	block_add_param(blk, 1, "cache_chunksize", block_cache_param_set,
+			&blk->chunk_size);
+	block_add_param(blk, 2, "cache_readahead", block_readahead_param_set,
+			&blk->readahead);
+	block_add_param(blk, 3, "cache_hits", block_stat_param_set,
+			&blk->cache_hits);
+	block_add_param(blk, 4, "cache_misses", block_stat_param_set,
+			&blk->cache_misses);
+	block_add_param(blk, 5, "cache_prefetched", block_stat_param_set,
+			&blk->cache_prefetched);
+}
+
 int blockdevice_register(struct block_device *blk)
 {
 	loff_t size = (loff_t)blk->num_blocks * BLOCKSIZE(blk);
 	int ret;
-	int i;
 
 	blk->cdev.size = size;
 	blk->cdev.dev = blk->dev;
 	blk->cdev.ops = &block_ops;
 	blk->cdev.priv = blk;
-	blk->rdbufsize = BUFSIZE >> blk->blockbits;
 
-	INIT_LIST_HEAD(&blk->buffered_blocks);
-	INIT_LIST_HEAD(&blk->idle_blocks);
-	blk->blkmask = blk->rdbufsize - 1;
-
-	debug("%s: rdbufsize: %d blockbits: %d blkmask: 0x%08x\n", __func__, blk->rdbufsize, blk->blockbits,
-			blk->blkmask);
+	blk->chunk_size = max(BUFSIZE, BLOCKSIZE(blk));
+	blk->cache_chunks = BLOCK_CACHE_CHUNKS;
+	blk->readahead = BLOCK_READAHEAD;
 
-	for (i = 0; i < 8; i++) {
-		struct chunk *chunk = xzalloc(sizeof(*chunk));
-		chunk->data = dma_alloc(BUFSIZE);
-		chunk->num = i;
-		list_add_tail(&chunk->list, &blk->idle_blocks);
-	}
+	ret = block_cache_alloc(blk);
+	if (ret)
+		return ret;
 
 	ret = devfs_create(&blk->cdev);
 	if (ret)
@@ -374,24 +748,24 @@ int blockdevice_register(struct block_device *blk)
 
 	list_add_tail(&blk->list, &block_device_list);
 
+	block_add_params(blk);
+
 	return 0;
 }
 
 int blockdevice_unregister(struct block_device *blk)
 {
-	struct chunk *chunk, *tmp;
+	int i;
 
 	writebuffer_flush(blk);
 
-	list_for_each_entry_safe(chunk, tmp, &blk->buffered_blocks, list) {
-		dma_free(chunk->data);
-		free(chunk);
+	for (i = 0; i < ARRAY_SIZE(blk->params); i++) {
+		if (blk->params[i])
+			dev_remove_param(blk->params[i]);
+		blk->params[i] = NULL;
 	}
 
-	list_for_each_entry_safe(chunk, tmp, &blk->idle_blocks, list) {
-		dma_free(chunk->data);
-		free(chunk);
-	}
+	block_cache_free(blk->cache, blk->chunks, blk->chunk_hash);
 
 	devfs_remove(&blk->cdev);
 	list_del(&blk->list);
@@ -14,12 +14,14 @@
 #include <common.h>
 #include <boot.h>
 #include <fs.h>
+#include <fcntl.h>
 #include <malloc.h>
 #include <memory.h>
 #include <libfile.h>
 #include <image-fit.h>
 #include <globalvar.h>
 #include <init.h>
+#include <uncompress.h>
 #include <linux/stat.h>
 
 static LIST_HEAD(handler_list);
@@ -102,14 +104,21 @@ int bootm_load_os(struct image_data *data, unsigned long load_address)
 	if (load_address == UIMAGE_INVALID_ADDRESS)
 		return -EINVAL;
 
-	if (data->os_fit) {
+	if (IS_ENABLED(CONFIG_FITIMAGE) && data->os_fit) {
+		int ret;
+
 		data->os_res = request_sdram_region("kernel",
 				load_address,
-				data->os_fit->kernel_size);
+				data->os_fit->kernel.size);
 		if (!data->os_res)
 			return -ENOMEM;
-		memcpy((void *)load_address, data->os_fit->kernel,
-		       data->os_fit->kernel_size);
+		ret = fit_load_image(data->os_fit, &data->os_fit->kernel,
+				(void *)load_address);
+		if (ret) {
+			release_sdram_region(data->os_res);
+			data->os_res = NULL;
+			return ret;
+		}
 		return 0;
 	}
 
@@ -127,7 +136,12 @@ int bootm_load_os(struct image_data *data, unsigned long load_address)
 	}
 
 	if (data->os_file) {
-		data->os_res = file_to_sdram(data->os_file, load_address);
+		if (data->os_compression)
+			data->os_res = file_uncompress_to_sdram(data->os_file,
+					load_address);
+		else
+			data->os_res = file_to_sdram(data->os_file,
+					load_address);
 		if (!data->os_res)
 			return -ENOMEM;
 
@@ -142,7 +156,7 @@ bool bootm_has_initrd(struct image_data *data)
 	if (!IS_ENABLED(CONFIG_CMD_BOOTM_INITRD))
 		return false;
 
-	if (data->os_fit && data->os_fit->initrd)
+	if (data->os_fit && data->os_fit->initrd.node)
 		return true;
 
 	if (data->initrd_file)
@@ -153,20 +167,14 @@ bool bootm_has_initrd(struct image_data *data)
 
 static int bootm_open_initrd_uimage(struct image_data *data)
 {
-	int ret;
-
 	if (strcmp(data->os_file, data->initrd_file)) {
 		data->initrd = uimage_open(data->initrd_file);
 		if (!data->initrd)
 			return -EINVAL;
 
-		if (bootm_get_verify_mode() > BOOTM_VERIFY_NONE) {
-			ret = uimage_verify(data->initrd);
-			if (ret) {
-				printf("Checking data crc failed with %s\n",
-					strerror(-ret));
-			}
-		}
+		/* The data crc is checked while the initrd is loaded */
+		if (bootm_get_verify_mode() > BOOTM_VERIFY_NONE)
+			data->initrd->verify = 1;
 		uimage_print_contents(data->initrd);
 	} else {
 		data->initrd = data->os;
@@ -202,14 +210,20 @@ int bootm_load_initrd(struct image_data *data, unsigned long load_address)
 	if (data->initrd_res)
 		return 0;
 
-	if (data->os_fit && data->os_fit->initrd) {
+	if (IS_ENABLED(CONFIG_FITIMAGE) && data->os_fit &&
+	    data->os_fit->initrd.node) {
 		data->initrd_res = request_sdram_region("initrd",
 				load_address,
-				data->os_fit->initrd_size);
+				data->os_fit->initrd.size);
 		if (!data->initrd_res)
 			return -ENOMEM;
-		memcpy((void *)load_address, data->os_fit->initrd,
-		       data->os_fit->initrd_size);
+		ret = fit_load_image(data->os_fit, &data->os_fit->initrd,
+				(void *)load_address);
+		if (ret) {
+			release_sdram_region(data->initrd_res);
+			data->initrd_res = NULL;
+			return ret;
+		}
 		printf("Loaded initrd from FIT image\n");
 		goto done1;
 	}
@@ -326,8 +340,8 @@ int bootm_load_devicetree(struct image_data *data, unsigned long load_address)
 	if (!IS_ENABLED(CONFIG_OFTREE))
 		return 0;
 
-	if (data->os_fit && data->os_fit->oftree) {
-		data->of_root_node = of_unflatten_dtb(data->os_fit->oftree);
+	if (data->os_fit && data->os_fit->oftree.data) {
+		data->of_root_node = of_unflatten_dtb(data->os_fit->oftree.data);
 	} else if (data->oftree_file) {
 		size_t size;
 
@@ -409,6 +423,36 @@ int bootm_load_devicetree(struct image_data *data, unsigned long load_address)
 	return 0;
 }
 
+/*
+ * gzip stores the uncompressed size in the last four bytes. For the other
+ * formats we only know the compressed size, which is a lower bound only. The
+ * sdram region of the image grows while it is uncompressed, so anything placed
+ * behind the image has to be placed behind the region after bootm_load_os().
+ */
+static int bootm_get_os_uncompressed_size(struct image_data *data,
+		loff_t size)
+{
+	__le32 isize;
+	int fd, ret;
+
+	if (data->os_compression != filetype_gzip || size < sizeof(isize))
+		return size;
+
+	fd = open(data->os_file, O_RDONLY);
+	if (fd < 0)
+		return size;
+
+	if (lseek(fd, size - sizeof(isize), SEEK_SET) == size - sizeof(isize) &&
+	    read_full(fd, &isize, sizeof(isize)) == sizeof(isize))
+		ret = le32_to_cpu(isize);
+	else
+		ret = size;
+
+	close(fd);
+
+	return ret;
+}
+
 int bootm_get_os_size(struct image_data *data)
 {
 	int ret;
@@ -416,13 +460,15 @@ int bootm_get_os_size(struct image_data *data)
 	if (data->os)
 		return uimage_get_size(data->os, uimage_part_num(data->os_part));
 	if (data->os_fit)
-		return data->os_fit->kernel_size;
+		return data->os_fit->kernel.size;
 
 	if (data->os_file) {
 		struct stat s;
 		ret = stat(data->os_file, &s);
 		if (ret)
 			return ret;
+		if (data->os_compression)
+			return bootm_get_os_uncompressed_size(data, s.st_size);
 		return s.st_size;
 	}
 
@@ -431,21 +477,13 @@ int bootm_get_os_size(struct image_data *data)
 
 static int bootm_open_os_uimage(struct image_data *data)
 {
-	int ret;
-
 	data->os = uimage_open(data->os_file);
 	if (!data->os)
 		return -EINVAL;
 
-	if (bootm_get_verify_mode() > BOOTM_VERIFY_NONE) {
-		ret = uimage_verify(data->os);
-		if (ret) {
-			printf("Checking data crc failed with %s\n",
-					strerror(-ret));
-			uimage_close(data->os);
-			return ret;
-		}
-	}
+	/* The data crc is checked while the image is loaded */
+	if (bootm_get_verify_mode() > BOOTM_VERIFY_NONE)
+		data->os->verify = 1;
 
 	uimage_print_contents(data->os);
 
@@ -530,6 +568,26 @@ int bootm_boot(struct bootm_data *bootm_data)
 		goto err_out;
 	}
 
+	/*
+	 * Compressed kernels are uncompressed to their load address while
+	 * they are read, the handler is chosen by the uncompressed content.
+	 */
+	if (filetype_is_compressed(os_type)) {
+		enum filetype type = uncompress_file_detect_type(data->os_file);
+
+		if (type == filetype_uimage || type == filetype_oftree) {
+			printf("compressed %s images are not supported\n",
+					file_type_to_string(type));
+			ret = -EINVAL;
+			goto err_out;
+		}
+
+		if ((int)type >= 0) {
+			data->os_compression = os_type;
+			os_type = type;
+		}
+	}
+
 	if (!data->force && os_type == filetype_unknown) {
 		printf("Unknown OS filetype (try -f)\n");
 		ret = -EINVAL;
@@ -578,6 +636,8 @@ int bootm_boot(struct bootm_data *bootm_data)
 
 	printf("\nLoading %s '%s'", file_type_to_string(os_type),
 			data->os_file);
+	if (data->os_compression)
+		printf(", %s", file_type_to_string(data->os_compression));
 	if (os_type == filetype_uimage &&
 			data->os->header.ih_type == IH_TYPE_MULTI)
 		printf(", multifile image %d", uimage_part_num(data->os_part));
@@ -596,6 +656,14 @@ int bootm_boot(struct bootm_data *bootm_data)
 		goto err_out;
 	}
 
+	if (data->os_compression && !handler->compressed) {
+		printf("%s handler cannot boot %s compressed images\n",
+				handler->name,
+				file_type_to_string(data->os_compression));
+		ret = -EINVAL;
+		goto err_out;
+	}
+
 	if (bootm_verbose(data)) {
 		bootm_print_info(data);
 		printf("Passing control to %s handler\n", handler->name);
@@ -61,6 +61,7 @@ static const struct filetype_str filetype_str[] = {
 	[filetype_xz_compressed] = { "XZ compressed", "xz" },
 	[filetype_exe] = { "MS-DOS executable", "exe" },
 	[filetype_mxs_bootstream] = { "Freescale MXS bootstream", "mxsbs" },
+	[filetype_zstd_compressed] = { "ZSTD compressed", "zstd" },
 };
 
 const char *file_type_to_string(enum filetype f)
@@ -277,6 +278,9 @@ enum filetype file_detect_type(const void *_buf, size_t bufsize)
 	if (buf8[0] == 0xfd && buf8[1] == 0x37 && buf8[2] == 0x7a &&
 			buf8[3] == 0x58 && buf8[4] == 0x5a && buf8[5] == 0x00)
 		return filetype_xz_compressed;
+	if (buf8[0] == 0x28 && buf8[1] == 0xb5 && buf8[2] == 0x2f &&
+			buf8[3] == 0xfd)
+		return filetype_zstd_compressed;
 	if (buf[0] == be32_to_cpu(0xd00dfeed))
 		return filetype_oftree;
 	if (strncmp(buf8, "ANDROID!", 8) == 0)
@@ -371,6 +375,21 @@ err_out:
 	return type;
 }
 
+bool filetype_is_compressed(enum filetype ft)
+{
+	switch (ft) {
+	case filetype_gzip:
+	case filetype_bzip2:
+	case filetype_lzo_compressed:
+	case filetype_lz4_compressed:
+	case filetype_xz_compressed:
+	case filetype_zstd_compressed:
+		return true;
+	default:
+		return false;
+	}
+}
+
 bool filetype_is_barebox_image(enum filetype ft)
 {
 	switch (ft) {
@@ -26,6 +26,7 @@
 #include <digest.h>
 #include <of.h>
 #include <fs.h>
+#include <fcntl.h>
 #include <malloc.h>
 #include <linux/ctype.h>
 #include <asm/byteorder.h>
@@ -34,10 +35,22 @@
 #include <stringlist.h>
 #include <rsa.h>
 #include <image-fit.h>
+#include <linux/sizes.h>
 
 #define FDT_MAX_DEPTH 32
 #define FDT_MAX_PATH_LEN 200
 
+/*
+ * When the FIT file can be seeked, image data of at least FIT_STREAM_MIN
+ * bytes is skipped when the FIT is opened and read directly to the load
+ * address of the image later. Images are loaded in chunks of FIT_LOAD_CHUNK
+ * bytes which are hashed right after they have been copied, while they are
+ * still in the cache.
+ */
+#define FIT_STREAM_MIN	SZ_64K
+#define FIT_LOAD_CHUNK	SZ_128K
+#define FIT_MAX_HASHES	4
+
 #define CHECK_LEVEL_NONE 0
 #define CHECK_LEVEL_HASH 1
 #define CHECK_LEVEL_SIG 2
@@ -317,6 +330,9 @@ static int fit_verify_signature(struct device_node *sig_node, void *fit)
 	}
 
 	string_list_add(&exc_props, "data");
+	string_list_add(&exc_props, "data-size");
+	string_list_add(&exc_props, "data-position");
+	string_list_add(&exc_props, "data-offset");
 
 	digest_init(digest);
 	ret = fit_digest(fit, digest, &inc_nodes, &exc_props, hashed_strings_start, hashed_strings_size);
@@ -342,41 +358,50 @@ static int fit_verify_signature(struct device_node *sig_node, void *fit)
 	return ret;
 }
 
-static int fit_verify_hash(struct device_node *hash, const void *data, int data_len)
+/* Set up the digest for a hash node */
+static struct digest *fit_hash_start(struct device_node *hash)
 {
 	struct digest *d;
 	const char *algo;
-	const char *value_read;
-	char *value_calc;
-	int hash_len, ret;
+	int hash_len;
 
-	value_read = of_get_property(hash, "value", &hash_len);
-	if (!value_read) {
+	if (!of_get_property(hash, "value", &hash_len)) {
 		pr_err("%s: \"value\" property not found\n", hash->full_name);
-		return -EINVAL;
+		return ERR_PTR(-EINVAL);
 	}
 
 	if (of_property_read_string(hash, "algo", &algo)) {
 		pr_err("%s: \"algo\" property not found\n", hash->full_name);
-		return -EINVAL;
+		return ERR_PTR(-EINVAL);
 	}
 
 	d = digest_alloc(algo);
 	if (!d) {
 		pr_err("%s: unsupported algo %s\n", hash->full_name, algo);
-		return -EINVAL;
+		return ERR_PTR(-EINVAL);
 	}
 
 	if (hash_len != digest_length(d)) {
 		pr_err("%s: invalid hash length %d\n", hash->full_name, hash_len);
-		ret = -EINVAL;
-		goto err_digest_free;
+		digest_free(d);
+		return ERR_PTR(-EINVAL);
 	}
 
+	digest_init(d);
+
+	return d;
+}
+
+/* Compare the digest with the value of the hash node and free it */
+static int fit_hash_check(struct device_node *hash, struct digest *d)
+{
+	const char *value_read;
+	char *value_calc;
+	int hash_len, ret;
+
+	value_read = of_get_property(hash, "value", &hash_len);
 	value_calc = xmalloc(hash_len);
 
-	digest_init(d);
-	digest_update(d, data, data_len);
 	digest_final(d, value_calc);
 
 	if (memcmp(value_read, value_calc, hash_len)) {
@@ -388,21 +413,43 @@ static int fit_verify_hash(struct device_node *hash, const void *data, int data_
 	}
 
 	free(value_calc);
-
-err_digest_free:
 	digest_free(d);
 
 	return ret;
 }
 
-static int fit_open_image(struct fit_handle *handle, const char *unit, const void **outdata,
-	unsigned long *outsize)
+/*
+ * Find the data of an image which is not embedded in the FDT. It is either
+ * located after the FDT (external data FITs, data-offset) or anywhere in the
+ * file (data-position, also used for data skipped by fit_read_stream()).
+ */
+static int fit_image_position(struct fit_handle *handle,
+		struct device_node *image, struct fit_image *img)
 {
-	struct device_node *image = NULL, *hash;
+	u32 pos, size;
+
+	if (of_property_read_u32(image, "data-size", &size))
+		return -EINVAL;
+
+	if (!of_property_read_u32(image, "data-position", &pos))
+		img->pos = pos;
+	else if (!of_property_read_u32(image, "data-offset", &pos))
+		img->pos = handle->data_base + pos;
+	else
+		return -EINVAL;
+
+	img->size = size;
+
+	return 0;
+}
+
+static int fit_open_image(struct fit_handle *handle, const char *unit,
+		struct fit_image *img)
+{
+	struct device_node *image = NULL;
 	const char *type = NULL, *desc= "(no description)";
 	const void *data;
 	int data_len;
-	int ret = 0;
 
 	image = of_get_child_by_name(handle->root, "images");
 	if (!image)
@@ -421,29 +468,109 @@ static int fit_open_image(struct fit_handle *handle, const char *unit, const voi
 		return -EINVAL;
 	}
 
+	img->node = image;
+
 	data = of_get_property(image, "data", &data_len);
-	if (!data) {
-		pr_err("data not found\n");
-		return -EINVAL;
+	if (data) {
+		img->data = data;
+		img->size = data_len;
+	} else {
+		if (fit_image_position(handle, image, img)) {
+			pr_err("data not found\n");
+			return -EINVAL;
+		}
+
+		if (handle->fd < 0) {
+			/* The whole file is in memory */
+			if (img->pos + img->size > handle->size) {
+				pr_err("data outside of the file\n");
+				return -EINVAL;
+			}
+			img->data = handle->fit + img->pos;
+		}
 	}
 
+	return 0;
+}
+
+/**
+ * fit_load_image - copy the data of an image to its destination
+ * @handle: the FIT
+ * @img: the image, one of the images in @handle
+ * @dest: the destination, @img->size bytes
+ *
+ * Images which have not been read when the FIT was opened are read from the
+ * file directly to @dest. The hashes of the image are computed while it is
+ * copied, so verifying it takes no extra pass over the data.
+ *
+ * Return: 0 on success, negative error code otherwise
+ */
+int fit_load_image(struct fit_handle *handle, struct fit_image *img, void *dest)
+{
+	struct device_node *hash, *hashes[FIT_MAX_HASHES];
+	struct digest *d[FIT_MAX_HASHES];
+	unsigned long done, now;
+	int i, num = 0, ret;
+
 	if (handle->verify > BOOTM_VERIFY_NONE) {
-		ret = -EINVAL;
-		for_each_child_of_node(image, hash) {
+		for_each_child_of_node(img->node, hash) {
+			if (num == FIT_MAX_HASHES) {
+				pr_err("%s: too many hashes\n", img->node->full_name);
+				ret = -EINVAL;
+				goto out;
+			}
 			if (handle->verbose)
 				of_print_nodes(hash, 0);
-			ret = fit_verify_hash(hash, data, data_len);
+			d[num] = fit_hash_start(hash);
+			if (IS_ERR(d[num])) {
+				ret = PTR_ERR(d[num]);
+				goto out;
+			}
+			hashes[num++] = hash;
+		}
+
+		if (!num)
+			return -EINVAL;
+	}
+
+	if (!img->data && lseek(handle->fd, img->pos, SEEK_SET) != img->pos) {
+		ret = -EIO;
+		goto out;
+	}
+
+	for (done = 0; done < img->size; done += now) {
+		now = min_t(unsigned long, img->size - done, FIT_LOAD_CHUNK);
+
+		if (img->data) {
+			memcpy(dest + done, img->data + done, now);
+		} else {
+			ret = read_full(handle->fd, dest + done, now);
 			if (ret < 0)
-				return ret;
+				goto out;
+			if (ret < now) {
+				ret = -EIO;
+				goto out;
+			}
 		}
+
+		for (i = 0; i < num; i++)
+			digest_update(d[i], dest + done, now);
 	}
-	if (ret < 0)
-		return ret;
 
-	*outdata = data;
-	*outsize = data_len;
+	ret = 0;
+	for (i = 0; i < num; i++) {
+		int err = fit_hash_check(hashes[i], d[i]);
 
-	return 0;
+		if (err)
+			ret = err;
+	}
+
+	return ret;
+out:
+	for (i = 0; i < num; i++)
+		digest_free(d[i]);
+
+	return ret;
 }
 
 static int fit_open_configuration(struct fit_handle *handle, const char *name)
@@ -487,7 +614,7 @@ static int fit_open_configuration(struct fit_handle *handle, const char *name)
 	}
 
 	if (of_property_read_string(conf_node, "kernel", &unit) == 0) {
-		ret = fit_open_image(handle, unit, &handle->kernel, &handle->kernel_size);
+		ret = fit_open_image(handle, unit, &handle->kernel);
 		if (ret)
 			return ret;
 	} else {
@@ -495,13 +622,21 @@ static int fit_open_configuration(struct fit_handle *handle, const char *name)
 	}
 
 	if (of_property_read_string(conf_node, "fdt", &unit) == 0) {
-		ret = fit_open_image(handle, unit, &handle->oftree, &handle->oftree_size);
+		ret = fit_open_image(handle, unit, &handle->oftree);
 		if (ret)
 			return ret;
+
+		/* The device tree is needed in memory, verified */
+		handle->oftree_buf = xmalloc(handle->oftree.size);
+		ret = fit_load_image(handle, &handle->oftree,
+				handle->oftree_buf);
+		if (ret)
+			return ret;
+		handle->oftree.data = handle->oftree_buf;
 	}
 
 	if (of_property_read_string(conf_node, "ramdisk", &unit) == 0) {
-		ret = fit_open_image(handle, unit, &handle->initrd, &handle->initrd_size);
+		ret = fit_open_image(handle, unit, &handle->initrd);
 		if (ret)
 			return ret;
 	}
@@ -509,6 +644,220 @@ static int fit_open_configuration(struct fit_handle *handle, const char *name)
 	return 0;
 }
 
+static int fit_pread(int fd, loff_t pos, void *buf, size_t size)
+{
+	int ret;
+
+	if (lseek(fd, pos, SEEK_SET) != pos)
+		return -ESPIPE;
+
+	ret = read_full(fd, buf, size);
+	if (ret < 0)
+		return ret;
+
+	return ret == size ? 0 : -EINVAL;
+}
+
+static int fit_read_u32(int fd, uint32_t *val)
+{
+	int ret;
+
+	ret = read_full(fd, val, sizeof(*val));
+	if (ret < 0)
+		return ret;
+
+	return ret == sizeof(*val) ? 0 : -EINVAL;
+}
+
+/* Append len bytes to the FDT being built, return a pointer to them */
+static void *fit_fdt_append(struct fit_handle *handle, size_t len)
+{
+	void *p;
+
+	handle->fit = xrealloc(handle->fit, handle->size + len);
+	p = handle->fit + handle->size;
+	handle->size += len;
+
+	return p;
+}
+
+static void fit_fdt_append_u32(struct fit_handle *handle, uint32_t val)
+{
+	uint32_t *p = fit_fdt_append(handle, sizeof(val));
+
+	*p = cpu_to_fdt32(val);
+}
+
+/*
+ * Read the FDT of a FIT without the data of large images. Such "data"
+ * properties are replaced with "data-position" and "data-size" properties
+ * describing where in the file the data is. Signatures do not cover these
+ * properties, so they can still be checked on the FDT built here.
+ */
+static int fit_read_stream(struct fit_handle *handle)
+{
+	struct fdt_header hdr, *fdt;
+	uint32_t off_struct, size_struct, off_strings, size_strings;
+	uint32_t pos_nameoff, size_nameoff, pos, end, tag, len, alen, nameoff;
+	char *strings = NULL;
+	void *p;
+	int fd = handle->fd, ret;
+
+	ret = fit_pread(fd, 0, &hdr, sizeof(hdr));
+	if (ret)
+		return ret;
+
+	if (fdt32_to_cpu(hdr.magic) != FDT_MAGIC ||
+	    fdt32_to_cpu(hdr.version) < 17)
+		return -EINVAL;
+
+	off_struct = fdt32_to_cpu(hdr.off_dt_struct);
+	size_struct = fdt32_to_cpu(hdr.size_dt_struct);
+	off_strings = fdt32_to_cpu(hdr.off_dt_strings);
+	size_strings = fdt32_to_cpu(hdr.size_dt_strings);
+
+	if (off_struct < sizeof(hdr) || off_struct > SZ_64K ||
+	    size_struct > U32_MAX - off_struct || size_strings > SZ_1M)
+		return -EINVAL;
+
+	handle->data_base = ALIGN(fdt32_to_cpu(hdr.totalsize), 4);
+
+	/* The strings plus the names of the properties we add */
+	pos_nameoff = size_strings;
+	size_nameoff = pos_nameoff + sizeof("data-position");
+	strings = xmalloc(size_nameoff + sizeof("data-size"));
+
+	ret = fit_pread(fd, off_strings, strings, size_strings);
+	if (ret)
+		goto out;
+
+	strcpy(strings + pos_nameoff, "data-position");
+	strcpy(strings + size_nameoff, "data-size");
+
+	/* Header and memory reserve map */
+	ret = fit_pread(fd, 0, fit_fdt_append(handle, off_struct), off_struct);
+	if (ret)
+		goto out;
+
+	pos = off_struct;
+	end = off_struct + size_struct;
+
+	/*
+	 * The lengths come from the image, they are only compared against
+	 * the space left, end - pos, so that pos can't wrap around.
+	 */
+	do {
+		if (end - pos < 4) {
+			ret = -EINVAL;
+			goto out;
+		}
+
+		ret = fit_read_u32(fd, &tag);
+		if (ret)
+			goto out;
+		pos += 4;
+
+		switch (fdt32_to_cpu(tag)) {
+		case FDT_BEGIN_NODE:
+			*(uint32_t *)fit_fdt_append(handle, 4) = tag;
+			/* the name, padded to 4 bytes */
+			do {
+				if (end - pos < 4) {
+					ret = -EINVAL;
+					goto out;
+				}
+				p = fit_fdt_append(handle, 4);
+				ret = read_full(fd, p, 4);
+				if (ret != 4) {
+					ret = -EINVAL;
+					goto out;
+				}
+				pos += 4;
+			} while (!memchr(p, 0, 4));
+			break;
+		case FDT_END_NODE:
+		case FDT_NOP:
+		case FDT_END:
+			*(uint32_t *)fit_fdt_append(handle, 4) = tag;
+			break;
+		case FDT_PROP:
+			if (end - pos < 8) {
+				ret = -EINVAL;
+				goto out;
+			}
+			ret = fit_read_u32(fd, &len);
+			if (ret)
+				goto out;
+			ret = fit_read_u32(fd, &nameoff);
+			if (ret)
+				goto out;
+			pos += 8;
+
+			len = fdt32_to_cpu(len);
+			alen = ALIGN(len, 4);
+			nameoff = fdt32_to_cpu(nameoff);
+			if (nameoff >= size_strings || alen < len ||
+			    alen > end - pos) {
+				ret = -EINVAL;
+				goto out;
+			}
+
+			if (len >= FIT_STREAM_MIN &&
+			    !strcmp(strings + nameoff, "data")) {
+				fit_fdt_append_u32(handle, FDT_PROP);
+				fit_fdt_append_u32(handle, 4);
+				fit_fdt_append_u32(handle, pos_nameoff);
+				fit_fdt_append_u32(handle, pos);
+				fit_fdt_append_u32(handle, FDT_PROP);
+				fit_fdt_append_u32(handle, 4);
+				fit_fdt_append_u32(handle, size_nameoff);
+				fit_fdt_append_u32(handle, len);
+
+				pos += alen;
+				if (lseek(fd, pos, SEEK_SET) != pos) {
+					ret = -ESPIPE;
+					goto out;
+				}
+				break;
+			}
+
+			*(uint32_t *)fit_fdt_append(handle, 4) = tag;
+			fit_fdt_append_u32(handle, len);
+			fit_fdt_append_u32(handle, nameoff);
+			p = fit_fdt_append(handle, alen);
+			ret = read_full(fd, p, alen);
+			if (ret != alen) {
+				ret = -EINVAL;
+				goto out;
+			}
+			pos += alen;
+			break;
+		default:
+			pr_err("%s: Unknown tag 0x%08x\n", __func__,
+					fdt32_to_cpu(tag));
+			ret = -EINVAL;
+			goto out;
+		}
+	} while (fdt32_to_cpu(tag) != FDT_END);
+
+	size_struct = handle->size - off_struct;
+	off_strings = handle->size;
+	size_strings = size_nameoff + sizeof("data-size");
+	memcpy(fit_fdt_append(handle, size_strings), strings, size_strings);
+
+	fdt = handle->fit;
+	fdt->totalsize = cpu_to_fdt32(handle->size);
+	fdt->size_dt_struct = cpu_to_fdt32(size_struct);
+	fdt->off_dt_strings = cpu_to_fdt32(off_strings);
+	fdt->size_dt_strings = cpu_to_fdt32(size_strings);
+
+	ret = 0;
+out:
+	free(strings);
+
+	return ret;
+}
+
 struct fit_handle *fit_open(const char *filename, const char *config, bool verbose,
 			    enum bootm_verify verify)
 {
@@ -520,10 +869,32 @@ struct fit_handle *fit_open(const char *filename, const char *config, bool verbo
 
 	handle->verbose = verbose;
 
-	ret = read_file_2(filename, &handle->size, &handle->fit, FILESIZE_MAX);
-	if (ret) {
-		pr_err("unable to read %s: %s\n", filename, strerror(-ret));
-		goto err;
+	/*
+	 * Read only the FDT and stream the images from the file later if
+	 * possible, otherwise read the whole file.
+	 */
+	handle->fd = open(filename, O_RDONLY);
+	if (handle->fd >= 0 && lseek(handle->fd, 0, SEEK_SET) == 0) {
+		ret = fit_read_stream(handle);
+		if (ret) {
+			pr_err("unable to read %s: %s\n", filename, strerror(-ret));
+			goto err;
+		}
+	} else {
+		if (handle->fd >= 0)
+			close(handle->fd);
+		handle->fd = -1;
+
+		ret = read_file_2(filename, &handle->size, &handle->fit,
+				FILESIZE_MAX);
+		if (ret) {
+			pr_err("unable to read %s: %s\n", filename, strerror(-ret));
+			goto err;
+		}
+
+		if (handle->size >= sizeof(struct fdt_header))
+			handle->data_base = ALIGN(fdt32_to_cpu(
+				((struct fdt_header *)handle->fit)->totalsize), 4);
 	}
 
 	handle->root = of_unflatten_dtb(handle->fit);
@@ -543,20 +914,19 @@ struct fit_handle *fit_open(const char *filename, const char *config, bool verbo
 
 	return handle;
  err:
-	if (handle->root)
-		of_delete_node(handle->root);
-	free(handle->fit);
-	free(handle);
+	fit_close(handle);
 
 	return ERR_PTR(ret);
 }
 
 void fit_close(struct fit_handle *handle)
 {
-	if (handle->root)
+	if (!IS_ERR_OR_NULL(handle->root))
 		of_delete_node(handle->root);
-	if (handle->fit)
-		free(handle->fit);
+	if (handle->fd >= 0)
+		close(handle->fd);
+	free(handle->oftree_buf);
+	free(handle->fit);
 	free(handle);
 }
 
@@ -564,8 +934,9 @@ void fit_close(struct fit_handle *handle)
 static int do_bootm_sandbox_fit(struct image_data *data)
 {
 	struct fit_handle *handle;
-	handle = fit_open(data->os_file, data->os_part, data->verbose);
-	if (handle)
+	handle = fit_open(data->os_file, data->os_part, data->verbose,
+			data->verify);
+	if (!IS_ERR(handle))
 		fit_close(handle);
 	return 0;
 }
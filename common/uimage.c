@@ -225,10 +225,49 @@ void uimage_close(struct uimage_handle *handle)
 EXPORT_SYMBOL(uimage_close);
 
 static int uimage_fd;
+static u32 uimage_crc;
+static u32 uimage_crc_left;
 
 static int uimage_fill(void *buf, unsigned int len)
 {
-	return read_full(uimage_fd, buf, len);
+	int ret;
+
+	ret = read_full(uimage_fd, buf, len);
+
+	/* checksum the data while it is still in the cache */
+	if (ret > 0 && uimage_crc_left) {
+		u32 now = min_t(u32, ret, uimage_crc_left);
+
+		uimage_crc = crc32(uimage_crc, buf, now);
+		uimage_crc_left -= now;
+	}
+
+	return ret;
+}
+
+static int uimage_load_crc_check(struct uimage_handle *handle)
+{
+	void *buf;
+	int ret = 0;
+
+	/* the decompressor may not have read the padding at the end */
+	if (uimage_crc_left) {
+		buf = xmalloc(uimage_crc_left);
+		ret = uimage_fill(buf, uimage_crc_left);
+		free(buf);
+		if (ret < 0)
+			return ret;
+		if (uimage_crc_left)
+			return -EIO;
+	}
+
+	if (uimage_crc != handle->header.ih_dcrc) {
+		printf("Bad Data CRC: 0x%08x != 0x%08x\n",
+				uimage_crc, handle->header.ih_dcrc);
+		return -EINVAL;
+	}
+
+	return 0;
 }
 
 static int uncompress_copy(unsigned char *inbuf_unused, int len,
@@ -299,7 +338,9 @@ err:
 EXPORT_SYMBOL(uimage_verify);
 
 /*
- * Load a uimage, flushing output to flush function
+ * Load a uimage, flushing output to flush function. If handle->verify is
+ * set the data crc is checked as well. For single images it is computed
+ * on the data while it is loaded.
  */
 int uimage_load(struct uimage_handle *handle, unsigned int image_no,
 		int(*flush)(void*, unsigned int))
@@ -319,6 +360,14 @@ int uimage_load(struct uimage_handle *handle, unsigned int image_no,
 
 	iha = &handle->ihd[image_no];
 
+	/* The crc of a multi image covers all of its images */
+	if (handle->verify && uimage_is_multi_image(handle)) {
+		ret = uimage_verify(handle);
+		if (ret)
+			return ret;
+		handle->verify = 0;
+	}
+
 	ret = lseek(handle->fd, iha->offset + handle->data_offset,
 			SEEK_SET);
 	if (ret < 0)
@@ -331,10 +380,20 @@ int uimage_load(struct uimage_handle *handle, unsigned int image_no,
 		uncompress_fn = uncompress;
 
 	uimage_fd = handle->fd;
+	uimage_crc = 0;
+	uimage_crc_left = handle->verify ? hdr->ih_size : 0;
 
 	ret = uncompress_fn(NULL, iha->len, uimage_fill, flush,
 				NULL, NULL,
 				uncompress_err_stdout);
+	if (!ret && handle->verify) {
+		ret = uimage_load_crc_check(handle);
+		if (!ret)
+			handle->verify = 0;
+	}
+
+	uimage_crc_left = 0;
+
 	return ret;
 }
 EXPORT_SYMBOL(uimage_load);
@@ -414,6 +473,49 @@ out:
 	return res;
 }
 
+/*
+ * Uncompress a compressed file to a dynamically allocated sdram resource
+ * while it is read. The resource grows with the uncompressed data, it must
+ * be freed afterwards with release_sdram_region.
+ */
+struct resource *file_uncompress_to_sdram(const char *filename,
+		unsigned long adr)
+{
+	int fd, ret;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	uimage_buf = (void *)adr;
+	uimage_size = 0;
+
+	uimage_resource = request_sdram_region("image", adr, BUFSIZ);
+	if (!uimage_resource) {
+		printf("unable to request SDRAM 0x%08lx-0x%08lx\n",
+			adr, adr + BUFSIZ - 1);
+		goto out;
+	}
+
+	ret = uncompress_fd_to_flush(fd, uimage_sdram_flush,
+			uncompress_err_stdout);
+	if (ret) {
+		release_sdram_region(uimage_resource);
+		uimage_resource = NULL;
+		goto out;
+	}
+
+	if (uimage_size < resource_size(uimage_resource)) {
+		release_sdram_region(uimage_resource);
+		uimage_resource = request_sdram_region("image", adr,
+				uimage_size);
+	}
+out:
+	close(fd);
+
+	return uimage_resource;
+}
+
 /*
  * Load an uImage to a dynamically allocated sdram resource.
  * the resource must be freed afterwards with release_sdram_region
@@ -464,6 +566,12 @@ void *uimage_load_to_buf(struct uimage_handle *handle, int image_no,
 	if (image_no >= handle->nb_data_entries)
 		return NULL;
 
+	if (handle->verify) {
+		if (uimage_verify(handle))
+			return NULL;
+		handle->verify = 0;
+	}
+
 	ihd = &handle->ihd[image_no];
 
 	ret = lseek(handle->fd, ihd->offset + handle->data_offset,
@@ -21,11 +21,17 @@
 #define STATIC static inline
 #endif
 
-#ifdef CONFIG_DYNAMIC_CRC_TABLE
-
+/*
+ * The CRC is computed eight bytes at a time ("slicing-by-8"): crc_table[0]
+ * is the classic byte-wise table, crc_table[k][n] is the CRC of byte n
+ * followed by k zero bytes. Eight lookups in independent tables replace
+ * eight dependent lookups in one table, which is several times faster on
+ * anything with a cache. The tables take 8KiB and are set up on first use.
+ */
 static int crc_table_empty = 1;
-static ulong crc_table[256];
-static void make_crc_table(void);
+static uint32_t crc_table[8][256];
+
+#ifdef CONFIG_DYNAMIC_CRC_TABLE
 
 /*
   Generate a table for a byte-wise 32-bit CRC calculation on the polynomial:
@@ -51,11 +57,11 @@ static void make_crc_table(void);
   the information needed to generate CRC's on data a byte at a time for all
   combinations of CRC register values and incoming bytes.
 */
-static void make_crc_table(void)
+static void make_crc_table0(void)
 {
-  ulong c;
+  uint32_t c;
   int n, k;
-  ulong poly;            /* polynomial exclusive-or pattern */
+  uint32_t poly;         /* polynomial exclusive-or pattern */
   /* terms of polynomial defining this crc (except x^32): */
   static const char p[] = {0,1,2,4,5,7,8,10,11,12,16,22,23,26};
 
@@ -66,18 +72,17 @@ static void make_crc_table(void)
 
   for (n = 0; n < 256; n++)
   {
-    c = (ulong)n;
+    c = (uint32_t)n;
     for (k = 0; k < 8; k++)
       c = c & 1 ? poly ^ (c >> 1) : c >> 1;
-    crc_table[n] = c;
+    crc_table[0][n] = c;
   }
-  crc_table_empty = 0;
 }
 #else
 /* ========================================================================
- * Table of CRC-32's of all single-byte values (made by make_crc_table)
+ * Table of CRC-32's of all single-byte values (made by make_crc_table0)
  */
-static const ulong crc_table[256] = {
+static const uint32_t crc_table0[256] = {
   0x00000000L, 0x77073096L, 0xee0e612cL, 0x990951baL, 0x076dc419L,
   0x706af48fL, 0xe963a535L, 0x9e6495a3L, 0x0edb8832L, 0x79dcb8a4L,
   0xe0d5e91eL, 0x97d2d988L, 0x09b64c2bL, 0x7eb17cbdL, 0xe7b82d07L,
@@ -131,34 +136,81 @@ static const ulong crc_table[256] = {
   0x5d681b02L, 0x2a6f2b94L, 0xb40bbe37L, 0xc30c8ea1L, 0x5a05df1bL,
   0x2d02ef8dL
 };
+
+static void make_crc_table0(void)
+{
+	memcpy(crc_table[0], crc_table0, sizeof(crc_table0));
+}
 #endif
 
+static void make_crc_table(void)
+{
+	uint32_t c;
+	int n, k;
 
-/* ========================================================================= */
-#define DO1(buf) crc = crc_table[((int)crc ^ (*buf++)) & 0xff] ^ (crc >> 8);
-#define DO2(buf)  DO1(buf); DO1(buf);
-#define DO4(buf)  DO2(buf); DO2(buf);
-#define DO8(buf)  DO4(buf); DO4(buf);
+	make_crc_table0();
+
+	for (n = 0; n < 256; n++) {
+		c = crc_table[0][n];
+		for (k = 1; k < 8; k++) {
+			c = crc_table[0][c & 0xff] ^ (c >> 8);
+			crc_table[k][n] = c;
+		}
+	}
+
+	crc_table_empty = 0;
+}
 
 /* ========================================================================= */
-STATIC uint32_t crc32(uint32_t crc, const void *_buf, unsigned int len)
+#define DO1(buf) crc = crc_table[0][(crc ^ (*buf++)) & 0xff] ^ (crc >> 8);
+
+/*
+ * The CRC register without the initial and final inversion. The bytes up to
+ * the first 32 bit boundary are done one at a time, then eight bytes per
+ * round are read as two aligned little endian words.
+ */
+static uint32_t crc32_update(uint32_t crc, const unsigned char *buf,
+			     unsigned int len)
 {
-    const unsigned char *buf = _buf;
+	const uint32_t *p;
+	uint32_t one, two;
 
-#ifdef CONFIG_DYNAMIC_CRC_TABLE
-    if (crc_table_empty)
-      make_crc_table();
-#endif
-    crc = crc ^ 0xffffffffL;
-    while (len >= 8)
-    {
-      DO8(buf);
-      len -= 8;
-    }
-    if (len) do {
-      DO1(buf);
-    } while (--len);
-    return crc ^ 0xffffffffL;
+	if (crc_table_empty)
+		make_crc_table();
+
+	while (len && ((unsigned long)buf & 3)) {
+		DO1(buf);
+		len--;
+	}
+
+	p = (const uint32_t *)buf;
+
+	while (len >= 8) {
+		one = le32_to_cpu(*p++) ^ crc;
+		two = le32_to_cpu(*p++);
+		crc = crc_table[7][one & 0xff] ^
+		      crc_table[6][(one >> 8) & 0xff] ^
+		      crc_table[5][(one >> 16) & 0xff] ^
+		      crc_table[4][one >> 24] ^
+		      crc_table[3][two & 0xff] ^
+		      crc_table[2][(two >> 8) & 0xff] ^
+		      crc_table[1][(two >> 16) & 0xff] ^
+		      crc_table[0][two >> 24];
+		len -= 8;
+	}
+
+	buf = (const unsigned char *)p;
+
+	while (len--)
+		DO1(buf);
+
+	return crc;
+}
+
+/* ========================================================================= */
+STATIC uint32_t crc32(uint32_t crc, const void *buf, unsigned int len)
+{
+	return crc32_update(crc ^ 0xffffffffL, buf, len) ^ 0xffffffffL;
 }
 #ifdef __BAREBOX__
 EXPORT_SYMBOL(crc32);
@@ -167,26 +219,14 @@ EXPORT_SYMBOL(crc32);
 /* No ones complement version. JFFS2 (and other things ?)
  * don't use ones compliment in their CRC calculations.
  */
-STATIC uint32_t crc32_no_comp(uint32_t crc, const void *_buf, unsigned int len)
+STATIC uint32_t crc32_no_comp(uint32_t crc, const void *buf, unsigned int len)
 {
-   const unsigned char *buf = _buf;
-
-#ifdef CONFIG_DYNAMIC_CRC_TABLE
-    if (crc_table_empty)
-      make_crc_table();
-#endif
-    while (len >= 8)
-    {
-      DO8(buf);
-      len -= 8;
-    }
-    if (len) do {
-      DO1(buf);
-    } while (--len);
-
-    return crc;
+	return crc32_update(crc, buf, len);
 }
 
+/* Large reads, so that the CRC and not the read calls dominate */
+#define FILE_CRC_BUFSIZE	(64 * 1024)
+
 STATIC int file_crc(char *filename, ulong start, ulong size, ulong *crc,
 		    ulong *total)
 {
@@ -214,10 +254,10 @@ STATIC int file_crc(char *filename, ulong start, ulong size, ulong *crc,
 		}
 	}
 
-	buf = xmalloc(4096);
+	buf = xmalloc(FILE_CRC_BUFSIZE);
 
 	while (size) {
-		now = min((ulong)4096, size);
+		now = min((ulong)FILE_CRC_BUFSIZE, size);
 		now = read(fd, buf, now);
 		if (now < 0) {
 			ret = now;
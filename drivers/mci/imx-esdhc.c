@@ -47,6 +47,8 @@ struct fsl_esdhc_host {
 	void __iomem		*regs;
 	struct device_d		*dev;
 	struct clk		*clk;
+	struct esdhc_adma2_desc	*adma_desc;	/* NULL if ADMA2 is not used */
+	dma_addr_t		adma_addr;
 };
 
 #define to_fsl_esdhc(mci)	container_of(mci, struct fsl_esdhc_host, mci)
@@ -156,6 +158,43 @@ esdhc_pio_read_write(struct mci_host *mci, struct mci_data *data)
 	return 0;
 }
 
+/*
+ * ADMA2 transfers the whole request in one go by describing the buffer
+ * as a list of segments, so there is no limit on the request size apart
+ * from the 16 bit block counter.
+ */
+static bool esdhc_use_adma(struct fsl_esdhc_host *host, struct mci_data *data)
+{
+	if (IS_ENABLED(CONFIG_MCI_IMX_ESDHC_PIO) || !host->adma_desc)
+		return false;
+
+	/* ADMA2 needs 32 bit aligned segments */
+	return !((unsigned long)data->dest & 0x3) && !(data->blocksize & 0x3);
+}
+
+static void esdhc_setup_adma(struct fsl_esdhc_host *host, struct mci_data *data)
+{
+	struct esdhc_adma2_desc *desc = host->adma_desc;
+	unsigned long addr = (unsigned long)data->dest;
+	unsigned int len = data->blocks * data->blocksize;
+
+	while (len) {
+		unsigned int now = min_t(unsigned int, len, ESDHC_ADMA_SEG_SIZE);
+
+		desc->attr = cpu_to_le16(ADMA2_VALID | ADMA2_ACT_TRAN);
+		desc->len = cpu_to_le16(now);
+		desc->addr = cpu_to_le32(addr);
+
+		addr += now;
+		len -= now;
+		desc++;
+	}
+
+	desc[-1].attr |= cpu_to_le16(ADMA2_END);
+
+	esdhc_write32(host->regs + ESDHC_ADMA_SYS_ADDR, host->adma_addr);
+}
+
 static int esdhc_setup_data(struct mci_host *mci, struct mci_data *data)
 {
 	struct fsl_esdhc_host *host = to_fsl_esdhc(mci);
@@ -171,6 +210,8 @@ static int esdhc_setup_data(struct mci_host *mci, struct mci_data *data)
 			esdhc_write32(regs + SDHCI_DMA_ADDRESS, (u32)data->dest);
 		}
 	} else {
+		bool adma = esdhc_use_adma(host, data);
+
 		wml_value = data->blocksize/4;
 
 		if (data->flags & MMC_DATA_READ) {
@@ -178,7 +219,8 @@ static int esdhc_setup_data(struct mci_host *mci, struct mci_data *data)
 				wml_value = 0x10;
 
 			esdhc_clrsetbits32(regs + IMX_SDHCI_WML, WML_RD_WML_MASK, wml_value);
-			esdhc_write32(regs + SDHCI_DMA_ADDRESS, (u32)data->dest);
+			if (!adma)
+				esdhc_write32(regs + SDHCI_DMA_ADDRESS, (u32)data->dest);
 		} else {
 			if (wml_value > 0x80)
 				wml_value = 0x80;
@@ -187,7 +229,17 @@ static int esdhc_setup_data(struct mci_host *mci, struct mci_data *data)
 
 			esdhc_clrsetbits32(regs + IMX_SDHCI_WML, WML_WR_WML_MASK,
 						wml_value << 16);
-			esdhc_write32(regs + SDHCI_DMA_ADDRESS, (u32)data->src);
+			if (!adma)
+				esdhc_write32(regs + SDHCI_DMA_ADDRESS, (u32)data->src);
+		}
+
+		if (adma) {
+			esdhc_setup_adma(host, data);
+			esdhc_clrsetbits32(regs + SDHCI_HOST_CONTROL__POWER_CONTROL__BLOCK_GAP_CONTROL,
+					PROCTL_DMAS_MASK, PROCTL_DMAS_ADMA2);
+		} else {
+			esdhc_clrbits32(regs + SDHCI_HOST_CONTROL__POWER_CONTROL__BLOCK_GAP_CONTROL,
+					PROCTL_DMAS_MASK);
 		}
 	}
 
@@ -219,6 +271,12 @@ static int esdhc_do_data(struct mci_host *mci, struct mci_data *data)
 
 		if (irqstat & IRQSTAT_DTOE)
 			return -ETIMEDOUT;
+
+		if (irqstat & ESDHC_IRQSTAT_DMAE) {
+			dev_err(host->dev, "DMA error, ADMA status 0x%08x\n",
+				esdhc_read32(regs + ESDHC_ADMA_ERR_STATUS));
+			return -EIO;
+		}
 	} while (!(irqstat & IRQSTAT_TC) &&
 		(esdhc_read32(regs + SDHCI_PRESENT_STATE) & PRSSTAT_DLA));
 
@@ -499,7 +557,8 @@ static int esdhc_init(struct mci_host *mci, struct device_d *dev)
 
 	writel(IRQSTATEN_CC | IRQSTATEN_TC | IRQSTATEN_CINT | IRQSTATEN_CTOE |
 			IRQSTATEN_CCE | IRQSTATEN_CEBE | IRQSTATEN_CIE | IRQSTATEN_DTOE |
-			IRQSTATEN_DCE | IRQSTATEN_DEBE | IRQSTATEN_DINT, regs + SDHCI_INT_ENABLE);
+			IRQSTATEN_DCE | IRQSTATEN_DEBE | IRQSTATEN_DINT |
+			IRQSTATEN_DMAE, regs + SDHCI_INT_ENABLE);
 
 	/* Put the PROCTL reg back to the default */
 	esdhc_write32(regs + SDHCI_HOST_CONTROL__POWER_CONTROL__BLOCK_GAP_CONTROL,
@@ -598,6 +657,21 @@ static int fsl_esdhc_probe(struct device_d *dev)
 	if (caps & ESDHC_HOSTCAPBLT_HSS)
 		mci->host_caps |= MMC_CAP_MMC_HIGHSPEED | MMC_CAP_SD_HIGHSPEED;
 
+	/*
+	 * No auto CMD12 is used, so multi block transfers announced with
+	 * SET_BLOCK_COUNT simply end without STOP_TRANSMISSION.
+	 */
+	mci->host_caps |= MMC_CAP_CMD23;
+
+	/* ADMA2 is known to work on the uSDHC only */
+	if (!IS_ENABLED(CONFIG_MCI_IMX_ESDHC_PIO) && cpu_is_mx6() &&
+	    (caps & ESDHC_HOSTCAPBLT_ADMAS))
+		host->adma_desc = dma_alloc_coherent(ESDHC_ADMA_DESC_NUM *
+				sizeof(struct esdhc_adma2_desc), &host->adma_addr);
+
+	/* the block counter is 16 bit wide */
+	mci->max_req_size = BLKATTR_CNT_MAX * 512;
+
 	host->mci.send_cmd = esdhc_send_cmd;
 	host->mci.set_ios = esdhc_set_ios;
 	host->mci.init = esdhc_init;
@@ -23,6 +23,7 @@
 #define	__FSL_ESDHC_H__
 
 #include <errno.h>
+#include <linux/sizes.h>
 #include <asm/byteorder.h>
 
 #define SYSCTL_INITA		0x08000000
@@ -40,6 +41,8 @@
 #define PROCTL_INIT		0x00000020
 #define PROCTL_DTW_4		0x00000002
 #define PROCTL_DTW_8		0x00000004
+#define PROCTL_DMAS_MASK	0x00000300
+#define PROCTL_DMAS_ADMA2	0x00000200
 
 #define WML_WRITE	0x00010000
 #define WML_RD_WML_MASK	0xff
@@ -48,6 +51,7 @@
 #define BLKATTR_CNT(x)	((x & 0xffff) << 16)
 #define BLKATTR_SIZE(x)	(x & 0x1fff)
 #define MAX_BLK_CNT	0x7fff	/* so malloc will have enough room with 32M */
+#define BLKATTR_CNT_MAX	0xffff
 
 #define ESDHC_HOSTCAPBLT_VS18	0x04000000
 #define ESDHC_HOSTCAPBLT_VS30	0x02000000
@@ -55,6 +59,30 @@
 #define ESDHC_HOSTCAPBLT_SRS	0x00800000
 #define ESDHC_HOSTCAPBLT_DMAS	0x00400000
 #define ESDHC_HOSTCAPBLT_HSS	0x00200000
+#define ESDHC_HOSTCAPBLT_ADMAS	0x00100000
+
+/* The eSDHC reports DMA errors in a different bit than standard SDHCI */
+#define ESDHC_IRQSTAT_DMAE	0x10000000
+
+#define ESDHC_ADMA_ERR_STATUS	0x54
+#define ESDHC_ADMA_SYS_ADDR	0x58
+
+/* ADMA2 descriptor attributes */
+#define ADMA2_VALID		0x0001
+#define ADMA2_END		0x0002
+#define ADMA2_INT		0x0004
+#define ADMA2_ACT_TRAN		0x0020
+
+#define ESDHC_ADMA_SEG_SIZE	SZ_32K
+#define ESDHC_ADMA_DESC_NUM	(DIV_ROUND_UP(BLKATTR_CNT_MAX * 512, \
+					ESDHC_ADMA_SEG_SIZE) + 1)
+
+/* 32 bit ADMA2 descriptor */
+struct esdhc_adma2_desc {
+	__le16	attr;
+	__le16	len;
+	__le32	addr;
+} __packed;
 
 #define PIO_TIMEOUT		100000
 
@@ -133,6 +133,47 @@ static int mci_set_blocklen(struct mci *mci, unsigned len)
 
 static void *sector_buf;
 
+/**
+ * Announce the block count of the following multi block transfer
+ * @param mci MCI instance
+ * @param blocks Block count of the transfer
+ * @return Transaction status (0 on success)
+ *
+ * Transfers announced with SET_BLOCK_COUNT end by themselves, there is no
+ * STOP_TRANSMISSION needed afterwards.
+ */
+static int mci_set_block_count(struct mci *mci, unsigned blocks)
+{
+	struct mci_cmd cmd;
+
+	mci_setup_cmd(&cmd, MMC_CMD_SET_BLOCK_COUNT, blocks, MMC_RSP_R1);
+	return mci_send_cmd(mci, &cmd, NULL);
+}
+
+static inline int mci_use_block_count(struct mci *mci, int blocks)
+{
+	return blocks > 1 && (mci_caps(mci) & MMC_CAP_CMD23);
+}
+
+/**
+ * Maximum number of blocks for a single read or write command
+ * @param mci MCI instance
+ * @param bl_len Block length used for the transfer
+ */
+static unsigned mci_max_req_blocks(struct mci *mci, unsigned bl_len)
+{
+	unsigned max_req_block = UINT_MAX;
+
+	if (mci->host->max_req_size)
+		max_req_block = mci->host->max_req_size / bl_len;
+
+	/* SET_BLOCK_COUNT takes a 16 bit block count */
+	if (mci_caps(mci) & MMC_CAP_CMD23)
+		max_req_block = min(max_req_block, 0xffffU);
+
+	return max_req_block;
+}
+
 /**
  * Write one or several blocks of data to the card
  * @param mci_dev MCI instance
@@ -148,8 +189,15 @@ static int mci_block_write(struct mci *mci, const void *src, int blocknum,
 	struct mci_data data;
 	const void *buf;
 	unsigned mmccmd;
+	int sbc = mci_use_block_count(mci, blocks);
 	int ret;
 
+	if (sbc) {
+		ret = mci_set_block_count(mci, blocks);
+		if (ret)
+			return ret;
+	}
+
 	if (blocks > 1)
 		mmccmd = MMC_CMD_WRITE_MULTIPLE_BLOCK;
 	else
@@ -174,7 +222,7 @@ static int mci_block_write(struct mci *mci, const void *src, int blocknum,
 
 	ret = mci_send_cmd(mci, &cmd, &data);
 
-	if (ret || blocks > 1) {
+	if (ret || (blocks > 1 && !sbc)) {
 		mci_setup_cmd(&cmd, MMC_CMD_STOP_TRANSMISSION, 0, MMC_RSP_R1b);
 		mci_send_cmd(mci, &cmd, NULL);
         }
@@ -194,9 +242,16 @@ static int mci_read_block(struct mci *mci, void *dst, int blocknum,
 {
 	struct mci_cmd cmd;
 	struct mci_data data;
+	int sbc = mci_use_block_count(mci, blocks);
 	int ret;
 	unsigned mmccmd;
 
+	if (sbc) {
+		ret = mci_set_block_count(mci, blocks);
+		if (ret)
+			return ret;
+	}
+
 	if (blocks > 1)
 		mmccmd = MMC_CMD_READ_MULTIPLE_BLOCK;
 	else
@@ -214,7 +269,7 @@ static int mci_read_block(struct mci *mci, void *dst, int blocknum,
 
 	ret = mci_send_cmd(mci, &cmd, &data);
 
-	if (ret || blocks > 1) {
+	if (ret || (blocks > 1 && !sbc)) {
 		mci_setup_cmd(&cmd, MMC_CMD_STOP_TRANSMISSION, 0, MMC_RSP_R1b);
 		mci_send_cmd(mci, &cmd, NULL);
 	}
@@ -460,7 +515,7 @@ static int mmc_change_freq(struct mci *mci)
 	if (mci->version < MMC_VERSION_4)
 		return 0;
 
-	mci->card_caps |= MMC_CAP_4_BIT_DATA;
+	mci->card_caps |= MMC_CAP_4_BIT_DATA | MMC_CAP_CMD23;
 
 	err = mci_send_ext_csd(mci, mci->ext_csd);
 	if (err) {
@@ -497,6 +552,14 @@ static int mmc_change_freq(struct mci *mci)
 	else
 		mci->card_caps |= MMC_CAP_MMC_HIGHSPEED;
 
+	/* The faster modes are selected once the bus width is known */
+	if (cardtype & EXT_CSD_CARD_TYPE_DDR_1_8V)
+		mci->card_caps |= MMC_CAP_MMC_1_8V_DDR;
+	if (cardtype & EXT_CSD_CARD_TYPE_SDR_1_8V)
+		mci->card_caps |= MMC_CAP_MMC_HS200;
+	if (cardtype & EXT_CSD_CARD_TYPE_HS400_1_8V)
+		mci->card_caps |= MMC_CAP_MMC_HS400;
+
 	if (IS_ENABLED(CONFIG_MCI_MMC_BOOT_PARTITIONS) &&
 			mci->ext_csd[EXT_CSD_REV] >= 3 && mci->ext_csd[EXT_CSD_BOOT_MULT]) {
 		int idx;
@@ -624,6 +687,9 @@ retry_scr:
 	if (mci->scr[0] & SD_DATA_4BIT)
 		mci->card_caps |= MMC_CAP_4_BIT_DATA;
 
+	if (mci->scr[0] & SD_SCR_CMD23_SUPPORT)
+		mci->card_caps |= MMC_CAP_CMD23;
+
 	/* Version 1.0 doesn't support switching */
 	if (mci->version == SD_VERSION_1_0)
 		return 0;
@@ -655,8 +721,10 @@ retry_scr:
 	if ((__be32_to_cpu(switch_status[4]) & 0x0f000000) == 0x01000000)
 		mci->card_caps |= MMC_CAP_SD_HIGHSPEED;
 
-	if (mci_caps(mci) & MMC_CAP_SD_HIGHSPEED)
+	if (mci_caps(mci) & MMC_CAP_SD_HIGHSPEED) {
 		mci->tran_speed = 50000000;
+		host->timing = MMC_TIMING_SD_HS;
+	}
 
 	return 0;
 }
@@ -672,6 +740,7 @@ static void mci_set_ios(struct mci *mci)
 
 	ios.bus_width = host->bus_width;
 	ios.clock = host->clock;
+	ios.timing = host->timing;
 
 	host->set_ios(host, &ios);
 }
@@ -991,6 +1060,140 @@ static int mci_startup_sd(struct mci *mci)
 	return 0;
 }
 
+/**
+ * Switch an MMC card in high speed mode to DDR52
+ * @param mci MCI instance
+ * @return Transaction status (0 on success)
+ */
+static int mmc_select_ddr52(struct mci *mci)
+{
+	struct mci_host *host = mci->host;
+	unsigned width;
+	int err;
+
+	if (host->bus_width == MMC_BUS_WIDTH_8)
+		width = EXT_CSD_DDR_BUS_WIDTH_8;
+	else
+		width = EXT_CSD_DDR_BUS_WIDTH_4;
+
+	err = mci_switch(mci, EXT_CSD_CMD_SET_NORMAL, EXT_CSD_BUS_WIDTH, width);
+	if (err) {
+		dev_dbg(&mci->dev, "Switching to DDR52 failed: %d\n", err);
+		return err;
+	}
+
+	host->timing = MMC_TIMING_MMC_DDR52;
+	mci_set_ios(mci);
+
+	return 0;
+}
+
+/**
+ * Switch an MMC card in high speed mode to HS200
+ * @param mci MCI instance
+ * @return Transaction status (0 on success)
+ *
+ * The card stays in high speed mode when switching or tuning fails.
+ */
+static int mmc_select_hs200(struct mci *mci)
+{
+	struct mci_host *host = mci->host;
+	int err;
+
+	/* HS200 needs 1.8V I/O, and the host has to tune the sampling point */
+	if (!(host->host_caps & MMC_CAP_1_8V_SIGNALING) || !host->execute_tuning)
+		return -ENOSYS;
+
+	err = mci_switch(mci, EXT_CSD_CMD_SET_NORMAL, EXT_CSD_HS_TIMING,
+			 EXT_CSD_TIMING_HS200);
+	if (err) {
+		dev_dbg(&mci->dev, "Switching to HS200 failed: %d\n", err);
+		return err;
+	}
+
+	host->timing = MMC_TIMING_MMC_HS200;
+	mci_set_clock(mci, 200000000);
+
+	err = host->execute_tuning(host, MMC_CMD_SEND_TUNING_BLOCK_HS200);
+	if (err) {
+		dev_warn(&mci->dev, "HS200 tuning failed: %d\n", err);
+		goto fallback;
+	}
+
+	mci->tran_speed = 200000000;
+
+	return 0;
+
+fallback:
+	host->timing = MMC_TIMING_MMC_HS;
+	mci_set_clock(mci, mci->tran_speed);
+	mci_switch(mci, EXT_CSD_CMD_SET_NORMAL, EXT_CSD_HS_TIMING,
+		   EXT_CSD_TIMING_HS);
+
+	return err;
+}
+
+/**
+ * Switch an MMC card from tuned HS200 to HS400
+ * @param mci MCI instance
+ * @return Transaction status (0 on success)
+ *
+ * HS400 is entered through high speed mode with an 8 bit DDR bus. If
+ * leaving HS200 fails the card and the host stay in HS200, if a later
+ * step fails both are put back into high speed mode with an 8 bit bus.
+ */
+static int mmc_select_hs400(struct mci *mci)
+{
+	struct mci_host *host = mci->host;
+	int err;
+
+	host->timing = MMC_TIMING_MMC_HS;
+	mci_set_clock(mci, 52000000);
+
+	err = mci_switch(mci, EXT_CSD_CMD_SET_NORMAL, EXT_CSD_HS_TIMING,
+			 EXT_CSD_TIMING_HS);
+	if (err)
+		goto out_hs200;
+
+	err = mci_switch(mci, EXT_CSD_CMD_SET_NORMAL, EXT_CSD_BUS_WIDTH,
+			 EXT_CSD_DDR_BUS_WIDTH_8);
+	if (err)
+		goto out_hs;
+
+	host->timing = MMC_TIMING_MMC_DDR52;
+	mci_set_ios(mci);
+
+	err = mci_switch(mci, EXT_CSD_CMD_SET_NORMAL, EXT_CSD_HS_TIMING,
+			 EXT_CSD_TIMING_HS400);
+	if (err)
+		goto out_hs;
+
+	host->timing = MMC_TIMING_MMC_HS400;
+	mci->tran_speed = 200000000;
+	mci_set_clock(mci, mci->tran_speed);
+
+	return 0;
+
+out_hs:
+	dev_dbg(&mci->dev, "Switching to HS400 failed: %d\n", err);
+	host->timing = MMC_TIMING_MMC_HS;
+	mci->tran_speed = 52000000;
+	mci_set_clock(mci, mci->tran_speed);
+	mci_switch(mci, EXT_CSD_CMD_SET_NORMAL, EXT_CSD_HS_TIMING,
+		   EXT_CSD_TIMING_HS);
+	mci_switch(mci, EXT_CSD_CMD_SET_NORMAL, EXT_CSD_BUS_WIDTH,
+		   EXT_CSD_BUS_WIDTH_8);
+
+	return err;
+
+out_hs200:
+	dev_dbg(&mci->dev, "Switching to HS400 failed: %d\n", err);
+	host->timing = MMC_TIMING_MMC_HS200;
+	mci_set_clock(mci, mci->tran_speed);
+
+	return err;
+}
+
 static int mci_startup_mmc(struct mci *mci)
 {
 	struct mci_host *host = mci->host;
@@ -1011,6 +1214,7 @@ static int mci_startup_mmc(struct mci *mci)
 			mci->tran_speed = 52000000;
 		else
 			mci->tran_speed = 26000000;
+		host->timing = MMC_TIMING_MMC_HS;
 	}
 
 	mci_set_clock(mci, mci->tran_speed);
@@ -1046,6 +1250,21 @@ static int mci_startup_mmc(struct mci *mci)
 			break;
 	}
 
+	/* The faster bus modes all need a 4 or 8 bit bus */
+	if (idx < 0 || host->timing != MMC_TIMING_MMC_HS ||
+	    !(mci->card_caps & MMC_CAP_MMC_HIGHSPEED_52MHZ))
+		return 0;
+
+	if ((mci_caps(mci) & MMC_CAP_MMC_HS200) && !mmc_select_hs200(mci)) {
+		if ((mci_caps(mci) & MMC_CAP_MMC_HS400) &&
+		    host->bus_width == MMC_BUS_WIDTH_8)
+			mmc_select_hs400(mci);
+		return 0;
+	}
+
+	if (mci_caps(mci) & MMC_CAP_MMC_1_8V_DDR)
+		mmc_select_ddr52(mci);
+
 	return 0;
 }
 
@@ -1174,8 +1393,14 @@ static int mci_startup(struct mci *mci)
 	if (err)
 		return err;
 
-	/* we setup the blocklength only one times for all accesses to this media  */
-	err = mci_set_blocklen(mci, mci->read_bl_len);
+	/*
+	 * we setup the blocklength only one times for all accesses to this
+	 * media. SET_BLOCKLEN is illegal in the DDR modes which always use
+	 * 512 byte blocks.
+	 */
+	if (host->timing != MMC_TIMING_MMC_DDR52 &&
+	    host->timing != MMC_TIMING_MMC_HS400)
+		err = mci_set_blocklen(mci, mci->read_bl_len);
 
 	mci_part_add(mci, mci->capacity, 0,
 			mci->cdevname, NULL, 0, true,
@@ -1264,19 +1489,16 @@ static int mci_blk_part_switch(struct mci_part *part)
  *
  * This routine expects the buffer has the correct size to read all data!
  */
-static int __maybe_unused mci_sd_write(struct block_device *blk,
+static int __maybe_unused __mci_sd_write(struct block_device *blk,
 				const void *buffer, int block, int num_blocks)
 {
 	struct mci_part *part = container_of(blk, struct mci_part, blk);
 	struct mci *mci = part->mci;
 	struct mci_host *host = mci->host;
 	int rc;
-	unsigned max_req_block = num_blocks;
+	unsigned max_req_block = mci_max_req_blocks(mci, mci->write_bl_len);
 	int write_block;
 
-	if (mci->host->max_req_size)
-		max_req_block = mci->host->max_req_size / mci->write_bl_len;
-
 	mci_blk_part_switch(part);
 
 	if (host->card_write_protected && host->card_write_protected(host)) {
@@ -1324,18 +1546,15 @@ static int __maybe_unused mci_sd_write(struct block_device *blk,
  *
  * This routine expects the buffer has the correct size to store all data!
  */
-static int mci_sd_read(struct block_device *blk, void *buffer, int block,
+static int __mci_sd_read(struct block_device *blk, void *buffer, int block,
 				int num_blocks)
 {
 	struct mci_part *part = container_of(blk, struct mci_part, blk);
 	struct mci *mci = part->mci;
-	unsigned max_req_block = num_blocks;
+	unsigned max_req_block = mci_max_req_blocks(mci, mci->read_bl_len);
 	int read_block;
 	int rc;
 
-	if (mci->host->max_req_size)
-		max_req_block = mci->host->max_req_size / mci->read_bl_len;
-
 	mci_blk_part_switch(part);
 
 	dev_dbg(&mci->dev, "%s: Read %d block(s), starting at %d\n",
@@ -1367,6 +1586,43 @@ static int mci_sd_read(struct block_device *blk, void *buffer, int block,
 	return 0;
 }
 
+/* Account the transfers for the throughput statistics */
+static int __maybe_unused mci_sd_write(struct block_device *blk,
+				const void *buffer, int block, int num_blocks)
+{
+	struct mci_part *part = container_of(blk, struct mci_part, blk);
+	struct mci *mci = part->mci;
+	uint64_t start = get_time_ns();
+	int rc;
+
+	rc = __mci_sd_write(blk, buffer, block, num_blocks);
+
+	if (!rc) {
+		mci->write_bytes += (uint64_t)num_blocks * SECTOR_SIZE;
+		mci->write_ns += get_time_ns() - start;
+	}
+
+	return rc;
+}
+
+static int mci_sd_read(struct block_device *blk, void *buffer, int block,
+				int num_blocks)
+{
+	struct mci_part *part = container_of(blk, struct mci_part, blk);
+	struct mci *mci = part->mci;
+	uint64_t start = get_time_ns();
+	int rc;
+
+	rc = __mci_sd_read(blk, buffer, block, num_blocks);
+
+	if (!rc) {
+		mci->read_bytes += (uint64_t)num_blocks * SECTOR_SIZE;
+		mci->read_ns += get_time_ns() - start;
+	}
+
+	return rc;
+}
+
 /* ------------------ attach to the device API --------------------------- */
 
 /**
@@ -1462,12 +1718,55 @@ static unsigned extract_mtd_year(struct mci *mci)
 
 static void mci_print_caps(unsigned caps)
 {
-	printf("  capabilities: %s%s%s%s%s\n",
+	printf("  capabilities: %s%s%s%s%s%s%s%s%s%s\n",
 		caps & MMC_CAP_4_BIT_DATA ? "4bit " : "",
 		caps & MMC_CAP_8_BIT_DATA ? "8bit " : "",
 		caps & MMC_CAP_SD_HIGHSPEED ? "sd-hs " : "",
 		caps & MMC_CAP_MMC_HIGHSPEED ? "mmc-hs " : "",
-		caps & MMC_CAP_MMC_HIGHSPEED_52MHZ ? "mmc-52MHz " : "");
+		caps & MMC_CAP_MMC_HIGHSPEED_52MHZ ? "mmc-52MHz " : "",
+		caps & MMC_CAP_MMC_1_8V_DDR ? "mmc-ddr52 " : "",
+		caps & MMC_CAP_MMC_HS200 ? "mmc-hs200 " : "",
+		caps & MMC_CAP_MMC_HS400 ? "mmc-hs400 " : "",
+		caps & MMC_CAP_CMD23 ? "cmd23 " : "",
+		caps & MMC_CAP_1_8V_SIGNALING ? "1.8v-io " : "");
+}
+
+static const char *mci_timing_string(unsigned timing)
+{
+	switch (timing) {
+	case MMC_TIMING_LEGACY:
+		return "legacy";
+	case MMC_TIMING_MMC_HS:
+		return "mmc-hs";
+	case MMC_TIMING_SD_HS:
+		return "sd-hs";
+	case MMC_TIMING_MMC_DDR52:
+		return "mmc-ddr52";
+	case MMC_TIMING_MMC_HS200:
+		return "mmc-hs200";
+	case MMC_TIMING_MMC_HS400:
+		return "mmc-hs400";
+	default:
+		return "unknown";
+	}
+}
+
+static void mci_print_throughput(const char *name, uint64_t bytes,
+		uint64_t ns)
+{
+	uint64_t ms = ns, rate;
+
+	do_div(ms, 1000000);
+
+	printf("  %s: %llu KiB in %llu ms", name, bytes >> 10, ms);
+
+	if (ms) {
+		rate = (bytes >> 10) * 1000;
+		do_div(rate, (uint32_t)ms);
+		printf(" (%llu KiB/s)", rate);
+	}
+
+	printf("\n");
 }
 
 /**
@@ -1496,6 +1795,7 @@ static void mci_info(struct device_d *dev)
 		bw = 1;
 
 	printf("  current buswidth: %d\n", bw);
+	printf("  current timing: %s\n", mci_timing_string(host->timing));
 	mci_print_caps(host->host_caps);
 
 	printf("Card information:\n");
@@ -1521,6 +1821,10 @@ static void mci_info(struct device_d *dev)
 	printf("  Serial no: %0u\n", extract_psn(mci));
 	printf("  Manufacturing date: %u.%u\n", extract_mtd_month(mci),
 		extract_mtd_year(mci));
+
+	printf("Transfer statistics:\n");
+	mci_print_throughput("Read", mci->read_bytes, mci->read_ns);
+	mci_print_throughput("Write", mci->write_bytes, mci->write_ns);
 }
 
 /**
@@ -1599,6 +1903,7 @@ static int mci_card_probe(struct mci *mci)
 		goto on_error;
 	}
 
+	host->timing = MMC_TIMING_LEGACY;
 	mci_set_bus_width(mci, MMC_BUS_WIDTH_1);
 	/* according to the SD card spec the detection can happen at 400 kHz */
 	mci_set_clock(mci, 400000);
@@ -367,22 +367,31 @@ static int dwc_ether_rx(struct eth_device *dev)
 	int length = 0;
 
 	/* Check  if the owner is the CPU */
-	if (status & DESC_RXSTS_OWNBYDMA)
+	if (status & DESC_RXSTS_OWNBYDMA) {
+		u32 missed = readl(&priv->dma_regs_p->missedframes);
+
+		dev->rx_overruns += (missed & MISSED_NODESC_MASK) +
+			((missed & MISSED_FIFO_MASK) >> MISSED_FIFO_SHIFT);
 		return 0;
+	}
 
 	length = (status & DESC_RXSTS_FRMLENMSK) >>
 		 DESC_RXSTS_FRMLENSHFT;
 
+	if (status & DESC_RXSTS_ERROR) {
+		dev->rx_dropped++;
+	} else {
+		dma_sync_single_for_cpu((unsigned long)desc_p->dmamac_addr,
+					length, DMA_FROM_DEVICE);
+		net_receive(dev, desc_p->dmamac_addr, length);
+		dma_sync_single_for_device((unsigned long)desc_p->dmamac_addr,
+					   length, DMA_FROM_DEVICE);
+	}
+
 	/*
 	 * Make the current descriptor valid again and go to
 	 * the next one
 	 */
-	dma_sync_single_for_cpu((unsigned long)desc_p->dmamac_addr, length,
-				DMA_FROM_DEVICE);
-	net_receive(dev, desc_p->dmamac_addr, length);
-	dma_sync_single_for_device((unsigned long)desc_p->dmamac_addr, length,
-				   DMA_FROM_DEVICE);
-
 	desc_p->txrx_status |= DESC_RXSTS_OWNBYDMA;
 
 	/* Test the wrap-around condition. */
@@ -77,7 +77,8 @@ struct eth_dma_regs {
 	u32 status;		/* 0x14 */
 	u32 opmode;		/* 0x18 */
 	u32 intenable;		/* 0x1c */
-	u8 reserved[40];
+	u32 missedframes;	/* 0x20 */
+	u8 reserved[36];
 	u32 currhosttxdesc;	/* 0x48 */
 	u32 currhostrxdesc;	/* 0x4c */
 	u32 currhosttxbuffaddr;	/* 0x50 */
@@ -86,6 +87,11 @@ struct eth_dma_regs {
 
 #define DW_DMA_BASE_OFFSET	(0x1000)
 
+/* Missed frame counter register definitions, cleared on read */
+#define MISSED_NODESC_MASK	0x0000ffff	/* no free rx descriptor */
+#define MISSED_FIFO_SHIFT	17		/* rx fifo overflow */
+#define MISSED_FIFO_MASK	(0x7ff << MISSED_FIFO_SHIFT)
+
 /* Bus mode register definitions */
 #define FIXEDBURST		(1 << 16)
 #define PRIORXTX_41		(3 << 14)
@@ -33,13 +33,6 @@
 
 #include "fec_imx.h"
 
-struct fec_frame {
-	uint8_t data[1500];	/* actual data */
-	int length;		/* actual length */
-	int used;		/* buffer in use or not */
-	uint8_t head[16];	/* MAC header(6 + 6 + 2) + 2(aligned) */
-};
-
 /*
  * MII-interface related functions
  */
@@ -329,6 +322,10 @@ static int fec_init(struct eth_device *dev)
 
 	writel(xwmrk, fec->regs + FEC_X_WMRK);
 
+	/* let the ENET drop frames with bad IP header or protocol checksums */
+	if (fec_is_imx6(fec))
+		writel(FEC_RACC_IPDIS | FEC_RACC_PRODIS, fec->regs + FEC_RACC);
+
 	/*
 	 * Set multicast address filter
 	 */
@@ -528,7 +525,7 @@ static int fec_recv(struct eth_device *dev)
 	struct buffer_descriptor __iomem *rbd = &fec->rbd_base[fec->rbd_index];
 	uint32_t ievent;
 	int frame_length, len = 0;
-	struct fec_frame *frame;
+	struct net_buf *nb;
 	uint16_t bd_status;
 
 	/*
@@ -578,18 +575,41 @@ static int fec_recv(struct eth_device *dev)
 			/*
 			 * Get buffer address and size
 			 */
-			frame = phys_to_virt(readl(&rbd->data_pointer));
+			nb = fec->rx_buf[fec->rbd_index];
 			frame_length = readw(&rbd->data_length) - 4;
-			dma_sync_single_for_cpu((unsigned long)frame->data,
+			dma_sync_single_for_cpu((unsigned long)nb->data,
 						frame_length, DMA_FROM_DEVICE);
-			net_receive(dev, frame->data, frame_length);
-			dma_sync_single_for_device((unsigned long)frame->data,
+
+			if (list_empty(&fec->rx_free)) {
+				/* no buffer to put into the ring, stack copies */
+				net_receive(dev, nb->data, frame_length);
+			} else {
+				nb->head = 0;
+				nb->tail = frame_length;
+				net_receive_buf(dev, nb);
+
+				if (net_buf_shared(nb)) {
+					net_buf_put(nb);
+					nb = list_first_entry(&fec->rx_free,
+							struct net_buf, list);
+					list_del(&nb->list);
+					nb->refcount = 1;
+					fec->rx_buf[fec->rbd_index] = nb;
+					writel(virt_to_phys(nb->data),
+							&rbd->data_pointer);
+				}
+			}
+
+			dma_sync_single_for_device((unsigned long)nb->data,
 						   frame_length, DMA_FROM_DEVICE);
 			len = frame_length;
 		} else {
 			if (bd_status & FEC_RBD_ERR) {
 				dev_warn(&dev->dev, "error frame: 0x%p 0x%08x\n", rbd, bd_status);
 			}
+			if (bd_status & FEC_RBD_OV)
+				dev->rx_overruns++;
+			dev->rx_dropped++;
 		}
 		/*
 		 * free the current buffer, restart the engine
@@ -603,18 +623,48 @@ static int fec_recv(struct eth_device *dev)
 	return len;
 }
 
+/* Called when the network stack drops the last reference to a buffer */
+static void fec_rx_buf_release(struct net_buf *nb)
+{
+	struct fec_priv *fec = nb->priv;
+
+	list_add_tail(&nb->list, &fec->rx_free);
+}
+
+/*
+ * Buffers of received packets are handed to the network stack, which may
+ * keep them for a while. The descriptor then gets one of the spare buffers,
+ * the kept one becomes a spare again when the stack releases it.
+ */
 static int fec_alloc_receive_packets(struct fec_priv *fec, int count, int size)
 {
+	struct net_buf *nb;
 	void *p;
 	int i;
 
 	/* reserve data memory and consider alignment */
-	p = dma_alloc_coherent(size * count, DMA_ADDRESS_BROKEN);
+	p = dma_alloc_coherent(size * (count + FEC_RX_SPARE), DMA_ADDRESS_BROKEN);
 	if (!p)
 		return -ENOMEM;
 
-	for (i = 0; i < count; i++) {
-		writel(virt_to_phys(p), &fec->rbd_base[i].data_pointer);
+	fec->rx_mem = p;
+	fec->rx_pool = xzalloc((count + FEC_RX_SPARE) * sizeof(*nb));
+	INIT_LIST_HEAD(&fec->rx_free);
+
+	for (i = 0; i < count + FEC_RX_SPARE; i++) {
+		nb = &fec->rx_pool[i];
+		nb->data = p;
+		nb->release = fec_rx_buf_release;
+		nb->priv = fec;
+
+		if (i < count) {
+			nb->refcount = 1;
+			fec->rx_buf[i] = nb;
+			writel(virt_to_phys(p), &fec->rbd_base[i].data_pointer);
+		} else {
+			list_add_tail(&nb->list, &fec->rx_free);
+		}
+
 		p += size;
 	}
 
@@ -623,8 +673,8 @@ static int fec_alloc_receive_packets(struct fec_priv *fec, int count, int size)
 
 static void fec_free_receive_packets(struct fec_priv *fec, int count, int size)
 {
-	void *p = phys_to_virt(fec->rbd_base[0].data_pointer);
-	dma_free_coherent(p, 0, size * count);
+	dma_free_coherent(fec->rx_mem, 0, size * (count + FEC_RX_SPARE));
+	free(fec->rx_pool);
 }
 
 #ifdef CONFIG_OFDEVICE
@@ -680,6 +730,8 @@ static int fec_probe(struct device_d *dev)
 	edev->get_ethaddr = fec_get_hwaddr;
 	edev->set_ethaddr = fec_set_hwaddr;
 	edev->parent = dev;
+	if (fec_is_imx6(fec))
+		edev->features = ETH_FEATURE_RX_CSUM;
 
 	fec->clk = clk_get(dev, NULL);
 	if (IS_ERR(fec->clk)) {
@@ -41,6 +41,7 @@
 #define FEC_GADDR1			0x120
 #define FEC_GADDR2			0x124
 #define FEC_X_WMRK			0x144
+#define FEC_RACC			0x1c4	/* i.MX6 only */
 #define FEC_ERDSR			0x180
 #define FEC_ETDSR			0x184
 #define	FEC_EMRBR			0x188
@@ -59,6 +60,9 @@
 #define FEC_MIIGSK_ENR_READY		(1 << 2)
 #define FEC_MIIGSK_ENR_EN		(1 << 1)
 
+#define FEC_RACC_IPDIS			(1 << 1)
+#define FEC_RACC_PRODIS			(1 << 2)
+
 #define FEC_R_CNTRL_GRS			(1 << 31)
 #define FEC_R_CNTRL_NO_LGTH_CHECK	(1 << 30)
 #ifdef CONFIG_ARCH_IMX28
@@ -129,6 +133,21 @@ enum fec_type {
 	FEC_TYPE_IMX6,
 };
 
+/**
+ * @brief Numbers of buffer descriptors for receiving
+ *
+ * The number defines the stocked memory buffers for the receiving task.
+ * Larger values makes no sense in this limited environment.
+ */
+#define FEC_RBD_NUM		64
+
+/**
+ * @brief Number of spare receive buffers
+ *
+ * Replace ring buffers which the network stack keeps for a while.
+ */
+#define FEC_RX_SPARE		64
+
 /**
  * @brief i.MX27-FEC private structure
  */
@@ -137,6 +156,10 @@ struct fec_priv {
 	void __iomem *regs;
 	struct buffer_descriptor __iomem *rbd_base;	/* RBD ring                  */
 	int rbd_index;				/* next receive BD to read   */
+	struct net_buf *rx_buf[FEC_RBD_NUM];	/* buffers of the RBD ring   */
+	struct list_head rx_free;		/* spare receive buffers     */
+	struct net_buf *rx_pool;
+	void *rx_mem;
 	struct buffer_descriptor __iomem *tbd_base;	/* TBD ring                  */
 	int tbd_index;				/* next transmit BD to write */
 	int phy_addr;
@@ -163,14 +186,6 @@ static inline int fec_is_imx6(struct fec_priv *priv)
 	return priv->type == FEC_TYPE_IMX6;
 }
 
-/**
- * @brief Numbers of buffer descriptors for receiving
- *
- * The number defines the stocked memory buffers for the receiving task.
- * Larger values makes no sense in this limited environment.
- */
-#define FEC_RBD_NUM		64
-
 /**
  * @brief Define the ethernet packet size limit in memory
  *
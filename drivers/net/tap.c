@@ -24,9 +24,13 @@
 #include <init.h>
 #include <mach/linux.h>
 
+/* IFNAMSIZ of the host, tap_alloc() returns the interface name in here */
+#define TAP_NAME_SIZE	16
+
 struct tap_priv {
 	int fd;
-	char *name;
+	char name[TAP_NAME_SIZE];
+	struct net_buf *rx_buf;
 };
 
 static int tap_eth_send(struct eth_device *edev, void *packet, int length)
@@ -40,12 +44,25 @@ static int tap_eth_send(struct eth_device *edev, void *packet, int length)
 static int tap_eth_rx(struct eth_device *edev)
 {
 	struct tap_priv *priv = edev->priv;
+	struct net_buf *nb = priv->rx_buf;
 	int length;
 
-	length = linux_read_nonblock(priv->fd, NetRxPackets[0], PKTSIZE);
+	if (!nb)
+		nb = priv->rx_buf = net_buf_alloc(PKTSIZE);
+
+	length = linux_read_nonblock(priv->fd, nb->data, PKTSIZE);
+	if (length <= 0)
+		return 0;
 
-	if (length > 0)
-		net_receive(edev, NetRxPackets[0], length);
+	nb->head = 0;
+	nb->tail = length;
+	net_receive_buf(edev, nb);
+
+	/* the stack keeps the buffer, use a new one for the next packet */
+	if (net_buf_shared(nb)) {
+		net_buf_put(nb);
+		priv->rx_buf = NULL;
+	}
 
 	return 0;
 }
@@ -77,7 +94,7 @@ static int tap_probe(struct device_d *dev)
 	int ret = 0;
 
 	priv = xzalloc(sizeof(struct tap_priv));
-	priv->name = "barebox";
+	strcpy(priv->name, "barebox");
 
 	priv->fd = tap_alloc(priv->name);
 	if (priv->fd < 0) {
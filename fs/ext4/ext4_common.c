@@ -38,57 +38,154 @@
 
 #include "ext4_common.h"
 
-static struct ext4_extent_header *ext4fs_get_extent_block(struct ext2_data *data,
-		char *buf, struct ext4_extent_header *ext_block,
-		uint32_t fileblock, int log2_blksz)
+/*
+ * Add the extents below @eh to the extent map of @node. The tree is
+ * walked in order, so the map ends up sorted by logical block.
+ */
+static int ext4fs_add_extents(struct ext2fs_node *node,
+		struct ext4_extent_header *eh, int depth)
 {
+	struct ext2_data *data = node->data;
 	struct ext4_extent_idx *index;
-	unsigned long long block;
-	struct ext_filesystem *fs = data->fs;
 	int blksz = EXT2_BLOCK_SIZE(data);
-	int i, ret;
+	int log2_blksz = LOG2_EXT2_BLOCK_SIZE(data);
+	int i, entries, ret = 0;
+	char *buf;
 
-	while (1) {
-		index = (struct ext4_extent_idx *)(ext_block + 1);
+	if (le16_to_cpu(eh->eh_magic) != EXT4_EXT_MAGIC ||
+			depth > EXT4_EXT_MAX_DEPTH)
+		return -EINVAL;
 
-		if (le16_to_cpu(ext_block->eh_magic) != EXT4_EXT_MAGIC)
-			return 0;
+	entries = le16_to_cpu(eh->eh_entries);
 
-		if (ext_block->eh_depth == 0)
-			return ext_block;
-		i = -1;
-		do {
-			i++;
-			if (i >= le16_to_cpu(ext_block->eh_entries))
-				break;
-		} while (fileblock >= le32_to_cpu(index[i].ei_block));
+	if (eh->eh_depth == 0) {
+		struct ext4_extent *extent = (struct ext4_extent *)(eh + 1);
 
-		if (--i < 0)
-			return 0;
+		node->extents = xrealloc(node->extents,
+				(node->num_extents + entries) *
+				sizeof(*node->extents));
+
+		for (i = 0; i < entries; i++) {
+			struct ext4fs_extent *e = &node->extents[node->num_extents++];
+			unsigned int len = le16_to_cpu(extent[i].ee_len);
+
+			e->block = le32_to_cpu(extent[i].ee_block);
+
+			if (len > EXT4_EXT_INIT_MAX_LEN) {
+				/* unwritten extent, reads as zeroes */
+				e->len = len - EXT4_EXT_INIT_MAX_LEN;
+				e->start = 0;
+			} else {
+				e->len = len;
+				e->start = le16_to_cpu(extent[i].ee_start_hi);
+				e->start = (e->start << 32) +
+					le32_to_cpu(extent[i].ee_start_lo);
+			}
+		}
+
+		return 0;
+	}
+
+	buf = zalloc(blksz);
+	if (!buf)
+		return -ENOMEM;
+
+	index = (struct ext4_extent_idx *)(eh + 1);
+
+	for (i = 0; i < entries; i++) {
+		unsigned long long block;
 
 		block = le16_to_cpu(index[i].ei_leaf_hi);
 		block = (block << 32) + le32_to_cpu(index[i].ei_leaf_lo);
 
-		ret = ext4fs_devread(fs, block << log2_blksz, 0, blksz, buf);
+		ret = ext4fs_devread(data->fs, block << log2_blksz, 0, blksz, buf);
 		if (ret)
-			return NULL;
+			break;
+
+		ret = ext4fs_add_extents(node, (struct ext4_extent_header *)buf,
+				depth + 1);
+		if (ret)
+			break;
+	}
+
+	free(buf);
+
+	return ret;
+}
+
+/*
+ * Read the whole extent tree of an extent mapped file into the extent
+ * map of the node. This is done once, so that reads neither have to
+ * walk the tree nor re-read its index blocks for each file block.
+ */
+int ext4fs_map_extents(struct ext2fs_node *node)
+{
+	int ret;
+
+	if (node->extents || !(le32_to_cpu(node->inode.flags) & EXT4_EXTENTS_FL))
+		return 0;
+
+	ret = ext4fs_add_extents(node,
+			(struct ext4_extent_header *)node->inode.b.blocks.dir_blocks,
+			0);
+	if (ret) {
+		pr_err("invalid extent block\n");
+		free(node->extents);
+		node->extents = NULL;
+		node->num_extents = 0;
+	}
+
+	return ret;
+}
+
+/*
+ * Find the extent containing @fileblock in the extent map. Returns NULL
+ * if the block is in a hole, in this case @next (if given) is set to the
+ * first mapped block after the hole or to UINT_MAX if there is none.
+ */
+struct ext4fs_extent *ext4fs_find_extent(struct ext2fs_node *node,
+		uint32_t fileblock, uint32_t *next)
+{
+	int lo = 0, hi = node->num_extents - 1;
+
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		struct ext4fs_extent *e = &node->extents[mid];
+
+		if (fileblock < e->block)
+			hi = mid - 1;
+		else if (fileblock - e->block >= e->len)
+			lo = mid + 1;
 		else
-			ext_block = (struct ext4_extent_header *)buf;
+			return e;
 	}
+
+	if (next)
+		*next = lo < node->num_extents ?
+			node->extents[lo].block : UINT_MAX;
+
+	return NULL;
 }
 
 static int ext4fs_blockgroup(struct ext2_data *data, int group,
 		struct ext2_block_group *blkgrp)
 {
 	long int blkno;
-	unsigned int blkoff, desc_per_blk;
+	unsigned int blkoff, desc_per_blk, desc_size;
 	struct ext_filesystem *fs = data->fs;
 
-	desc_per_blk = EXT2_BLOCK_SIZE(data) / sizeof(struct ext2_block_group);
+	/* 64bit filesystems may use larger group descriptors */
+	desc_size = sizeof(struct ext2_block_group);
+	if ((__le32_to_cpu(data->sblock.feature_incompat) &
+	     EXT4_FEATURE_INCOMPAT_64BIT) &&
+	    __le16_to_cpu(data->sblock.descriptor_size) > desc_size)
+		desc_size = __le16_to_cpu(data->sblock.descriptor_size);
+
+	desc_per_blk = EXT2_BLOCK_SIZE(data) / desc_size;
 
 	blkno = __le32_to_cpu(data->sblock.first_data_block) + 1 +
 			group / desc_per_blk;
-	blkoff = (group % desc_per_blk) * sizeof(struct ext2_block_group);
+	blkoff = (group % desc_per_blk) * desc_size;
 
 	dev_dbg(fs->dev, "read %d group descriptor (blkno %ld blkoff %u)\n",
 	      group, blkno, blkoff);
@@ -139,13 +236,23 @@ static int ext4fs_get_indir_block(struct ext2fs_node *node,
 	if (indir->blkno == blkno)
 		return 0;
 
+	/* A zero block number is a hole, all blocks below it are unmapped */
+	if (!blkno) {
+		memset(indir->data, 0, blksz);
+		indir->blkno = 0;
+		return 0;
+	}
+
 	ret = ext4fs_devread(fs, blkno, 0, blksz, (void *)indir->data);
 	if (ret) {
+		indir->blkno = -1;
 		dev_err(fs->dev, "** SI ext2fs read block (indir 1)"
 			"failed. **\n");
 		return ret;
 	}
 
+	indir->blkno = blkno;
+
 	return 0;
 }
 
@@ -157,7 +264,6 @@ long int read_allocated_block(struct ext2fs_node *node, int fileblock)
 	long int rblock;
 	long int perblock_parent;
 	long int perblock_child;
-	unsigned long long start;
 	struct ext2_inode *inode = &node->inode;
 	struct ext2_data *data = node->data;
 	int ret;
@@ -167,47 +273,17 @@ long int read_allocated_block(struct ext2fs_node *node, int fileblock)
 	log2_blksz = LOG2_EXT2_BLOCK_SIZE(node->data);
 
 	if (le32_to_cpu(inode->flags) & EXT4_EXTENTS_FL) {
-		char *buf = zalloc(blksz);
-		struct ext4_extent_header *ext_block;
-		struct ext4_extent *extent;
-		int i = -1;
-
-		if (!buf)
-			return -ENOMEM;
-
-		ext_block = ext4fs_get_extent_block(node->data, buf,
-				(struct ext4_extent_header *)inode->b.blocks.dir_blocks,
-				fileblock, log2_blksz);
-		if (!ext_block) {
-			pr_err("invalid extent block\n");
-			free(buf);
-			return -EINVAL;
-		}
-
-		extent = (struct ext4_extent *)(ext_block + 1);
+		struct ext4fs_extent *extent;
 
-		do {
-			i++;
-			if (i >= le16_to_cpu(ext_block->eh_entries))
-				break;
-		} while (fileblock >= le32_to_cpu(extent[i].ee_block));
-
-		if (--i >= 0) {
-			fileblock -= le32_to_cpu(extent[i].ee_block);
-			if (fileblock >= le16_to_cpu(extent[i].ee_len)) {
-				free(buf);
-				return 0;
-			}
+		ret = ext4fs_map_extents(node);
+		if (ret)
+			return ret;
 
-			start = le16_to_cpu(extent[i].ee_start_hi);
-			start = (start << 32) +
-					le32_to_cpu(extent[i].ee_start_lo);
-			free(buf);
-			return fileblock + start;
-		}
+		extent = ext4fs_find_extent(node, fileblock, NULL);
+		if (!extent || !extent->start)
+			return 0;
 
-		free(buf);
-		return -EIO;
+		return extent->start + fileblock - extent->block;
 	}
 
 	if (fileblock < INDIRECT_BLOCKS) {
@@ -265,101 +341,290 @@ long int read_allocated_block(struct ext2fs_node *node, int fileblock)
 	return blknr;
 }
 
-int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
-				struct ext2fs_node **fnode, int *ftype)
+static int ext4fs_dirent_node(struct ext2fs_node *diro,
+		struct ext2_dirent *dirent, struct ext2fs_node **fnode,
+		int *ftype)
 {
-	unsigned int fpos = 0;
-	int status, ret;
-	struct ext2fs_node *diro = (struct ext2fs_node *) dir;
-	struct ext_filesystem *fs = dir->data->fs;
+	struct ext2fs_node *fdiro;
+	int type = FILETYPE_UNKNOWN;
+	int ret;
 
-	if (name != NULL)
-		dev_dbg(fs->dev, "Iterate dir %s\n", name);
+	fdiro = zalloc(sizeof(struct ext2fs_node));
+	if (!fdiro)
+		return -ENOMEM;
 
-	if (!diro->inode_read) {
-		ret = ext4fs_read_inode(diro->data, diro->ino, &diro->inode);
-		if (ret)
+	fdiro->data = diro->data;
+	fdiro->ino = __le32_to_cpu(dirent->inode);
+
+	if (dirent->filetype != FILETYPE_UNKNOWN) {
+		fdiro->inode_read = 0;
+
+		if (dirent->filetype == FILETYPE_DIRECTORY)
+			type = FILETYPE_DIRECTORY;
+		else if (dirent->filetype == FILETYPE_SYMLINK)
+			type = FILETYPE_SYMLINK;
+		else if (dirent->filetype == FILETYPE_REG)
+			type = FILETYPE_REG;
+	} else {
+		ret = ext4fs_read_inode(diro->data, __le32_to_cpu(dirent->inode),
+					&fdiro->inode);
+		if (ret) {
+			free(fdiro);
 			return ret;
+		}
+		fdiro->inode_read = 1;
+
+		if ((__le16_to_cpu(fdiro->inode.mode) &
+		     FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY) {
+			type = FILETYPE_DIRECTORY;
+		} else if ((__le16_to_cpu(fdiro->inode.mode)
+			    & FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK) {
+			type = FILETYPE_SYMLINK;
+		} else if ((__le16_to_cpu(fdiro->inode.mode)
+			    & FILETYPE_INO_MASK) == FILETYPE_INO_REG) {
+			type = FILETYPE_REG;
+		}
 	}
-	/* Search the file.  */
-	while (fpos < __le32_to_cpu(diro->inode.size)) {
-		struct ext2_dirent dirent;
-
-		status = ext4fs_read_file(diro, fpos,
-					   sizeof(struct ext2_dirent),
-					   (char *) &dirent);
-		if (status < 1)
+
+	*ftype = type;
+	*fnode = fdiro;
+
+	return 0;
+}
+
+/*
+ * Search a single directory block for @name. Returns -ENOENT when the
+ * name is not in this block.
+ */
+static int ext4fs_search_dir_block(struct ext2fs_node *diro, char *buf,
+		int len, const char *name, struct ext2fs_node **fnode,
+		int *ftype)
+{
+	struct ext_filesystem *fs = diro->data->fs;
+	int namelen = strlen(name);
+	int pos = 0;
+
+	while (pos + (int)sizeof(struct ext2_dirent) <= len) {
+		struct ext2_dirent *dirent = (void *)buf + pos;
+		int direntlen = __le16_to_cpu(dirent->direntlen);
+
+		if (direntlen < sizeof(struct ext2_dirent) ||
+		    pos + direntlen > len ||
+		    sizeof(struct ext2_dirent) + dirent->namelen > direntlen) {
+			dev_err(fs->dev, "corrupted directory entry in inode %d\n",
+				diro->ino);
 			return -EINVAL;
+		}
 
-		if (dirent.namelen != 0) {
-			char filename[dirent.namelen + 1];
-			struct ext2fs_node *fdiro;
-			int type = FILETYPE_UNKNOWN;
+		if (dirent->inode && dirent->namelen == namelen &&
+		    !memcmp(dirent + 1, name, namelen)) {
+			dev_dbg(fs->dev, "iterate >%s<\n", name);
+			return ext4fs_dirent_node(diro, dirent, fnode, ftype);
+		}
 
-			status = ext4fs_read_file(diro,
-						  fpos +
-						  sizeof(struct ext2_dirent),
-						  dirent.namelen, filename);
-			if (status < 1)
-				return -EINVAL;
+		pos += direntlen;
+	}
 
-			fdiro = zalloc(sizeof(struct ext2fs_node));
-			if (!fdiro)
-				return -ENOMEM;
+	return -ENOENT;
+}
 
-			fdiro->data = diro->data;
-			fdiro->ino = __le32_to_cpu(dirent.inode);
+static int ext4fs_read_dir_block(struct ext2fs_node *diro, uint32_t block,
+		char *buf)
+{
+	int log2bytes = LOG2_BLOCK_SIZE(diro->data);
+	int blocksize = 1 << log2bytes;
+	ssize_t ret;
 
-			filename[dirent.namelen] = '\0';
+	ret = ext4fs_read_file(diro, (loff_t)block << log2bytes, blocksize,
+			       buf);
+	if (ret < 0)
+		return ret;
+	if (ret < blocksize)
+		return -EINVAL;
 
-			if (dirent.filetype != FILETYPE_UNKNOWN) {
-				fdiro->inode_read = 0;
+	return 0;
+}
 
-				if (dirent.filetype == FILETYPE_DIRECTORY)
-					type = FILETYPE_DIRECTORY;
-				else if (dirent.filetype == FILETYPE_SYMLINK)
-					type = FILETYPE_SYMLINK;
-				else if (dirent.filetype == FILETYPE_REG)
-					type = FILETYPE_REG;
-			} else {
-				ret = ext4fs_read_inode(diro->data,
-							   __le32_to_cpu
-							   (dirent.inode),
-							   &fdiro->inode);
-				if (ret) {
-					free(fdiro);
-					return ret;
-				}
-				fdiro->inode_read = 1;
-
-				if ((__le16_to_cpu(fdiro->inode.mode) &
-				     FILETYPE_INO_MASK) ==
-				    FILETYPE_INO_DIRECTORY) {
-					type = FILETYPE_DIRECTORY;
-				} else if ((__le16_to_cpu(fdiro->inode.mode)
-					    & FILETYPE_INO_MASK) ==
-					   FILETYPE_INO_SYMLINK) {
-					type = FILETYPE_SYMLINK;
-				} else if ((__le16_to_cpu(fdiro->inode.mode)
-					    & FILETYPE_INO_MASK) ==
-					   FILETYPE_INO_REG) {
-					type = FILETYPE_REG;
-				}
-			}
+/*
+ * Look up @name in a hash indexed directory. Walks the index from the
+ * root block down to the leaf block the name hashes to and searches it,
+ * following leaf blocks marked as hash collision continuations.
+ *
+ * Returns -ENOSYS when the index can't be used, the caller then falls
+ * back to a linear scan.
+ */
+static int ext4fs_dx_lookup(struct ext2fs_node *diro, const char *name,
+		struct ext2fs_node **fnode, int *ftype)
+{
+	struct ext2_data *data = diro->data;
+	struct ext_filesystem *fs = data->fs;
+	int blocksize = EXT2_BLOCK_SIZE(data);
+	struct dx_root_info *info;
+	struct dx_countlimit *cl;
+	struct dx_entry *entries;
+	char *index, *leaf;
+	uint32_t hash, block;
+	int version, levels, root_levels, count, limit, lo, hi, at, ret;
+
+	index = malloc(blocksize);
+	leaf = malloc(blocksize);
+	if (!index || !leaf) {
+		ret = -ENOMEM;
+		goto out;
+	}
 
-			dev_dbg(fs->dev, "iterate >%s<\n", filename);
+	ret = ext4fs_read_dir_block(diro, 0, index);
+	if (ret)
+		goto out;
 
-			if (strcmp(filename, name) == 0) {
-				*ftype = type;
-				*fnode = fdiro;
-				return 0;
-			}
+	/* The root info follows the "." and ".." entries, 12 bytes each */
+	info = (void *)index + 24;
+	levels = info->indirect_levels;
+	version = info->hash_version;
+	/* info is overwritten when the index nodes are read into index */
+	root_levels = levels;
 
-			free(fdiro);
+	if (info->reserved_zero || info->info_length < sizeof(*info) ||
+	    levels >= DX_MAX_LEVELS || version > DX_HASH_TEA) {
+		ret = -ENOSYS;
+		goto out;
+	}
+
+	if (__le32_to_cpu(data->sblock.flags) & EXT2_FLAGS_UNSIGNED_HASH)
+		version += DX_HASH_LEGACY_UNSIGNED;
+
+	hash = ext4fs_dirhash(name, strlen(name), version,
+			      data->sblock.hash_seed);
+
+	entries = (void *)info + info->info_length;
+
+	for (;;) {
+		cl = (struct dx_countlimit *)entries;
+		count = __le16_to_cpu(cl->count);
+		limit = __le16_to_cpu(cl->limit);
+
+		if (!count || count > limit ||
+		    (void *)(entries + limit) > (void *)index + blocksize) {
+			ret = -ENOSYS;
+			goto out;
 		}
-		fpos += __le16_to_cpu(dirent.direntlen);
+
+		/* Find the last entry with a hash <= ours, entry 0 covers 0 */
+		lo = 1;
+		hi = count - 1;
+		while (lo <= hi) {
+			int mid = (lo + hi) / 2;
+
+			if (__le32_to_cpu(entries[mid].hash) > hash)
+				hi = mid - 1;
+			else
+				lo = mid + 1;
+		}
+		at = lo - 1;
+
+		block = __le32_to_cpu(entries[at].block) & 0x0fffffff;
+
+		if (!levels)
+			break;
+
+		levels--;
+
+		ret = ext4fs_read_dir_block(diro, block, index);
+		if (ret)
+			goto out;
+
+		/* Index nodes start with an empty directory entry */
+		entries = (void *)index + sizeof(struct ext2_dirent);
 	}
-	return -ENOENT;
+
+	for (;;) {
+		ret = ext4fs_read_dir_block(diro, block, leaf);
+		if (ret)
+			goto out;
+
+		ret = ext4fs_search_dir_block(diro, leaf, blocksize, name,
+					      fnode, ftype);
+		if (ret != -ENOENT)
+			goto out;
+
+		/*
+		 * Names with the same hash may continue in the next leaf,
+		 * marked by the collision bit in the next index entry.
+		 */
+		if (++at >= count) {
+			/* continuation in the next index node, rare enough */
+			if (root_levels)
+				ret = -ENOSYS;
+			goto out;
+		}
+
+		if ((__le32_to_cpu(entries[at].hash) & ~1) != hash)
+			goto out;
+
+		block = __le32_to_cpu(entries[at].block) & 0x0fffffff;
+	}
+
+out:
+	free(index);
+	free(leaf);
+
+	if (ret == -ENOSYS)
+		dev_dbg(fs->dev, "htree lookup of %s failed, falling back\n",
+			name);
+
+	return ret;
+}
+
+int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
+				struct ext2fs_node **fnode, int *ftype)
+{
+	struct ext2fs_node *diro = (struct ext2fs_node *) dir;
+	struct ext2_data *data = dir->data;
+	struct ext_filesystem *fs = data->fs;
+	int blocksize = EXT2_BLOCK_SIZE(data);
+	uint32_t block, blocks;
+	char *buf;
+	int ret;
+
+	dev_dbg(fs->dev, "Iterate dir %s\n", name);
+
+	if (!diro->inode_read) {
+		ret = ext4fs_read_inode(diro->data, diro->ino, &diro->inode);
+		if (ret)
+			return ret;
+		diro->inode_read = 1;
+	}
+
+	if ((__le32_to_cpu(data->sblock.feature_compatibility) &
+	     EXT2_FEATURE_COMPAT_DIR_INDEX) &&
+	    (__le32_to_cpu(diro->inode.flags) & EXT2_INDEX_FL)) {
+		ret = ext4fs_dx_lookup(diro, name, fnode, ftype);
+		if (ret != -ENOSYS)
+			return ret;
+	}
+
+	/* Search the file block by block. */
+	buf = malloc(blocksize);
+	if (!buf)
+		return -ENOMEM;
+
+	blocks = __le32_to_cpu(diro->inode.size) >> LOG2_BLOCK_SIZE(data);
+	ret = -ENOENT;
+
+	for (block = 0; block < blocks; block++) {
+		ret = ext4fs_read_dir_block(diro, block, buf);
+		if (ret)
+			break;
+
+		ret = ext4fs_search_dir_block(diro, buf, blocksize, name,
+					      fnode, ftype);
+		if (ret != -ENOENT)
+			break;
+	}
+
+	free(buf);
+
+	return ret;
 }
 
 char *ext4fs_read_symlink(struct ext2fs_node *node)
@@ -474,8 +739,13 @@ int ext4fs_open(struct ext2_data *data, const char *filename, struct ext2fs_node
 				&fdiro->inode);
 		if (ret)
 			goto fail;
+		fdiro->inode_read = 1;
 	}
 
+	ret = ext4fs_map_extents(fdiro);
+	if (ret)
+		goto fail;
+
 	*inode = fdiro;
 
 	return 0;
@@ -526,6 +796,9 @@ int ext4fs_mount(struct ext_filesystem *fs)
 	fs->data->indir1.data = malloc(blksz);
 	fs->data->indir2.data = malloc(blksz);
 	fs->data->indir3.data = malloc(blksz);
+	fs->data->indir1.blkno = -1;
+	fs->data->indir2.blkno = -1;
+	fs->data->indir3.blkno = -1;
 
 	if (!fs->data->indir1.data || !fs->data->indir2.data ||
 			!fs->data->indir3.data) {
@@ -546,6 +819,7 @@ fail:
 
 void ext4fs_umount(struct ext_filesystem *fs)
 {
+	free(fs->data->diropen.extents);
 	free(fs->data->indir1.data);
 	free(fs->data->indir2.data);
 	free(fs->data->indir3.data);
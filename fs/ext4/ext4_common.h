@@ -46,13 +46,28 @@ static inline void *zalloc(size_t size)
 	return p;
 }
 
+static inline loff_t ext4fs_inode_size(struct ext2_inode *inode)
+{
+	loff_t size = __le32_to_cpu(inode->size);
+
+	if ((__le16_to_cpu(inode->mode) & FILETYPE_INO_MASK) == FILETYPE_INO_REG)
+		size |= (loff_t)__le32_to_cpu(inode->dir_acl) << 32;
+
+	return size;
+}
+
 int ext4fs_read_inode(struct ext2_data *data, int ino,
 		      struct ext2_inode *inode);
-int ext4fs_read_file(struct ext2fs_node *node, int pos,
-		unsigned int len, char *buf);
+ssize_t ext4fs_read_file(struct ext2fs_node *node, loff_t pos,
+		size_t len, char *buf);
+int ext4fs_map_extents(struct ext2fs_node *node);
+struct ext4fs_extent *ext4fs_find_extent(struct ext2fs_node *node,
+		uint32_t fileblock, uint32_t *next);
 int ext4fs_find_file(const char *path, struct ext2fs_node *rootnode,
 			struct ext2fs_node **foundnode, int *foundtype);
 int ext4fs_iterate_dir(struct ext2fs_node *dir, char *name,
 			struct ext2fs_node **fnode, int *ftype);
+uint32_t ext4fs_dirhash(const char *name, int len, int version,
+			const uint32_t *seed);
 
 #endif
@@ -38,8 +38,62 @@
 
 void ext4fs_free_node(struct ext2fs_node *node, struct ext2fs_node *currroot)
 {
-	if ((node != &node->data->diropen) && (node != currroot))
+	if ((node != &node->data->diropen) && (node != currroot)) {
+		free(node->extents);
 		free(node);
+	}
+}
+
+/*
+ * Read from an extent mapped file. Each extent is read with a single
+ * device request directly into the caller's buffer, holes and unwritten
+ * extents are filled with zeroes.
+ */
+static int ext4fs_read_file_extents(struct ext2fs_node *node, loff_t pos,
+		size_t len, char *buf)
+{
+	struct ext_filesystem *fs = node->data->fs;
+	int log2blocksize = LOG2_EXT2_BLOCK_SIZE(node->data);
+	int log2bytes = log2blocksize + DISK_SECTOR_BITS;
+	loff_t blockmask = (1 << log2bytes) - 1;
+	int ret;
+
+	ret = ext4fs_map_extents(node);
+	if (ret)
+		return ret;
+
+	while (len) {
+		uint32_t fileblock = pos >> log2bytes;
+		int blockoff = pos & blockmask;
+		struct ext4fs_extent *extent;
+		uint32_t next;
+		loff_t now;
+
+		extent = ext4fs_find_extent(node, fileblock, &next);
+		if (extent)
+			next = extent->block + extent->len;
+
+		now = ((loff_t)(next - fileblock) << log2bytes) - blockoff;
+		if (now > len)
+			now = len;
+
+		if (extent && extent->start) {
+			uint64_t blknr = extent->start + fileblock - extent->block;
+
+			ret = ext4fs_devread(fs, blknr << log2blocksize,
+					blockoff, now, buf);
+			if (ret)
+				return ret;
+		} else {
+			memset(buf, 0, now);
+		}
+
+		buf += now;
+		pos += now;
+		len -= now;
+	}
+
+	return 0;
 }
 
 /*
@@ -47,43 +101,55 @@ void ext4fs_free_node(struct ext2fs_node *node, struct ext2fs_node *currroot)
  * Optimized read file API : collects and defers contiguous sector
  * reads into one potentially more efficient larger sequential read action
  */
-int ext4fs_read_file(struct ext2fs_node *node, int pos,
-		unsigned int len, char *buf)
+ssize_t ext4fs_read_file(struct ext2fs_node *node, loff_t pos,
+		size_t len, char *buf)
 {
-	int i;
-	int blockcnt;
+	uint32_t i;
+	uint32_t blockcnt;
 	int log2blocksize = LOG2_EXT2_BLOCK_SIZE(node->data);
-	int blocksize = 1 << (log2blocksize + DISK_SECTOR_BITS);
-	unsigned int filesize = __le32_to_cpu(node->inode.size);
+	int log2bytes = log2blocksize + DISK_SECTOR_BITS;
+	int blocksize = 1 << log2bytes;
+	loff_t filesize = ext4fs_inode_size(&node->inode);
 	int previous_block_number = -1;
-	int delayed_start = 0;
-	int delayed_extent = 0;
+	uint64_t delayed_start = 0;
+	size_t delayed_extent = 0;
 	int delayed_skipfirst = 0;
-	int delayed_next = 0;
+	uint64_t delayed_next = 0;
 	char *delayed_buf = NULL;
 	short ret;
 	struct ext_filesystem *fs = node->data->fs;
 
 	/* Adjust len so it we can't read past the end of the file. */
-	if (len > filesize)
-		len = filesize;
+	if (pos >= filesize)
+		return 0;
+	if (len > filesize - pos)
+		len = filesize - pos;
+
+	if (le32_to_cpu(node->inode.flags) & EXT4_EXTENTS_FL) {
+		ret = ext4fs_read_file_extents(node, pos, len, buf);
+		if (ret)
+			return ret;
+
+		return len;
+	}
 
-	blockcnt = ((len + pos) + blocksize - 1) / blocksize;
+	blockcnt = (len + pos + blocksize - 1) >> log2bytes;
 
-	for (i = pos / blocksize; i < blockcnt; i++) {
-		int blknr;
-		int blockoff = pos % blocksize;
+	for (i = pos >> log2bytes; i < blockcnt; i++) {
+		uint64_t blknr;
+		long int ret_blk;
+		int blockoff = pos & (blocksize - 1);
 		int blockend = blocksize;
 		int skipfirst = 0;
-		blknr = read_allocated_block(node, i);
-		if (blknr < 0)
-			return blknr;
+		ret_blk = read_allocated_block(node, i);
+		if (ret_blk < 0)
+			return ret_blk;
 
-		blknr = blknr << log2blocksize;
+		blknr = (uint64_t)ret_blk << log2blocksize;
 
 		/* Last block.  */
 		if (i == blockcnt - 1) {
-			blockend = (len + pos) % blocksize;
+			blockend = (len + pos) & (blocksize - 1);
 
 			/* The last portion is exactly blocksize. */
 			if (!blockend)
@@ -91,7 +157,7 @@ int ext4fs_read_file(struct ext2fs_node *node, int pos,
 		}
 
 		/* First block. */
-		if (i == pos / blocksize) {
+		if (i == pos >> log2bytes) {
 			skipfirst = blockoff;
 			blockend -= skipfirst;
 		}
@@ -135,7 +201,7 @@ int ext4fs_read_file(struct ext2fs_node *node, int pos,
 					return ret;
 				previous_block_number = -1;
 			}
-			memset(buf, 0, blocksize - skipfirst);
+			memset(buf, 0, blockend);
 		}
 		buf += blocksize - skipfirst;
 	}
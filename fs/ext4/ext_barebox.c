@@ -30,15 +30,14 @@
 #include <fcntl.h>
 #include "ext4_common.h"
 
-int ext4fs_devread(struct ext_filesystem *fs, int __sector, int byte_offset,
-		int byte_len, char *buf)
+int ext4fs_devread(struct ext_filesystem *fs, uint64_t sector, int byte_offset,
+		size_t byte_len, char *buf)
 {
 	ssize_t size;
-	uint64_t sector = __sector;
 
 	size = cdev_read(fs->cdev, buf, byte_len, sector * SECTOR_SIZE + byte_offset, 0);
 	if (size < 0) {
-		dev_err(fs->dev, "read error at sector %d: %s\n", __sector,
+		dev_err(fs->dev, "read error at sector %llu: %s\n", sector,
 				strerror(-size));
 		return size;
 	}
@@ -56,7 +55,7 @@ static int ext_open(struct device_d *dev, FILE *file, const char *filename)
 	if (ret)
 		return ret;
 
-	file->size = __le32_to_cpu(inode->inode.size);
+	file->size = ext4fs_inode_size(&inode->inode);
 	file->priv = inode;
 
 	return 0;
@@ -86,6 +85,8 @@ static loff_t ext_lseek(struct device_d *dev, FILE *f, loff_t pos)
 struct ext4fs_dir {
 	struct ext2fs_node *dirnode;
 	int fpos;
+	char *block;		/* currently loaded directory block */
+	int blockpos;		/* position of the loaded block, -1 if none */
 	DIR dir;
 };
 
@@ -118,46 +119,59 @@ static DIR *ext_opendir(struct device_d *dev, const char *pathname)
 		return NULL;
 	}
 
+	ext4_dir->block = xmalloc(EXT2_BLOCK_SIZE(fs->data));
+	ext4_dir->blockpos = -1;
+
 	return &ext4_dir->dir;
 }
 
 static struct dirent *ext_readdir(struct device_d *dev, DIR *dir)
 {
 	struct ext4fs_dir *ext4_dir = dir->priv;
-	struct ext2_dirent dirent;
 	struct ext2fs_node *diro = ext4_dir->dirnode;
-	int ret;
-	char *filename;
-
-	if (ext4_dir->fpos >= __le32_to_cpu(diro->inode.size))
-		return NULL;
-
-	ret = ext4fs_read_file(diro, ext4_dir->fpos, sizeof(struct ext2_dirent),
-			(char *) &dirent);
-	if (ret < 0)
-		return NULL;
-
-	if (dirent.namelen == 0)
-		return NULL;
-
-	filename = xzalloc(dirent.namelen + 1);
-
-	ret = ext4fs_read_file(diro, ext4_dir->fpos + sizeof(struct ext2_dirent),
-			dirent.namelen, filename);
-	if (ret < 0) {
-		free(filename);
-		return NULL;
+	int blocksize = EXT2_BLOCK_SIZE(diro->data);
+	int size = __le32_to_cpu(diro->inode.size);
+	ssize_t ret;
+
+	while (ext4_dir->fpos < size) {
+		struct ext2_dirent *dirent;
+		int blockpos = ext4_dir->fpos & ~(blocksize - 1);
+		int offset = ext4_dir->fpos - blockpos;
+		int direntlen;
+
+		/* Read the directory a whole block at a time */
+		if (blockpos != ext4_dir->blockpos) {
+			ret = ext4fs_read_file(diro, blockpos, blocksize,
+					       ext4_dir->block);
+			if (ret < blocksize)
+				return NULL;
+			ext4_dir->blockpos = blockpos;
+		}
+
+		if (offset + sizeof(struct ext2_dirent) > blocksize)
+			return NULL;
+
+		dirent = (void *)ext4_dir->block + offset;
+		direntlen = __le16_to_cpu(dirent->direntlen);
+
+		if (direntlen < sizeof(struct ext2_dirent) ||
+		    offset + direntlen > blocksize ||
+		    sizeof(struct ext2_dirent) + dirent->namelen > direntlen)
+			return NULL;
+
+		ext4_dir->fpos += direntlen;
+
+		/* Skip unused entries */
+		if (!dirent->inode || !dirent->namelen)
+			continue;
+
+		memcpy(dir->d.d_name, dirent + 1, dirent->namelen);
+		dir->d.d_name[dirent->namelen] = '\0';
+
+		return &dir->d;
 	}
 
-	filename[dirent.namelen] = '\0';
-
-	ext4_dir->fpos += __le16_to_cpu(dirent.direntlen);
-
-	strcpy(dir->d.d_name, filename);
-
-	free(filename);
-
-	return &dir->d;
+	return NULL;
 }
 
 static int ext_closedir(struct device_d *dev, DIR *dir)
@@ -167,6 +181,7 @@ static int ext_closedir(struct device_d *dev, DIR *dir)
 
 	ext4fs_free_node(ext4_dir->dirnode, &fs->data->diropen);
 
+	free(ext4_dir->block);
 	free(ext4_dir);
 
 	return 0;
@@ -186,7 +201,7 @@ static int ext_stat(struct device_d *dev, const char *filename, struct stat *s)
 	if (ret)
 		return ret;
 
-	s->st_size = __le32_to_cpu(node->inode.size);
+	s->st_size = ext4fs_inode_size(&node->inode);
 	s->st_mode = __le16_to_cpu(node->inode.mode);
 
 	ext4fs_free_node(node, &fs->data->diropen);
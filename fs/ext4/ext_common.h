@@ -114,6 +114,27 @@ struct ext2_sblock {
 	char volume_name[16];
 	char last_mounted_on[64];
 	uint32_t compression_info;
+	uint8_t prealloc_blocks;
+	uint8_t prealloc_dir_blocks;
+	uint16_t reserved_gdt_blocks;
+	uint8_t journal_uuid[16];
+	uint32_t journal_inode;
+	uint32_t journal_dev;
+	uint32_t last_orphan;
+	uint32_t hash_seed[4];
+	uint8_t default_hash_version;
+	uint8_t journal_backup_type;
+	uint16_t descriptor_size;
+	uint32_t default_mount_options;
+	uint32_t first_meta_block_group;
+	uint32_t mkfs_time;
+	uint32_t journal_blocks[17];
+	uint32_t total_blocks_high;
+	uint32_t reserved_blocks_high;
+	uint32_t free_blocks_high;
+	uint16_t min_extra_inode_size;
+	uint16_t want_extra_inode_size;
+	uint32_t flags;
 };
 
 struct ext2_block_group {
@@ -154,7 +175,7 @@ struct ext2_inode {
 	} b;
 	uint32_t version;
 	uint32_t acl;
-	uint32_t dir_acl;
+	uint32_t dir_acl;	/* upper 32 bits of the size for regular files */
 	uint32_t fragment_addr;
 	uint32_t osd2[3];
 };
@@ -167,11 +188,54 @@ struct ext2_dirent {
 	uint8_t filetype;
 };
 
+/* Hashed directory (htree) index structures */
+#define EXT2_INDEX_FL			0x00001000 /* Directory is hash indexed */
+#define EXT2_FEATURE_COMPAT_DIR_INDEX	0x0020
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002
+
+#define DX_HASH_LEGACY			0
+#define DX_HASH_HALF_MD4		1
+#define DX_HASH_TEA			2
+#define DX_HASH_LEGACY_UNSIGNED		3
+#define DX_HASH_HALF_MD4_UNSIGNED	4
+#define DX_HASH_TEA_UNSIGNED		5
+
+#define DX_MAX_LEVELS			3
+
+/* Follows the "." and ".." entries in the first directory block */
+struct dx_root_info {
+	uint32_t reserved_zero;
+	uint8_t hash_version;
+	uint8_t info_length;
+	uint8_t indirect_levels;
+	uint8_t unused_flags;
+};
+
+/* The first entry of each index node holds the count/limit pair instead of a hash */
+struct dx_countlimit {
+	uint16_t limit;
+	uint16_t count;
+};
+
+struct dx_entry {
+	uint32_t hash;
+	uint32_t block;
+};
+
+/* A cached extent of an extent mapped file */
+struct ext4fs_extent {
+	uint32_t block;		/* first logical block */
+	uint32_t len;		/* number of blocks */
+	uint64_t start;		/* first physical block, 0 if unwritten */
+};
+
 struct ext2fs_node {
 	struct ext2_data *data;
 	struct ext2_inode inode;
 	int ino;
 	int inode_read;
+	struct ext4fs_extent *extents;	/* extent map, sorted by block */
+	int num_extents;
 };
 
 struct ext4fs_indir_block {
@@ -366,6 +366,109 @@ static DWORD get_fat (	/* 0xFFFFFFFF:Disk error, 1:Internal error, Else:Cluster
 	return 0xFFFFFFFF;	/* An error occurred at the disk I/O layer */
 }
 
+/*
+ * Cluster run map - Build the list of contiguous cluster runs of a file
+ *
+ * The chain is followed on the FAT once and stored as (file cluster, volume
+ * cluster, length) runs, so that reads can span all clusters of a run with
+ * a single disk_read and seeks do not have to walk the chain again. This is
+ * only done for files which are not opened for writing, so the map never
+ * has to be invalidated.
+ */
+static int map_runs (
+	FIL *fp		/* Pointer to the file object */
+)
+{
+	FATFS *fs = fp->fs;
+	struct fat_clust_run *runs = NULL, *run = NULL, *tmp;
+	DWORD bcs, clst, fclust, nclust;
+	UINT nruns = 0, maxruns = 0;
+
+	bcs = (DWORD)fs->csize * SS(fs);
+	nclust = fp->fsize / bcs + (fp->fsize % bcs ? 1 : 0);
+	clst = fp->sclust;
+
+	for (fclust = 0; fclust < nclust; fclust++) {
+		if (fclust) {
+			clst = get_fat(fs, clst);
+			if (clst == 0xFFFFFFFF)
+				goto err_io;
+		}
+		if (clst < 2 || clst >= fs->n_fatent) {
+			free(runs);
+			return -ERESTARTSYS;
+		}
+		if (run && run->clust + run->len == clst) {
+			run->len++;
+			continue;
+		}
+		if (nruns == maxruns) {
+			maxruns = maxruns ? maxruns * 2 : 8;
+			tmp = realloc(runs, maxruns * sizeof(*runs));
+			if (!tmp) {
+				free(runs);
+				return -ENOMEM;
+			}
+			runs = tmp;
+		}
+		run = &runs[nruns++];
+		run->fclust = fclust;
+		run->clust = clst;
+		run->len = 1;
+	}
+
+	fp->runs = runs;
+	fp->nruns = nruns;
+
+	return 0;
+
+err_io:
+	free(runs);
+	return -EIO;
+}
+
+/*
+ * Cluster run map - Find the run containing a cluster index of the file
+ */
+static struct fat_clust_run *find_run (
+	FIL *fp,	/* Pointer to the file object */
+	DWORD fclust	/* Cluster index within the file */
+)
+{
+	UINT lo = 0, hi = fp->nruns, mid;
+	struct fat_clust_run *run;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		run = &fp->runs[mid];
+		if (fclust < run->fclust)
+			hi = mid;
+		else if (fclust >= run->fclust + run->len)
+			lo = mid + 1;
+		else
+			return run;
+	}
+
+	return NULL;
+}
+
+/*
+ * Cluster run map - Map the file on first use if it can be mapped at all
+ */
+static int use_runs (
+	FIL *fp		/* Pointer to the file object */
+)
+{
+#ifdef CONFIG_FS_FAT_WRITE
+	if (fp->flag & FA_WRITE)
+		return 0;
+#endif
+	if (!fp->runs && fp->fsize && map_runs(fp))
+		return 0;
+
+	return fp->runs != NULL;
+}
+
 
 
 
@@ -1809,6 +1912,8 @@ int f_open (
 		fp->fsize = LD_DWORD(dir+DIR_FileSize);	/* File size */
 		fp->fptr = 0;			/* File pointer */
 		fp->dsect = 0;
+		fp->runs = NULL;		/* Cluster runs are mapped on first use */
+		fp->nruns = 0;
 		fp->fs = dj.fs;
 	}
 
@@ -1828,9 +1933,11 @@ int f_read (
 	UINT *br		/* Pointer to number of bytes read */
 )
 {
-	DWORD clst, sect, remain;
-	UINT rcnt, cc;
+	DWORD clst, sect, remain, bcs;
+	UINT rcnt, cc, maxcc;
 	BYTE csect, *rbuff = buff;
+	struct fat_clust_run *run = NULL;
+	int mapped;
 
 	*br = 0;	/* Initialize byte counter */
 
@@ -1842,11 +1949,19 @@ int f_read (
 	if (btr > remain)
 		btr = (UINT)remain;	/* Truncate btr by remaining bytes */
 
+	mapped = btr ? use_runs(fp) : 0;	/* Use the cluster run map if possible */
+	bcs = (DWORD)fp->fs->csize * SS(fp->fs);
+
 	/* Repeat until all data read */
 	for ( ;  btr; rbuff += rcnt, fp->fptr += rcnt, *br += rcnt, btr -= rcnt) {
 		if ((fp->fptr % SS(fp->fs)) == 0) {		/* On the sector boundary? */
 			csect = (BYTE)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));	/* Sector offset in the cluster */
-			if (!csect) {				/* On the cluster boundary? */
+			if (mapped) {			/* Look up the current cluster in the run map */
+				run = find_run(fp, fp->fptr / bcs);
+				if (!run)
+					ABORT(fp->fs, -ERESTARTSYS);
+				fp->clust = run->clust + (fp->fptr / bcs - run->fclust);
+			} else if (!csect) {		/* On the cluster boundary? */
 				if (fp->fptr == 0) {		/* On the top of the file? */
 					clst = fp->sclust;	/* Follow from the origin */
 				} else {			/* Middle or end of the file */
@@ -1864,9 +1979,12 @@ int f_read (
 			sect += csect;
 			cc = btr / SS(fp->fs);		/* When remaining bytes >= sector size, */
 			if (cc) {			/* Read maximum contiguous sectors directly */
-				if (csect + cc > fp->fs->csize)	/* Clip at cluster boundary */
-					cc = fp->fs->csize - csect;
-				if (disk_read(fp->fs, rbuff, sect, (BYTE)cc) != RES_OK)
+				maxcc = fp->fs->csize - csect;	/* Clip at cluster boundary or, */
+				if (mapped)			/* with a run map, at the end of the run */
+					maxcc += (run->fclust + run->len - 1 - fp->fptr / bcs) * fp->fs->csize;
+				if (cc > maxcc)
+					cc = maxcc;
+				if (disk_read(fp->fs, rbuff, sect, cc) != RES_OK)
 					ABORT(fp->fs, -EIO);
 #if defined CONFIG_FS_FAT_WRITE
 				/* Replace one of the read sectors with cached data if it contains a dirty sector */
@@ -1874,6 +1992,8 @@ int f_read (
 					memcpy(rbuff + ((fp->dsect - sect) * SS(fp->fs)), fp->buf, SS(fp->fs));
 #endif
 				rcnt = SS(fp->fs) * cc;	/* Number of bytes transferred */
+				if (mapped)		/* Keep the current cluster at the last one read */
+					fp->clust = run->clust + ((fp->fptr + rcnt - 1) / bcs - run->fclust);
 				continue;
 			}
 			if (fp->dsect != sect) {	/* Load data sector if not in cache */
@@ -2051,12 +2171,18 @@ int f_close (
 	FIL *fp		/* Pointer to the file object to be closed */
 )
 {
+#ifdef CONFIG_FS_FAT_WRITE
+	int res;
+#endif
+
+	free(fp->runs);		/* Discard cluster run map */
+	fp->runs = NULL;
+	fp->nruns = 0;
+
 #ifndef CONFIG_FS_FAT_WRITE
 	fp->fs = 0;	/* Discard file object */
 	return 0;
 #else
-	int res;
-
 	/* Flush cached data */
 	res = f_sync(fp);
 	if (res == 0)
@@ -2087,7 +2213,23 @@ int f_lseek (
 
 	ifptr = fp->fptr;
 	fp->fptr = nsect = 0;
-	if (ofs) {
+	if (ofs && use_runs(fp)) {	/* Look up the target cluster in the run map */
+		struct fat_clust_run *run;
+
+		bcs = (DWORD)fp->fs->csize * SS(fp->fs);	/* Cluster size (byte) */
+		run = find_run(fp, (ofs - 1) / bcs);
+		if (!run)
+			ABORT(fp->fs, -ERESTARTSYS);
+		clst = run->clust + ((ofs - 1) / bcs - run->fclust);
+		fp->clust = clst;
+		fp->fptr = ofs;
+		if (ofs % SS(fp->fs)) {
+			nsect = clust2sect(fp->fs, clst);	/* Current sector */
+			if (!nsect)
+				ABORT(fp->fs, -ERESTARTSYS);
+			nsect += ((ofs - 1) % bcs) / SS(fp->fs);
+		}
+	} else if (ofs) {
 		bcs = (DWORD)fp->fs->csize * SS(fp->fs);	/* Cluster size (byte) */
 		if (ifptr > 0 &&
 			(ofs - 1) / bcs >= (ifptr - 1) / bcs) {	/* When seek to same or following cluster, */
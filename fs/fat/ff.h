@@ -81,6 +81,14 @@ typedef struct {
 
 
 
+/* Run of physically contiguous clusters of a file */
+
+struct fat_clust_run {
+	DWORD	fclust;		/* Index of the first cluster within the file */
+	DWORD	clust;		/* First cluster number on the volume */
+	DWORD	len;		/* Number of clusters in the run */
+};
+
 /* File object structure (FIL) */
 
 typedef struct {
@@ -92,6 +100,8 @@ typedef struct {
 	DWORD	sclust;		/* File start cluster (0 when fsize==0) */
 	DWORD	clust;		/* Current cluster */
 	DWORD	dsect;		/* Current data sector */
+	struct fat_clust_run *runs;	/* Cluster run map (read-only files, NULL until mapped) */
+	UINT	nruns;		/* Number of entries in runs[] */
 #ifdef CONFIG_FS_FAT_WRITE
 	DWORD	dir_sect;	/* Sector containing the directory entry */
 	BYTE*	dir_ptr;	/* Ponter to the directory entry in the window */
@@ -0,0 +1,511 @@
+/*
+ * http.c - read only filesystem on top of a HTTP server
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define pr_fmt(fmt) "http: " fmt
+
+#include <common.h>
+#include <net.h>
+#include <driver.h>
+#include <fs.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <init.h>
+#include <malloc.h>
+#include <linux/stat.h>
+#include <linux/err.h>
+#include <linux/ctype.h>
+#include <linux/sizes.h>
+
+#define HTTP_PORT	80
+
+/* Forward seeks up to this distance read and discard the data in between */
+#define HTTP_SKIP_MAX	SZ_64K
+
+#define HTTP_LINE_MAX	512
+
+struct http_priv {
+	IPaddr_t server;
+	uint16_t port;
+	char *host;		/* for the Host: header */
+	char *root;		/* path prefix on the server */
+};
+
+struct file_priv {
+	struct http_priv *hpriv;
+	struct tcp_connection *tcp;
+	char *path;
+	int status;
+	bool redirect_dir;	/* redirected to path/ */
+	loff_t pos;		/* position of the body stream */
+	loff_t end;		/* end of the body, -1 if unknown */
+	loff_t size;		/* size of the file, -1 if unknown */
+	unsigned char buf[HTTP_LINE_MAX];
+	int buf_pos;
+	int buf_len;
+};
+
+static int http_fill(struct file_priv *priv)
+{
+	int ret;
+
+	ret = tcp_read(priv->tcp, priv->buf, sizeof(priv->buf));
+	if (ret < 0)
+		return ret;
+
+	priv->buf_pos = 0;
+	priv->buf_len = ret;
+
+	return ret;
+}
+
+/* Read a header line without the line ending, overlong lines are truncated */
+static int http_getline(struct file_priv *priv, char *line, int size)
+{
+	int len = 0, ret;
+
+	while (1) {
+		char c;
+
+		if (priv->buf_pos == priv->buf_len) {
+			ret = http_fill(priv);
+			if (ret < 0)
+				return ret;
+			if (!ret)
+				return -EPROTO;
+		}
+
+		c = priv->buf[priv->buf_pos++];
+		if (c == '\n')
+			break;
+		if (c != '\r' && len < size - 1)
+			line[len++] = c;
+	}
+
+	line[len] = 0;
+
+	return len;
+}
+
+static int http_read_body(struct file_priv *priv, void *buf, int size)
+{
+	int ret;
+
+	if (priv->end >= 0)
+		size = min_t(loff_t, size, priv->end - priv->pos);
+
+	if (!size)
+		return 0;
+
+	if (priv->buf_pos < priv->buf_len) {
+		ret = min(size, priv->buf_len - priv->buf_pos);
+		memcpy(buf, priv->buf + priv->buf_pos, ret);
+		priv->buf_pos += ret;
+	} else {
+		ret = tcp_read(priv->tcp, buf, size);
+		if (ret < 0)
+			return ret;
+		if (!ret && priv->end >= 0)
+			return -EPROTO;
+	}
+
+	priv->pos += ret;
+
+	return ret;
+}
+
+static int http_skip(struct file_priv *priv, loff_t count)
+{
+	char tmp[256];
+	int ret;
+
+	while (count) {
+		ret = http_read_body(priv, tmp, min_t(loff_t, count, sizeof(tmp)));
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			return -EPROTO;
+		count -= ret;
+	}
+
+	return 0;
+}
+
+static void http_disconnect(struct file_priv *priv)
+{
+	if (priv->tcp)
+		tcp_close(priv->tcp);
+	priv->tcp = NULL;
+}
+
+static int http_parse_header(struct file_priv *priv, char *line,
+		loff_t *start)
+{
+	char *val = strchr(line, ':');
+
+	if (!val)
+		return 0;
+
+	val = skip_spaces(val + 1);
+
+	if (!strncasecmp(line, "Content-Length:", 15)) {
+		priv->end = simple_strtoull(val, NULL, 10);
+	} else if (!strncasecmp(line, "Content-Range:", 14)) {
+		/* bytes <first>-<last>/<size> */
+		char *p;
+
+		if (strncasecmp(val, "bytes ", 6))
+			return -EPROTO;
+		*start = simple_strtoull(val + 6, &p, 10);
+		p = strchr(p, '/');
+		if (p && isdigit(p[1]))
+			priv->size = simple_strtoull(p + 1, NULL, 10);
+	} else if (!strncasecmp(line, "Location:", 9)) {
+		int len = strlen(val);
+
+		priv->redirect_dir = len && val[len - 1] == '/';
+	}
+
+	return 0;
+}
+
+/*
+ * Send a request for the file starting at @offset and parse the response
+ * header. On success the body can be read with http_read_body().
+ */
+static int http_request(struct file_priv *priv, const char *method,
+		loff_t offset)
+{
+	struct http_priv *hpriv = priv->hpriv;
+	char *line, *req;
+	loff_t start = 0;
+	int ret;
+
+	http_disconnect(priv);
+
+	priv->tcp = tcp_connect(hpriv->server, hpriv->port);
+	if (IS_ERR(priv->tcp)) {
+		ret = PTR_ERR(priv->tcp);
+		priv->tcp = NULL;
+		return ret;
+	}
+
+	priv->buf_pos = priv->buf_len = 0;
+	priv->end = -1;
+	priv->redirect_dir = false;
+
+	if (offset)
+		req = asprintf("%s %s HTTP/1.0\r\nHost: %s\r\n"
+				"User-Agent: barebox\r\nRange: bytes=%lld-\r\n\r\n",
+				method, priv->path, hpriv->host, offset);
+	else
+		req = asprintf("%s %s HTTP/1.0\r\nHost: %s\r\n"
+				"User-Agent: barebox\r\n\r\n",
+				method, priv->path, hpriv->host);
+	if (!req) {
+		http_disconnect(priv);
+		return -ENOMEM;
+	}
+
+	ret = tcp_write(priv->tcp, req, strlen(req));
+	free(req);
+	if (ret < 0) {
+		http_disconnect(priv);
+		return ret;
+	}
+
+	line = xmalloc(HTTP_LINE_MAX);
+
+	ret = http_getline(priv, line, HTTP_LINE_MAX);
+	if (ret < 0)
+		goto out;
+
+	if (strncmp(line, "HTTP/1.", 7) || strlen(line) < 12) {
+		ret = -EPROTO;
+		goto out;
+	}
+
+	priv->status = simple_strtoul(line + 9, NULL, 10);
+
+	pr_debug("%s %s: %s\n", method, priv->path, line);
+
+	while (1) {
+		ret = http_getline(priv, line, HTTP_LINE_MAX);
+		if (ret < 0)
+			goto out;
+		if (!ret)
+			break;
+		ret = http_parse_header(priv, line, &start);
+		if (ret)
+			goto out;
+	}
+
+	switch (priv->status) {
+	case 200:
+		start = 0;
+		if (priv->end >= 0)
+			priv->size = priv->end;
+		break;
+	case 206:
+		if (priv->end >= 0)
+			priv->end += start;
+		break;
+	case 301:
+	case 302:
+	case 307:
+	case 308:
+		ret = priv->redirect_dir ? -EISDIR : -EIO;
+		goto out;
+	case 416:
+		/* Range not satisfiable, we are at the end of the file */
+		start = offset;
+		priv->end = offset;
+		break;
+	case 401:
+	case 403:
+		ret = -EACCES;
+		goto out;
+	case 404:
+		ret = -ENOENT;
+		goto out;
+	default:
+		pr_err("%s %s: %s\n", method, priv->path, line);
+		ret = -EIO;
+		goto out;
+	}
+
+	if (start > offset) {
+		ret = -EPROTO;
+		goto out;
+	}
+
+	priv->pos = start;
+
+	/* The server may ignore the Range header and send the whole file */
+	ret = http_skip(priv, offset - start);
+out:
+	free(line);
+
+	if (ret)
+		http_disconnect(priv);
+
+	return ret;
+}
+
+static struct file_priv *http_do_open(struct device_d *dev,
+		const char *filename, const char *method)
+{
+	struct http_priv *hpriv = dev->priv;
+	struct file_priv *priv;
+	int ret;
+
+	priv = xzalloc(sizeof(*priv));
+	priv->hpriv = hpriv;
+	priv->size = -1;
+	priv->path = asprintf("%s%s", hpriv->root, filename);
+	if (!priv->path) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	ret = http_request(priv, method, 0);
+	if (ret)
+		goto err;
+
+	return priv;
+err:
+	free(priv->path);
+	free(priv);
+
+	return ERR_PTR(ret);
+}
+
+static void http_do_close(struct file_priv *priv)
+{
+	http_disconnect(priv);
+	free(priv->path);
+	free(priv);
+}
+
+static int http_open(struct device_d *dev, FILE *file, const char *filename)
+{
+	struct file_priv *priv;
+
+	priv = http_do_open(dev, filename, "GET");
+	if (IS_ERR(priv))
+		return PTR_ERR(priv);
+
+	file->priv = priv;
+	file->size = priv->size >= 0 ? priv->size : FILE_SIZE_STREAM;
+
+	return 0;
+}
+
+static int http_close(struct device_d *dev, FILE *f)
+{
+	http_do_close(f->priv);
+
+	return 0;
+}
+
+static int http_read(struct device_d *dev, FILE *f, void *buf, size_t insize)
+{
+	struct file_priv *priv = f->priv;
+	size_t outsize = 0;
+	int ret;
+
+	if (f->pos != priv->pos || !priv->tcp) {
+		if (priv->tcp && f->pos > priv->pos &&
+		    f->pos - priv->pos <= HTTP_SKIP_MAX)
+			ret = http_skip(priv, f->pos - priv->pos);
+		else
+			ret = -EAGAIN;
+
+		if (ret)
+			ret = http_request(priv, "GET", f->pos);
+		if (ret)
+			return ret;
+	}
+
+	while (outsize < insize) {
+		ret = http_read_body(priv, buf + outsize, insize - outsize);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			break;
+		outsize += ret;
+	}
+
+	return outsize;
+}
+
+static loff_t http_lseek(struct device_d *dev, FILE *f, loff_t pos)
+{
+	/* The new position is requested with the next read */
+	f->pos = pos;
+
+	return pos;
+}
+
+static DIR *http_opendir(struct device_d *dev, const char *pathname)
+{
+	/* HTTP has no generic way to list a directory */
+	return NULL;
+}
+
+static int http_stat(struct device_d *dev, const char *filename,
+		struct stat *s)
+{
+	struct file_priv *priv;
+	int len = strlen(filename);
+
+	if (!len || filename[len - 1] == '/') {
+		s->st_mode = S_IFDIR | S_IRWXU | S_IRWXG | S_IRWXO;
+		return 0;
+	}
+
+	priv = http_do_open(dev, filename, "HEAD");
+	if (PTR_ERR(priv) == -EISDIR) {
+		s->st_mode = S_IFDIR | S_IRWXU | S_IRWXG | S_IRWXO;
+		return 0;
+	}
+	if (IS_ERR(priv))
+		return PTR_ERR(priv);
+
+	s->st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+	s->st_size = priv->size >= 0 ? priv->size : FILESIZE_MAX;
+
+	http_do_close(priv);
+
+	return 0;
+}
+
+static int http_probe(struct device_d *dev)
+{
+	struct fs_device_d *fsdev = dev_to_fs_device(dev);
+	struct http_priv *priv;
+	char *host, *p;
+	int ret;
+
+	priv = xzalloc(sizeof(*priv));
+	dev->priv = priv;
+
+	/* <host>[:<port>][/<path>] */
+	host = xstrdup(fsdev->backingstore);
+
+	p = strchr(host, '/');
+	if (p) {
+		priv->root = xstrdup(p);
+		*p = 0;
+		/* the filenames we get start with a slash */
+		p = priv->root + strlen(priv->root) - 1;
+		if (*p == '/')
+			*p = 0;
+	} else {
+		priv->root = xstrdup("");
+	}
+
+	priv->host = xstrdup(host);
+
+	priv->port = HTTP_PORT;
+	p = strchr(host, ':');
+	if (p) {
+		*p++ = 0;
+		priv->port = simple_strtoul(p, NULL, 10);
+	}
+
+	priv->server = resolv(host);
+	free(host);
+
+	if (!priv->server || !priv->port) {
+		ret = -EINVAL;
+		goto err;
+	}
+
+	return 0;
+err:
+	free(priv->host);
+	free(priv->root);
+	free(priv);
+
+	return ret;
+}
+
+static void http_remove(struct device_d *dev)
+{
+	struct http_priv *priv = dev->priv;
+
+	free(priv->host);
+	free(priv->root);
+	free(priv);
+}
+
+static struct fs_driver_d http_driver = {
+	.open      = http_open,
+	.close     = http_close,
+	.read      = http_read,
+	.lseek     = http_lseek,
+	.opendir   = http_opendir,
+	.stat      = http_stat,
+	.flags     = 0,
+	.drv = {
+		.probe  = http_probe,
+		.remove = http_remove,
+		.name = "http",
+	}
+};
+
+static int http_init(void)
+{
+	return register_fs_driver(&http_driver);
+}
+coredevice_initcall(http_init);
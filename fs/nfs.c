@@ -32,7 +32,6 @@
 #include <init.h>
 #include <linux/stat.h>
 #include <linux/err.h>
-#include <kfifo.h>
 #include <linux/sizes.h>
 #include <byteorder.h>
 #include <globalvar.h>
@@ -58,6 +57,7 @@
 #define NFSPROC3_READLINK	5
 #define NFSPROC3_READ		6
 #define NFSPROC3_READDIR	16
+#define NFSPROC3_FSINFO		19
 
 #define NFS3_FHSIZE      64
 #define NFS3_COOKIEVERFSIZE	8
@@ -128,6 +128,29 @@ struct rpc_reply {
 #define NFS_TIMEOUT	(2 * SECOND)
 #define NFS_MAX_RESEND	5
 
+/* Number of READ requests in flight per file */
+#define NFS_READ_WINDOW		8
+/* Without fragment reassembly a READ reply has to fit into a single frame */
+#define NFS_READ_SIZE_FRAME	1024
+#define NFS_READ_SIZE_MAX	(IS_ENABLED(CONFIG_NET_IP_FRAGMENTS) ? \
+				 SZ_32K : NFS_READ_SIZE_FRAME)
+
+struct nfs_read {
+	uint32_t xid;
+	uint64_t offset;
+	uint32_t count;		/* bytes requested */
+	uint32_t len;		/* bytes received */
+	uint32_t pos;		/* bytes already returned to the reader */
+	uint64_t sent;
+	int tries;
+	int state;
+#define READ_PENDING	1
+#define READ_DONE	2
+	int err;
+	int eof;
+	void *buf;
+};
+
 struct nfs_priv {
 	struct net_connection *con;
 	IPaddr_t server;
@@ -139,11 +162,18 @@ struct nfs_priv {
 	uint32_t rpc_id;
 	uint32_t rootfh_len;
 	char rootfh[NFS3_FHSIZE];
+	unsigned short rsize;
+	struct file_priv *reader;	/* file READ replies are routed to */
 };
 
 struct file_priv {
-	struct kfifo *fifo;
+	/* ring of READ requests, read_head is the one at read_pos */
+	struct nfs_read *reads;
 	void *buf;
+	int read_head;
+	int read_cnt;
+	uint64_t read_pos;		/* file offset returned next */
+	uint64_t read_next;		/* file offset requested next */
 	uint32_t filefh_len;
 	char filefh[NFS3_FHSIZE];
 	struct nfs_priv *npriv;
@@ -350,13 +380,9 @@ static int rpc_check_reply(unsigned char *pkt,
 
 	memcpy(&rpc, pkt, sizeof(rpc));
 
-	if (ntoh32(rpc.id) != rpc_id) {
-		if (rpc_id - ntoh32(rpc.id) == 1)
-			/* stale packet, wait a bit longer */
-			return 0;
-
-		return -EINVAL;
-	}
+	if (ntoh32(rpc.id) != rpc_id)
+		/* stale packet, wait a bit longer */
+		return -EAGAIN;
 
 	if (rpc.rstatus  ||
 	    rpc.verifier ||
@@ -377,28 +403,21 @@ static int rpc_check_reply(unsigned char *pkt,
 }
 
 /*
- * rpc_req - synchronous RPC request
+ * rpc_send - send an RPC call with transaction id xid
  */
-static int rpc_req(struct nfs_priv *npriv, int rpc_prog, int rpc_proc,
-		uint32_t *data, int datalen)
+static int rpc_send(struct nfs_priv *npriv, uint32_t xid, int rpc_prog,
+		int rpc_proc, uint32_t *data, int datalen)
 {
 	struct rpc_call pkt;
 	unsigned short dport;
-	int ret;
 	unsigned char *payload = net_udp_get_payload(npriv->con);
-	int nfserr;
-	int tries = 0;
 
-	npriv->rpc_id++;
-
-	pkt.id = hton32(npriv->rpc_id);
+	pkt.id = hton32(xid);
 	pkt.type = hton32(MSG_CALL);
 	pkt.rpcvers = hton32(2);	/* use RPC version 2 */
 	pkt.prog = hton32(rpc_prog);
 	pkt.proc = hton32(rpc_proc);
 
-	debug("%s: prog: %d, proc: %d\n", __func__, rpc_prog, rpc_proc);
-
 	if (rpc_prog == PROG_PORTMAP) {
 		dport = SUNRPC_PORT;
 		pkt.vers = hton32(2);
@@ -415,9 +434,27 @@ static int rpc_req(struct nfs_priv *npriv, int rpc_prog, int rpc_proc,
 
 	npriv->con->udp->uh_dport = hton16(dport);
 
-again:
-	ret = net_udp_send(npriv->con,
+	return net_udp_send(npriv->con,
 			sizeof(pkt) + datalen * sizeof(uint32_t));
+}
+
+/*
+ * rpc_req - synchronous RPC request
+ */
+static int rpc_req(struct nfs_priv *npriv, int rpc_prog, int rpc_proc,
+		uint32_t *data, int datalen)
+{
+	int ret;
+	int nfserr;
+	int tries = 0;
+
+	npriv->rpc_id++;
+
+	debug("%s: prog: %d, proc: %d\n", __func__, rpc_prog, rpc_proc);
+
+again:
+	ret = rpc_send(npriv, npriv->rpc_id, rpc_prog, rpc_proc, data,
+			datalen);
 
 	nfs_timer_start = get_time_ns();
 
@@ -444,6 +481,12 @@ again:
 			ret = nfserr;
 			break;
 		}
+
+		if (ret == -EAGAIN) {
+			/* no reply or not ours, keep waiting */
+			nfs_state = STATE_START;
+			nfs_packet = NULL;
+		}
 	}
 
 	return ret;
@@ -648,6 +691,75 @@ static int nfs_mount_req(struct nfs_priv *npriv)
 	return 0;
 }
 
+/*
+ * nfs_fsinfo_req - Get the preferred read size of the server
+ */
+static int nfs_fsinfo_req(struct nfs_priv *npriv)
+{
+	uint32_t data[1024];
+	uint32_t *p;
+	uint32_t rtmax, rtpref;
+	int len;
+	int ret;
+
+	/*
+	 * struct FSINFO3args {
+	 * 	nfs_fh3 fsroot;
+	 * };
+	 *
+	 * struct FSINFO3resok {
+	 * 	post_op_attr obj_attributes;
+	 * 	uint32 rtmax;
+	 * 	uint32 rtpref;
+	 * 	uint32 rtmult;
+	 * 	uint32 wtmax;
+	 * 	uint32 wtpref;
+	 * 	uint32 wtmult;
+	 * 	uint32 dtpref;
+	 * 	size3 maxfilesize;
+	 * 	nfstime3 time_delta;
+	 * 	uint32 properties;
+	 * };
+	 *
+	 * struct FSINFO3resfail {
+	 * 	post_op_attr obj_attributes;
+	 * };
+	 *
+	 * union FSINFO3res switch (nfsstat3 status) {
+	 * case NFS3_OK:
+	 * 	FSINFO3resok resok;
+	 * default:
+	 * 	FSINFO3resfail resfail;
+	 * };
+	 */
+	p = &(data[0]);
+	p = rpc_add_credentials(p);
+
+	p = nfs_add_fh3(p, npriv->rootfh_len, npriv->rootfh);
+
+	len = p - &(data[0]);
+
+	ret = rpc_req(npriv, PROG_NFS, NFSPROC3_FSINFO, data, len);
+	if (ret)
+		return ret;
+
+	p = nfs_packet + sizeof(struct rpc_reply) + 4;
+
+	p = nfs_read_post_op_attr(p, NULL);
+
+	rtmax = ntoh32(net_read_uint32(p));
+	rtpref = ntoh32(net_read_uint32(p + 1));
+
+	debug("%s: rtmax: %u, rtpref: %u\n", __func__, rtmax, rtpref);
+
+	/* Use the preferred size unless the user asked for a size */
+	if (!npriv->rsize)
+		npriv->rsize = min_t(uint32_t, rtpref, NFS_READ_SIZE_MAX);
+	npriv->rsize = min_t(uint32_t, npriv->rsize, rtmax);
+
+	return 0;
+}
+
 /*
  * nfs_umountall_req - Unmount all our NFS Filesystems on the Server
  */
@@ -871,16 +983,13 @@ static void *nfs_readdirattr_req(struct file_priv *priv, struct nfs_dir *dir)
 }
 
 /*
- * nfs_read_req - Read File on NFS Server
+ * nfs_read_send - (Re)send the READ request of a read-ahead slot
  */
-static int nfs_read_req(struct file_priv *priv, uint64_t offset,
-		uint32_t readlen)
+static int nfs_read_send(struct file_priv *priv, struct nfs_read *r)
 {
 	uint32_t data[1024];
 	uint32_t *p;
 	int len;
-	int ret;
-	uint32_t rlen, eof;
 
 	/*
 	 * struct READ3args {
@@ -888,7 +997,41 @@ static int nfs_read_req(struct file_priv *priv, uint64_t offset,
 	 * 	offset3 offset;
 	 * 	count3 count;
 	 * };
-	 *
+	 */
+	p = &(data[0]);
+	p = rpc_add_credentials(p);
+
+	p = nfs_add_fh3(p, priv->filefh_len, priv->filefh);
+	p = nfs_add_uint64(p, r->offset);
+	p = nfs_add_uint32(p, r->count);
+
+	len = p - &(data[0]);
+
+	r->sent = get_time_ns();
+
+	return rpc_send(priv->npriv, r->xid, PROG_NFS, NFSPROC3_READ, data, len);
+}
+
+static struct nfs_read *nfs_read_slot(struct file_priv *priv, int i)
+{
+	return &priv->reads[(priv->read_head + i) % NFS_READ_WINDOW];
+}
+
+/*
+ * nfs_read_reply - Handle the reply to a READ request of the read-ahead
+ *
+ * Returns 1 if the packet is the reply to one of our READ requests.
+ */
+static int nfs_read_reply(struct file_priv *priv, void *pkt, int len)
+{
+	struct rpc_reply rpc;
+	struct nfs_read *r = NULL;
+	uint32_t *p;
+	void *end = pkt + len;
+	uint32_t rlen;
+	int i;
+
+	/*
 	 * struct READ3resok {
 	 * 	post_op_attr file_attributes;
 	 * 	count3 count;
@@ -907,47 +1050,162 @@ static int nfs_read_req(struct file_priv *priv, uint64_t offset,
 	 * 	READ3resfail resfail;
 	 * };
 	 */
-	p = &(data[0]);
-	p = rpc_add_credentials(p);
+	if (len < sizeof(rpc) + 4)
+		return 0;
 
-	p = nfs_add_fh3(p, priv->filefh_len, priv->filefh);
-	p = nfs_add_uint64(p, offset);
-	p = nfs_add_uint32(p, readlen);
+	memcpy(&rpc, pkt, sizeof(rpc));
 
-	len = p - &(data[0]);
+	for (i = 0; i < priv->read_cnt; i++) {
+		if (nfs_read_slot(priv, i)->xid == ntoh32(rpc.id)) {
+			r = nfs_read_slot(priv, i);
+			break;
+		}
+	}
 
-	ret = rpc_req(priv->npriv, PROG_NFS, NFSPROC3_READ, data, len);
-	if (ret)
-		return ret;
+	if (!r)
+		return 0;
 
-	p = nfs_packet + sizeof(struct rpc_reply) + 4;
+	/* duplicate reply to a resent request */
+	if (r->state != READ_PENDING)
+		return 1;
 
-	p = nfs_read_post_op_attr(p, NULL);
+	r->state = READ_DONE;
 
-	rlen = ntoh32(net_read_uint32(p));
+	if (rpc.rstatus || rpc.verifier || rpc.astatus) {
+		r->err = -EIO;
+		return 1;
+	}
+
+	p = pkt + sizeof(rpc);
 
-	/* skip over count */
-	p += 1;
+	r->err = -ntoh32(net_read_uint32(p++));
+	if (r->err)
+		return 1;
 
-	eof = ntoh32(net_read_uint32(p));
+	p = nfs_read_post_op_attr(p, NULL);
 
 	/*
 	 * skip over eof and count embedded in the representation of data
-	 * assuming it equals rlen above.
+	 * assuming it equals count.
 	 */
-	p += 2;
+	if ((void *)(p + 3) > end)
+		goto err;
 
-	if (readlen && !rlen && !eof)
-		return -EIO;
+	rlen = ntoh32(net_read_uint32(p));
+	r->eof = ntoh32(net_read_uint32(p + 1));
+	p += 3;
+
+	if (rlen > r->count || (void *)p + rlen > end)
+		goto err;
+
+	memcpy(r->buf, p, rlen);
+	r->len = rlen;
+
+	return 1;
+err:
+	printf("%s: premature end of packet\n", __func__);
+	r->err = -EIO;
+
+	return 1;
+}
+
+/*
+ * nfs_read_fill - Send READ requests until the read-ahead window is full
+ */
+static int nfs_read_fill(struct file_priv *priv, loff_t size)
+{
+	struct nfs_priv *npriv = priv->npriv;
+	struct nfs_read *r;
+	int ret;
+
+	while (priv->read_cnt < NFS_READ_WINDOW && priv->read_next < size) {
+		r = nfs_read_slot(priv, priv->read_cnt);
+
+		r->xid = ++npriv->rpc_id;
+		r->offset = priv->read_next;
+		r->count = min_t(uint64_t, npriv->rsize, size - r->offset);
+		r->len = 0;
+		r->pos = 0;
+		r->tries = 0;
+		r->err = 0;
+		r->eof = 0;
+		r->state = READ_PENDING;
+
+		ret = nfs_read_send(priv, r);
+		if (ret)
+			return ret;
+
+		priv->read_cnt++;
+		priv->read_next += r->count;
+	}
+
+	return 0;
+}
+
+/*
+ * nfs_read_poll - Receive READ replies, resend timed out requests
+ */
+static int nfs_read_poll(struct file_priv *priv)
+{
+	struct nfs_read *r;
+	int i, ret;
+
+	if (ctrlc())
+		return -EINTR;
+
+	net_poll();
+
+	for (i = 0; i < priv->read_cnt; i++) {
+		r = nfs_read_slot(priv, i);
 
-	kfifo_put(priv->fifo, (char *)p, rlen);
+		if (r->state != READ_PENDING ||
+		    !is_timeout(r->sent, NFS_TIMEOUT))
+			continue;
+
+		if (++r->tries == NFS_MAX_RESEND)
+			return -ETIMEDOUT;
+
+		ret = nfs_read_send(priv, r);
+		if (ret)
+			return ret;
+	}
 
 	return 0;
 }
 
+/*
+ * nfs_read_reset - Drop the read-ahead, continue reading at pos
+ *
+ * Replies to dropped requests are ignored when they arrive later.
+ */
+static void nfs_read_reset(struct file_priv *priv, uint64_t pos)
+{
+	priv->read_head = 0;
+	priv->read_cnt = 0;
+	priv->read_pos = pos;
+	priv->read_next = pos;
+}
+
 static void nfs_handler(void *ctx, char *packet, unsigned len)
 {
+	struct nfs_priv *npriv = ctx;
 	char *pkt = net_eth_to_udp_payload(packet);
+	int udplen = net_eth_to_udplen(packet);
+	uint32_t xid;
+
+	if (npriv->reader && nfs_read_reply(npriv->reader, pkt, udplen))
+		return;
+
+	if (udplen < sizeof(xid))
+		return;
+
+	/*
+	 * Drop replies to other requests, e.g. to READ requests of a read-ahead
+	 * window which was given up, or to requests which were resent.
+	 */
+	memcpy(&xid, pkt, sizeof(xid));
+	if (ntoh32(xid) != npriv->rpc_id)
+		return;
 
 	nfs_state = STATE_DONE;
 	nfs_packet = pkt;
@@ -1032,9 +1290,11 @@ out:
 
 static void nfs_do_close(struct file_priv *priv)
 {
-	if (priv->fifo)
-		kfifo_free(priv->fifo);
+	if (priv->npriv->reader == priv)
+		priv->npriv->reader = NULL;
 
+	free(priv->reads);
+	free(priv->buf);
 	free(priv);
 }
 
@@ -1142,6 +1402,7 @@ static int nfs_open(struct device_d *dev, FILE *file, const char *filename)
 {
 	struct file_priv *priv;
 	struct stat s;
+	int i;
 
 	priv = nfs_do_stat(dev, filename, &s);
 	if (IS_ERR(priv))
@@ -1150,12 +1411,16 @@ static int nfs_open(struct device_d *dev, FILE *file, const char *filename)
 	file->priv = priv;
 	file->size = s.st_size;
 
-	priv->fifo = kfifo_alloc(1024);
-	if (!priv->fifo) {
-		free(priv);
+	priv->reads = xzalloc(NFS_READ_WINDOW * sizeof(*priv->reads));
+	priv->buf = malloc(NFS_READ_WINDOW * priv->npriv->rsize);
+	if (!priv->buf) {
+		nfs_do_close(priv);
 		return -ENOMEM;
 	}
 
+	for (i = 0; i < NFS_READ_WINDOW; i++)
+		priv->reads[i].buf = priv->buf + i * priv->npriv->rsize;
+
 	return 0;
 }
 
@@ -1174,28 +1439,86 @@ static int nfs_write(struct device_d *_dev, FILE *file, const void *inbuf,
 	return -ENOSYS;
 }
 
+/*
+ * Files are read sequentially with up to NFS_READ_WINDOW READ requests in
+ * flight. Their replies are matched by XID and may arrive in any order.
+ */
 static int nfs_read(struct device_d *dev, FILE *file, void *buf, size_t insize)
 {
 	struct file_priv *priv = file->priv;
+	struct nfs_read *r;
+	size_t outsize = 0, now;
+	int eof, ret;
+
+	/* lseek() or pread(), restart the read-ahead */
+	if (file->pos != priv->read_pos)
+		nfs_read_reset(priv, file->pos);
 
-	if (insize > 1024)
-		insize = 1024;
+	priv->npriv->reader = priv;
 
-	if (insize && !kfifo_len(priv->fifo)) {
-		int ret = nfs_read_req(priv, file->pos, insize);
+	while (insize) {
+		ret = nfs_read_fill(priv, file->size);
 		if (ret)
-			return ret;
+			goto err;
+
+		if (!priv->read_cnt)
+			break;
+
+		r = nfs_read_slot(priv, 0);
+		if (r->state != READ_DONE) {
+			if (outsize)
+				break;
+
+			ret = nfs_read_poll(priv);
+			if (ret)
+				goto err;
+			continue;
+		}
+
+		ret = r->err;
+		if (ret)
+			goto err;
+
+		now = min_t(size_t, insize, r->len - r->pos);
+		memcpy(buf, r->buf + r->pos, now);
+		r->pos += now;
+		buf += now;
+		insize -= now;
+		outsize += now;
+		priv->read_pos += now;
+
+		if (r->pos < r->len)
+			break;
+
+		if (r->len < r->count) {
+			eof = r->eof;
+
+			if (!r->len && !eof) {
+				ret = -EIO;
+				goto err;
+			}
+
+			/* Short read, request the remainder again */
+			nfs_read_reset(priv, priv->read_pos);
+			if (eof)
+				break;
+			continue;
+		}
+
+		priv->read_head = (priv->read_head + 1) % NFS_READ_WINDOW;
+		priv->read_cnt--;
 	}
 
-	return kfifo_get(priv->fifo, buf, insize);
+	return outsize;
+err:
+	nfs_read_reset(priv, priv->read_pos);
+
+	return ret;
 }
 
 static loff_t nfs_lseek(struct device_d *dev, FILE *file, loff_t pos)
 {
-	struct file_priv *priv = file->priv;
-
 	file->pos = pos;
-	kfifo_reset(priv->fifo);
 
 	return file->pos;
 }
@@ -1406,6 +1729,16 @@ static int nfs_probe(struct device_d *dev)
 		goto err2;
 	}
 
+	parseopt_hu(fsdev->options, "rsize", &npriv->rsize);
+	npriv->rsize = min_t(unsigned short, npriv->rsize, NFS_READ_SIZE_MAX);
+
+	ret = nfs_fsinfo_req(npriv);
+	if (ret)
+		debug("fsinfo failed with %d\n", ret);
+	if (!npriv->rsize)
+		npriv->rsize = NFS_READ_SIZE_FRAME;
+	debug("nfs rsize: %hu\n", npriv->rsize);
+
 	nfs_set_rootarg(npriv, fsdev);
 
 	free(tmp);
@@ -16,12 +16,12 @@ again:
 		return;
 
 	if (start > options && start[-1] != ',') {
-		options = start;
+		options = start + 1;
 		goto again;
 	}
 
 	if (start[optlen] != '=') {
-		options = start;
+		options = start + 1;
 		goto again;
 	}
 
@@ -38,6 +38,7 @@
 #include "squashfs_fs_i.h"
 #include "squashfs.h"
 #include "decompressor.h"
+#include "../parseopt.h"
 
 static struct dentry *d_make_root(struct inode *inode)
 {
@@ -108,6 +109,7 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 	unsigned short flags;
 	unsigned int fragments;
 	u64 lookup_table_start, next_table;
+	unsigned short data_cache, fragment_cache;
 	int err;
 
 	TRACE("Entered squashfs_fill_superblock\n");
@@ -221,6 +223,20 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 	sb->s_maxbytes = MAX_LFS_FILESIZE;
 	sb->s_flags |= MS_RDONLY;
 
+	/*
+	 * The number of data and fragment blocks kept decompressed can be
+	 * raised with the data_cache= and fragment_cache= mount options,
+	 * e.g. to avoid decompressing blocks again on non-sequential reads.
+	 */
+	data_cache = squashfs_max_decompressors();
+	fragment_cache = SQUASHFS_CACHED_FRAGMENTS;
+	parseopt_hu(fsdev->options, "data_cache", &data_cache);
+	parseopt_hu(fsdev->options, "fragment_cache", &fragment_cache);
+	data_cache = max_t(int, data_cache, squashfs_max_decompressors());
+	fragment_cache = max_t(int, fragment_cache, 1);
+	TRACE("Caching %d data and %d fragment blocks\n", data_cache,
+		fragment_cache);
+
 	err = -ENOMEM;
 
 	msblk->block_cache = squashfs_cache_init("metadata",
@@ -230,7 +246,7 @@ static int squashfs_fill_super(struct super_block *sb, void *data, int silent)
 
 	/* Allocate read_page block */
 	msblk->read_page = squashfs_cache_init("data",
-		squashfs_max_decompressors(), msblk->block_size);
+		data_cache, msblk->block_size);
 	if (msblk->read_page == NULL) {
 		ERROR("Failed to allocate read_page block\n");
 		goto failed_mount;
@@ -267,7 +283,7 @@ handle_fragments:
 	if (fragments == 0)
 		goto check_directory_table;
 	msblk->fragment_cache = squashfs_cache_init("fragment",
-		SQUASHFS_CACHED_FRAGMENTS, msblk->block_size);
+		fragment_cache, msblk->block_size);
 	if (msblk->fragment_cache == NULL) {
 		err = -ENOMEM;
 		goto failed_mount;
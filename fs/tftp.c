@@ -31,7 +31,10 @@
 #include <linux/stat.h>
 #include <linux/err.h>
 #include <kfifo.h>
+#include <globalvar.h>
+#include <magicvar.h>
 #include <linux/sizes.h>
+#include <linux/log2.h>
 
 #define TFTP_PORT	69	/* Well known TFTP port number */
 
@@ -64,6 +67,13 @@
 #define STATE_DONE	8
 
 #define TFTP_BLOCK_SIZE		512	/* default TFTP block size */
+#define TFTP_MIN_BLOCK_SIZE	8	/* RFC 2348 */
+/* Largest block fitting into an unfragmented Ethernet frame */
+#define TFTP_MAX_FRAME_BLOCK_SIZE	(1500 - 20 - 8 - 4)
+/* RFC 2348, received blocks may be fragmented if we can reassemble them */
+#define TFTP_MAX_BLOCK_SIZE	(IS_ENABLED(CONFIG_NET_IP_FRAGMENTS) ? \
+				 65464 : TFTP_MAX_FRAME_BLOCK_SIZE)
+#define TFTP_MAX_WINDOW_SIZE	128
 #define TFTP_FIFO_SIZE		4096
 
 #define TFTP_ERR_RESEND	1
@@ -79,12 +89,22 @@ struct file_priv {
 	int filesize;
 	uint64_t resend_timeout;
 	uint64_t progress_timeout;
-	struct kfifo *fifo;
+	struct kfifo *fifo;	/* write data */
+	struct list_head rx_queue;	/* received blocks, struct net_buf */
+	unsigned int rx_queued;	/* bytes in rx_queue */
+	unsigned int rx_size;	/* limit for rx_queued */
 	void *buf;
 	int blocksize;
+	int windowsize;
+	int window_cnt;		/* blocks received since the last ACK */
+	int window_gap;		/* a block was lost, ACK already forced */
 	int block_requested;
 };
 
+/* Block and window size requested from the server, see global.tftp.* */
+static int tftp_blksize = 1432;
+static int tftp_windowsize = 8;
+
 struct tftp_priv {
 	IPaddr_t server;
 };
@@ -114,6 +134,19 @@ static int tftp_truncate(struct device_d *dev, FILE *f, ulong size)
 	return 0;
 }
 
+static int tftp_get_blksize(int push)
+{
+	/* We do not fragment outgoing packets */
+	int max = push ? TFTP_MAX_FRAME_BLOCK_SIZE : TFTP_MAX_BLOCK_SIZE;
+
+	return clamp(tftp_blksize, TFTP_MIN_BLOCK_SIZE, max);
+}
+
+static int tftp_get_windowsize(void)
+{
+	return clamp(tftp_windowsize, 1, TFTP_MAX_WINDOW_SIZE);
+}
+
 static int tftp_send(struct file_priv *priv)
 {
 	unsigned char *xp;
@@ -142,27 +175,51 @@ static int tftp_send(struct file_priv *priv)
 				"tsize%c"
 				"%d%c"
 				"blksize%c"
-				"1432",
+				"%d",
 				priv->filename, 0,
 				0,
 				0,
 				TIMEOUT, 0,
 				0,
 				priv->filesize, 0,
-				0);
+				0,
+				tftp_get_blksize(priv->push));
 		pkt++;
+		if (priv->state == STATE_RRQ && tftp_get_windowsize() > 1) {
+			/* RFC 7440 */
+			pkt += sprintf((unsigned char *)pkt, "windowsize%c%d",
+					0, tftp_get_windowsize());
+			pkt++;
+		}
 		len = pkt - xp;
 		break;
 
 	case STATE_RDATA:
-		if (priv->block == priv->block_requested)
+		/* Nothing new to acknowledge */
+		if (priv->last_block == priv->block_requested)
+			return 0;
+		/*
+		 * Only acknowledge complete windows, unless the ACK is
+		 * forced because of a timeout or a lost block.
+		 */
+		if (priv->block_requested >= 0 &&
+		    priv->window_cnt < priv->windowsize)
+			return 0;
+		/* The ACK requests the next window, so it has to fit */
+		if (priv->rx_size - priv->rx_queued <
+		    priv->windowsize * priv->blocksize)
 			return 0;
+		/* fall through */
+	case STATE_LAST:
+		priv->block = priv->last_block;
+		/* fall through */
 	case STATE_OACK:
 		xp = pkt;
 		s = (uint16_t *)pkt;
 		*s++ = htons(TFTP_ACK);
 		*s++ = htons(priv->block);
 		priv->block_requested = priv->block;
+		priv->window_cnt = 0;
 		pkt = (unsigned char *)s;
 		len = pkt - xp;
 		break;
@@ -242,6 +299,9 @@ static void tftp_parse_oack(struct file_priv *priv, unsigned char *pkt, int len)
 			priv->filesize = simple_strtoul(val, NULL, 10);
 		if (!strcmp(opt, "blksize"))
 			priv->blocksize = simple_strtoul(val, NULL, 10);
+		if (!strcmp(opt, "windowsize"))
+			priv->windowsize = clamp_t(int, simple_strtoul(val, NULL, 10),
+					1, tftp_get_windowsize());
 		debug("OACK opt: %s val: %s\n", opt, val);
 		s = val + strlen(val) + 1;
 	}
@@ -318,11 +378,17 @@ static void tftp_recv(struct file_priv *priv,
 
 		if (priv->state == STATE_RRQ || priv->state == STATE_OACK) {
 			/* first block received */
+			int oack = priv->state == STATE_OACK;
+
 			priv->state = STATE_RDATA;
 			priv->tftp_con->udp->uh_dport = uh_sport;
 			priv->last_block = 0;
 
-			if (priv->block != 1) {	/* Assertion */
+			/*
+			 * Without options there is no window, so the first
+			 * block cannot have been overtaken by another one.
+			 */
+			if (!oack && priv->block != 1) {	/* Assertion */
 				printf("error: First block is not block 1 (%d)\n",
 					priv->block);
 				priv->err = -EINVAL;
@@ -335,13 +401,42 @@ static void tftp_recv(struct file_priv *priv,
 			/* Same block again; ignore it. */
 			break;
 
+		if (priv->block != (uint16_t)(priv->last_block + 1)) {
+			/*
+			 * A block of the window was lost or reordered. Drop
+			 * the following ones and acknowledge the last block
+			 * received in order once, so that the server resends
+			 * the window from there (RFC 7440).
+			 */
+			debug("tftp: got block %d, expected %d\n", priv->block,
+				(uint16_t)(priv->last_block + 1));
+			if (!priv->window_gap) {
+				priv->window_gap = 1;
+				priv->block_requested = -1;
+			}
+			break;
+		}
+
 		priv->last_block = priv->block;
+		priv->window_cnt++;
+		priv->window_gap = 0;
 
 		tftp_timer_reset(priv);
 
-		kfifo_put(priv->fifo, pkt + 2, len);
+		/*
+		 * Keep the receive buffer instead of copying the data, it is
+		 * copied only once into the buffer passed to tftp_read().
+		 */
+		if (len) {
+			struct net_buf *nb = net_rx_buf_get(pkt + 2, len);
+
+			list_add_tail(&nb->list, &priv->rx_queue);
+			priv->rx_queued += len;
+		}
 
 		if (len < priv->blocksize) {
+			/* Acknowledge the last block, no window follows */
+			priv->state = STATE_LAST;
 			tftp_send(priv);
 			priv->err = 0;
 			priv->state = STATE_DONE;
@@ -378,6 +473,46 @@ static void tftp_handler(void *ctx, char *packet, unsigned len)
 	tftp_recv(priv, pkt, net_eth_to_udplen(packet), udp->uh_sport);
 }
 
+static void tftp_rx_flush(struct file_priv *priv)
+{
+	struct net_buf *nb, *tmp;
+
+	list_for_each_entry_safe(nb, tmp, &priv->rx_queue, list) {
+		list_del(&nb->list);
+		net_buf_put(nb);
+	}
+
+	priv->rx_queued = 0;
+}
+
+/* Copy received data to buf, return the number of bytes copied */
+static size_t tftp_rx_get(struct file_priv *priv, void *buf, size_t size)
+{
+	struct net_buf *nb, *tmp;
+	size_t now, copied = 0;
+
+	list_for_each_entry_safe(nb, tmp, &priv->rx_queue, list) {
+		if (!size)
+			break;
+
+		now = min_t(size_t, size, net_buf_len(nb));
+		memcpy(buf, net_buf_payload(nb), now);
+		nb->head += now;
+		buf += now;
+		size -= now;
+		copied += now;
+
+		if (!net_buf_len(nb)) {
+			list_del(&nb->list);
+			net_buf_put(nb);
+		}
+	}
+
+	priv->rx_queued -= copied;
+
+	return copied;
+}
+
 static struct file_priv *tftp_do_open(struct device_d *dev,
 		int accmode, const char *filename)
 {
@@ -415,12 +550,23 @@ static struct file_priv *tftp_do_open(struct device_d *dev,
 	priv->err = -EINVAL;
 	priv->filename = filename;
 	priv->blocksize = TFTP_BLOCK_SIZE;
+	priv->windowsize = 1;
 	priv->block_requested = -1;
-
-	priv->fifo = kfifo_alloc(TFTP_FIFO_SIZE);
-	if (!priv->fifo) {
-		ret = -ENOMEM;
-		goto out;
+	INIT_LIST_HEAD(&priv->rx_queue);
+
+	/*
+	 * The server may only lower the requested sizes. Leave room for two
+	 * windows so that one can be received while the other is consumed.
+	 */
+	priv->rx_size = roundup_pow_of_two(max(TFTP_FIFO_SIZE,
+			2 * tftp_get_windowsize() * tftp_get_blksize(priv->push)));
+
+	if (priv->push) {
+		priv->fifo = kfifo_alloc(priv->rx_size);
+		if (!priv->fifo) {
+			ret = -ENOMEM;
+			goto out;
+		}
 	}
 
 	priv->tftp_con = net_udp_new(tpriv->server, TFTP_PORT, tftp_handler,
@@ -456,7 +602,9 @@ static struct file_priv *tftp_do_open(struct device_d *dev,
 out2:
 	net_unregister(priv->tftp_con);
 out1:
-	kfifo_free(priv->fifo);
+	tftp_rx_flush(priv);
+	if (priv->fifo)
+		kfifo_free(priv->fifo);
 out:
 	free(priv);
 
@@ -508,7 +656,9 @@ static int tftp_do_close(struct file_priv *priv)
 	}
 
 	net_unregister(priv->tftp_con);
-	kfifo_free(priv->fifo);
+	tftp_rx_flush(priv);
+	if (priv->fifo)
+		kfifo_free(priv->fifo);
 	free(priv->buf);
 	free(priv);
 
@@ -567,7 +717,7 @@ static int tftp_read(struct device_d *dev, FILE *f, void *buf, size_t insize)
 	debug("%s %zu\n", __func__, insize);
 
 	while (insize) {
-		now = kfifo_get(priv->fifo, buf, insize);
+		now = tftp_rx_get(priv, buf, insize);
 		if (priv->state == STATE_DONE)
 			return outsize + now;
 		if (now) {
@@ -576,8 +726,7 @@ static int tftp_read(struct device_d *dev, FILE *f, void *buf, size_t insize)
 			insize -= now;
 		}
 
-		if (TFTP_FIFO_SIZE - kfifo_len(priv->fifo) >= priv->blocksize)
-			tftp_send(priv);
+		tftp_send(priv);
 
 		ret = tftp_poll(priv);
 		if (ret == TFTP_ERR_RESEND)
@@ -662,6 +811,14 @@ static struct fs_driver_d tftp_driver = {
 
 static int tftp_init(void)
 {
+	globalvar_add_simple_int("tftp.blksize", &tftp_blksize, "%d");
+	globalvar_add_simple_int("tftp.windowsize", &tftp_windowsize, "%d");
+
 	return register_fs_driver(&tftp_driver);
 }
 coredevice_initcall(tftp_init);
+
+BAREBOX_MAGICVAR_NAMED(global_tftp_blksize, global.tftp.blksize,
+		"TFTP block size to request (8..1468, up to 65464 for reads with IP fragment reassembly)");
+BAREBOX_MAGICVAR_NAMED(global_tftp_windowsize, global.tftp.windowsize,
+		"Number of TFTP blocks to receive per ACK (RFC 7440, 1..128)");
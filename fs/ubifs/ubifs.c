@@ -17,6 +17,8 @@
 #include <fs.h>
 #include <linux/stat.h>
 #include <linux/zlib.h>
+#define ZSTD_STATIC_LINKING_ONLY
+#include <linux/zstd.h>
 #include <linux/mtd/mtd.h>
 
 #include "ubifs.h"
@@ -46,6 +48,35 @@ static int gzip_decompress(const unsigned char *in, size_t in_len,
 }
 #endif
 
+#if defined(CONFIG_ZSTD_DECOMPRESS)
+static ZSTD_DCtx *ubifs_zstd_dctx;
+
+static int zstd_decompress(const unsigned char *in, size_t in_len,
+			   unsigned char *out, size_t *out_len)
+{
+	size_t ret;
+
+	if (!ubifs_zstd_dctx) {
+		size_t wksp_size = ZSTD_estimateDCtxSize();
+		void *wksp = malloc(wksp_size);
+
+		ubifs_zstd_dctx = ZSTD_initStaticDCtx(wksp, wksp_size);
+		if (!ubifs_zstd_dctx) {
+			free(wksp);
+			return -ENOMEM;
+		}
+	}
+
+	ret = ZSTD_decompressDCtx(ubifs_zstd_dctx, out, *out_len, in, in_len);
+	if (ZSTD_isError(ret))
+		return -EINVAL;
+
+	*out_len = ret;
+
+	return 0;
+}
+#endif
+
 /* Fake description object for the "none" compressor */
 static struct ubifs_compressor none_compr = {
 	.compr_type = UBIFS_COMPR_NONE,
@@ -79,6 +110,15 @@ static struct ubifs_compressor zlib_compr = {
 #endif
 };
 
+static struct ubifs_compressor zstd_compr = {
+	.compr_type = UBIFS_COMPR_ZSTD,
+	.name = "zstd",
+#ifdef CONFIG_ZSTD_DECOMPRESS
+	.capi_name = "zstd",
+	.decompress = zstd_decompress,
+#endif
+};
+
 /* All UBIFS compressors */
 struct ubifs_compressor *ubifs_compressors[UBIFS_COMPR_TYPES_CNT];
 
@@ -262,6 +302,10 @@ int __init ubifs_compressors_init(void)
 	if (err)
 		return err;
 
+	err = compr_init(&zstd_compr);
+	if (err)
+		return err;
+
 	err = compr_init(&none_compr);
 	if (err)
 		return err;
@@ -695,28 +739,13 @@ out:
 
 /* file.c */
 
-static inline void *kmap(struct page *page)
+static int decompress_data_node(struct ubifs_info *c, struct inode *inode,
+				void *addr, unsigned int block,
+				struct ubifs_data_node *dn)
 {
-	return page->addr;
-}
-
-static int read_block(struct inode *inode, void *addr, unsigned int block,
-		      struct ubifs_data_node *dn)
-{
-	struct ubifs_info *c = inode->i_sb->s_fs_info;
 	int err, len, out_len;
-	union ubifs_key key;
 	unsigned int dlen;
 
-	data_key_init(c, &key, inode->i_ino, block);
-	err = ubifs_tnc_lookup(c, &key, dn);
-	if (err) {
-		if (err == -ENOENT)
-			/* Not found, so it must be a hole */
-			memset(addr, 0, UBIFS_BLOCK_SIZE);
-		return err;
-	}
-
 	ubifs_assert(le64_to_cpu(dn->ch.sqnum) > ubifs_inode(inode)->creat_sqnum);
 
 	len = le32_to_cpu(dn->size);
@@ -747,228 +776,6 @@ dump:
 	return -EINVAL;
 }
 
-#ifndef __BAREBOX__
-static int do_readpage(struct ubifs_info *c, struct inode *inode,
-		       struct page *page, int last_block_size)
-{
-	void *addr;
-	int err = 0, i;
-	unsigned int block, beyond;
-	struct ubifs_data_node *dn;
-	loff_t i_size = inode->i_size;
-
-	dbg_gen("ino %lu, pg %lu, i_size %lld",
-		inode->i_ino, page->index, i_size);
-
-	addr = kmap(page);
-
-	block = page->index << UBIFS_BLOCKS_PER_PAGE_SHIFT;
-	beyond = (i_size + UBIFS_BLOCK_SIZE - 1) >> UBIFS_BLOCK_SHIFT;
-	if (block >= beyond) {
-		/* Reading beyond inode */
-		memset(addr, 0, PAGE_CACHE_SIZE);
-		goto out;
-	}
-
-	dn = kmalloc(UBIFS_MAX_DATA_NODE_SZ, GFP_NOFS);
-	if (!dn)
-		return -ENOMEM;
-
-	i = 0;
-	while (1) {
-		int ret;
-
-		if (block >= beyond) {
-			/* Reading beyond inode */
-			err = -ENOENT;
-			memset(addr, 0, UBIFS_BLOCK_SIZE);
-		} else {
-			/*
-			 * Reading last block? Make sure to not write beyond
-			 * the requested size in the destination buffer.
-			 */
-			if (((block + 1) == beyond) || last_block_size) {
-				void *buff;
-				int dlen;
-
-				/*
-				 * We need to buffer the data locally for the
-				 * last block. This is to not pad the
-				 * destination area to a multiple of
-				 * UBIFS_BLOCK_SIZE.
-				 */
-				buff = kzalloc(UBIFS_BLOCK_SIZE, 0);
-				if (!buff) {
-					printf("%s: Error, malloc fails!\n",
-					       __func__);
-					err = -ENOMEM;
-					break;
-				}
-
-				/* Read block-size into temp buffer */
-				ret = read_block(inode, buff, block, dn);
-				if (ret) {
-					err = ret;
-					if (err != -ENOENT) {
-						free(buff);
-						break;
-					}
-				}
-
-				if (last_block_size)
-					dlen = last_block_size;
-				else
-					dlen = le32_to_cpu(dn->size);
-
-				/* Now copy required size back to dest */
-				memcpy(addr, buff, dlen);
-
-				free(buff);
-			} else {
-				ret = read_block(inode, addr, block, dn);
-				if (ret) {
-					err = ret;
-					if (err != -ENOENT)
-						break;
-				}
-			}
-		}
-		if (++i >= UBIFS_BLOCKS_PER_PAGE)
-			break;
-		block += 1;
-		addr += UBIFS_BLOCK_SIZE;
-	}
-	if (err) {
-		if (err == -ENOENT) {
-			/* Not found, so it must be a hole */
-			dbg_gen("hole");
-			goto out_free;
-		}
-		ubifs_err(c, "cannot read page %lu of inode %lu, error %d",
-			  page->index, inode->i_ino, err);
-		goto error;
-	}
-
-out_free:
-	kfree(dn);
-out:
-	return 0;
-
-error:
-	kfree(dn);
-	return err;
-}
-
-int ubifs_read(const char *filename, void *buf, loff_t offset,
-	       loff_t size, loff_t *actread)
-{
-	struct ubifs_info *c = ubifs_sb->s_fs_info;
-	unsigned long inum;
-	struct inode *inode;
-	struct page page;
-	int err = 0;
-	int i;
-	int count;
-	int last_block_size = 0;
-
-	*actread = 0;
-
-	if (offset & (PAGE_SIZE - 1)) {
-		printf("ubifs: Error offset must be a multple of %d\n",
-		       PAGE_SIZE);
-		return -1;
-	}
-
-	c->ubi = ubi_open_volume(c->vi.ubi_num, c->vi.vol_id, UBI_READONLY);
-	/* ubifs_findfile will resolve symlinks, so we know that we get
-	 * the real file here */
-	inum = ubifs_findfile(ubifs_sb, (char *)filename);
-	if (!inum) {
-		err = -1;
-		goto out;
-	}
-
-	/*
-	 * Read file inode
-	 */
-	inode = ubifs_iget(ubifs_sb, inum);
-	if (IS_ERR(inode)) {
-		printf("%s: Error reading inode %ld!\n", __func__, inum);
-		err = PTR_ERR(inode);
-		goto out;
-	}
-
-	if (offset > inode->i_size) {
-		printf("ubifs: Error offset (%lld) > file-size (%lld)\n",
-		       offset, size);
-		err = -1;
-		goto put_inode;
-	}
-
-	/*
-	 * If no size was specified or if size bigger than filesize
-	 * set size to filesize
-	 */
-	if ((size == 0) || (size > (inode->i_size - offset)))
-		size = inode->i_size - offset;
-
-	count = (size + UBIFS_BLOCK_SIZE - 1) >> UBIFS_BLOCK_SHIFT;
-
-	page.addr = buf;
-	page.index = offset / PAGE_SIZE;
-	page.inode = inode;
-	for (i = 0; i < count; i++) {
-		/*
-		 * Make sure to not read beyond the requested size
-		 */
-		if (((i + 1) == count) && (size < inode->i_size))
-			last_block_size = size - (i * PAGE_SIZE);
-
-		err = do_readpage(c, inode, &page, last_block_size);
-		if (err)
-			break;
-
-		page.addr += PAGE_SIZE;
-		page.index++;
-	}
-
-	if (err) {
-		printf("Error reading file '%s'\n", filename);
-		*actread = i * PAGE_SIZE;
-	} else {
-		*actread = size;
-	}
-
-put_inode:
-	ubifs_iput(inode);
-
-out:
-	ubi_close_volume(c->ubi);
-	return err;
-}
-
-void ubifs_close(void)
-{
-}
-
-/* Compat wrappers for common/cmd_ubifs.c */
-int ubifs_load(char *filename, u32 addr, u32 size)
-{
-	loff_t actread;
-	int err;
-
-	printf("Loading file '%s' to addr 0x%08x...\n", filename, addr);
-
-	err = ubifs_read(filename, (void *)addr, 0, size, &actread);
-	if (err == 0) {
-		setenv_hex("filesize", actread);
-		printf("Done\n");
-	}
-
-	return err;
-}
-#endif
-
 void uboot_ubifs_umount(void)
 {
 	if (ubifs_sb) {
@@ -986,12 +793,14 @@ struct ubifs_file {
 	struct inode *inode;
 	void *buf;
 	unsigned int block;
-	struct ubifs_data_node *dn;
+	struct bu_info *bu;	/* data nodes of the last bulk-read */
+	unsigned int bu_block;	/* first block covered by @bu */
 };
 
 static int ubifs_open(struct device_d *dev, FILE *file, const char *filename)
 {
 	struct ubifs_priv *priv = dev->priv;
+	struct ubifs_info *c = priv->sb->s_fs_info;
 	struct inode *inode;
 	struct ubifs_file *uf;
 	unsigned long inum;
@@ -1008,8 +817,9 @@ static int ubifs_open(struct device_d *dev, FILE *file, const char *filename)
 
 	uf->inode = inode;
 	uf->buf = xmalloc(UBIFS_BLOCK_SIZE);
-	uf->dn = xzalloc(UBIFS_MAX_DATA_NODE_SZ);
 	uf->block = -1;
+	uf->bu = xzalloc(sizeof(*uf->bu));
+	uf->bu->buf = xmalloc(c->max_bu_buf_len);
 
 	file->size = inode->i_size;
 	file->priv = uf;
@@ -1025,20 +835,64 @@ static int ubifs_close(struct device_d *dev, FILE *f)
 	ubifs_iput(inode);
 
 	free(uf->buf);
-	free(uf->dn);
+	free(uf->bu->buf);
+	free(uf->bu);
 	free(uf);
 
 	return 0;
 }
 
+/*
+ * Read a block through the per-file bulk-read cache. Consecutive data nodes
+ * of the file which are stored back to back in the same LEB are looked up in
+ * the TNC in one go and read with a single UBI read. Subsequent blocks are
+ * then decompressed from the cached nodes until the range is exhausted.
+ */
+static int ubifs_read_block_bu(struct ubifs_file *uf, unsigned int block,
+			       void *addr)
+{
+	struct inode *inode = uf->inode;
+	struct ubifs_info *c = inode->i_sb->s_fs_info;
+	struct bu_info *bu = uf->bu;
+	void *node;
+	int i, ret;
+
+	if (block < uf->bu_block || block >= uf->bu_block + bu->blk_cnt) {
+		data_key_init(c, &bu->key, inode->i_ino, block);
+		bu->buf_len = c->max_bu_buf_len;
+
+		ret = ubifs_tnc_get_bu_keys(c, bu);
+		if (!ret && bu->cnt)
+			ret = ubifs_tnc_bulk_read(c, bu);
+		if (ret) {
+			bu->blk_cnt = 0;
+			return ret;
+		}
+
+		uf->bu_block = block;
+	}
+
+	node = bu->buf;
+	for (i = 0; i < bu->cnt; i++) {
+		if (key_block(c, &bu->zbranch[i].key) == block)
+			return decompress_data_node(c, inode, addr, block, node);
+		node += ALIGN(bu->zbranch[i].len, 8);
+	}
+
+	/* No data node for this block, so it must be a hole */
+	memset(addr, 0, UBIFS_BLOCK_SIZE);
+
+	return 0;
+}
+
 static int ubifs_get_block(struct ubifs_file *uf, unsigned int pos)
 {
 	int ret;
 	unsigned int block = pos / UBIFS_BLOCK_SIZE;
 
 	if (block != uf->block) {
-		ret = read_block(uf->inode, uf->buf, block, uf->dn);
-		if (ret && ret != -ENOENT)
+		ret = ubifs_read_block_bu(uf, block, uf->buf);
+		if (ret)
 			return ret;
 		uf->block = block;
 	}
@@ -1070,13 +924,12 @@ static int ubifs_read(struct device_d *_dev, FILE *f, void *buf, size_t insize)
 		buf += now;
 	}
 
-	/* Do full blocks */
+	/* Do full blocks, decompressing them directly into the buffer */
 	while (size >= UBIFS_BLOCK_SIZE) {
-		ret = ubifs_get_block(uf, pos);
+		ret = ubifs_read_block_bu(uf, pos / UBIFS_BLOCK_SIZE, buf);
 		if (ret)
 			return ret;
 
-		memcpy(buf, uf->buf, UBIFS_BLOCK_SIZE);
 		size -= UBIFS_BLOCK_SIZE;
 		pos += UBIFS_BLOCK_SIZE;
 		buf += UBIFS_BLOCK_SIZE;
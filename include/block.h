@@ -22,6 +22,24 @@ struct block_device {
 	int num_blocks;
 	int rdbufsize;
 	int blkmask;
+	int chunkbits;
+
+	/* chunk cache, tunable through device parameters */
+	int chunk_size;
+	int cache_chunks;
+	int readahead;
+	void *cache;
+	struct chunk *chunks;
+	struct hlist_head *chunk_hash;
+	int chunk_hash_mask;
+	int ra_slot;
+	int ra_next;
+
+	/* blocks found and not found in the cache, chunks read ahead */
+	int cache_hits;
+	int cache_misses;
+	int cache_prefetched;
+	struct param_d *params[6];
 
 	struct list_head buffered_blocks;
 	struct list_head idle_blocks;
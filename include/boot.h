@@ -43,6 +43,9 @@ struct image_data {
 	/* otherwise only the filename will be provided */
 	char *os_file;
 
+	/* the compression of os_file, filetype_unknown if it is not compressed */
+	enum filetype os_compression;
+
 	/*
 	 * The address the user wants to load the os image to.
 	 * May be UIMAGE_INVALID_ADDRESS to indicate that the
@@ -87,6 +90,8 @@ struct image_handler {
 	int ih_os;
 
 	enum filetype filetype;
+	/* set if the handler loads the OS with bootm_load_os() */
+	int compressed;
 	int (*bootm)(struct image_data *data);
 };
 
@@ -12,6 +12,8 @@
 
 #define DHCP_DEFAULT_RETRY 20
 
+struct eth_device;
+
 struct dhcp_req_param {
 	char *hostname;
 	char *vendor_id;
@@ -20,6 +22,6 @@ struct dhcp_req_param {
 	char *client_uuid;
 };
 
-int dhcp(int retries, struct dhcp_req_param *param);
+int dhcp(struct eth_device *edev, int retries, struct dhcp_req_param *param);
 
 #endif
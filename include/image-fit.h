@@ -21,25 +21,34 @@
 #include <linux/types.h>
 #include <boot.h>
 
+struct fit_image {
+	struct device_node *node;
+	/* NULL if the data is read from the file by fit_load_image() */
+	const void *data;
+	loff_t pos;		/* position of the data in the file */
+	unsigned long size;
+};
+
 struct fit_handle {
-	void *fit;
+	void *fit;		/* the FDT, without the data of large images */
 	size_t size;
+	int fd;			/* the FIT file, -1 if it was read completely */
+	loff_t data_base;	/* start of external data behind the FDT */
 
 	bool verbose;
 	enum bootm_verify verify;
 
 	struct device_node *root;
 
-	const void *kernel;
-	unsigned long kernel_size;
-	const void *oftree;
-	unsigned long oftree_size;
-	const void *initrd;
-	unsigned long initrd_size;
+	struct fit_image kernel;
+	struct fit_image oftree;
+	struct fit_image initrd;
+	void *oftree_buf;
 };
 
 struct fit_handle *fit_open(const char *filename, const char *config, bool verbose,
 			    enum bootm_verify verify);
+int fit_load_image(struct fit_handle *handle, struct fit_image *img, void *dest);
 void fit_close(struct fit_handle *handle);
 
 #endif	/* __IMAGE_FIT_H__ */
@@ -236,6 +236,8 @@ struct resource *uimage_load_to_sdram(struct uimage_handle *handle,
 void *uimage_load_to_buf(struct uimage_handle *handle, int image_no,
 		size_t *size);
 struct resource *file_to_sdram(const char *filename, unsigned long adr);
+struct resource *file_uncompress_to_sdram(const char *filename,
+		unsigned long adr);
 #define MAX_MULTI_IMAGE_COUNT 16
 
 struct uimage_handle {
@@ -245,6 +247,7 @@ struct uimage_handle {
 	int nb_data_entries;
 	size_t data_offset;
 	int fd;
+	int verify;	/* check the data crc in uimage_load() */
 };
 
 #define UIMAGE_INVALID_ADDRESS	(~0)
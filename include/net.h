@@ -61,8 +61,22 @@ struct eth_device {
 	IPaddr_t netmask;
 	IPaddr_t gateway;
 	char ethaddr[6];
+
+	unsigned int features;
+
+	uint64_t last_link_check;
+
+	/* statistics, drivers account dropped frames and ring overruns */
+	int rx_packets;
+	int rx_dropped;
+	int rx_overruns;
 };
 
+/* The MAC drops frames with bad IP header and UDP/TCP checksums */
+#define ETH_FEATURE_RX_CSUM	(1 << 0)
+/* The MAC inserts the UDP/TCP checksum of outgoing frames */
+#define ETH_FEATURE_TX_CSUM	(1 << 1)
+
 #define dev_to_edev(d) container_of(d, struct eth_device, dev)
 
 int eth_register(struct eth_device* dev);    /* Register network device		*/
@@ -70,6 +84,10 @@ void eth_unregister(struct eth_device* dev); /* Unregister network device	*/
 int eth_set_ethaddr(struct eth_device *edev, const char *ethaddr);
 
 int eth_send(struct eth_device *edev, void *packet, int length);	   /* Send a packet		*/
+
+extern struct list_head netdev_list;
+
+#define for_each_netdev(edev) list_for_each_entry(edev, &netdev_list, list)
 int eth_rx(void);			/* Check for received packets	*/
 
 /* associate a MAC address to a ethernet device. Should be called by
@@ -105,6 +123,7 @@ struct ethernet {
 #define PROT_VLAN	0x8100		/* IEEE 802.1q protocol		*/
 
 #define IPPROTO_ICMP	 1	/* Internet Control Message Protocol	*/
+#define IPPROTO_TCP	 6	/* Transmission Control Protocol	*/
 #define IPPROTO_UDP	17	/* User Datagram Protocol		*/
 
 /*
@@ -124,6 +143,10 @@ struct iphdr {
 	/* The options start here. */
 } __attribute__ ((packed));
 
+#define IP_DF		0x4000		/* Don't fragment		*/
+#define IP_MF		0x2000		/* More fragments		*/
+#define IP_OFFSET	0x1fff		/* Fragment offset in 8 byte units */
+
 struct udphdr {
 	uint16_t	uh_sport;	/* source port */
 	uint16_t	uh_dport;	/* destination port */
@@ -131,6 +154,24 @@ struct udphdr {
 	uint16_t	uh_sum;		/* udp checksum */
 } __attribute__ ((packed));
 
+struct tcphdr {
+	uint16_t	th_sport;	/* source port */
+	uint16_t	th_dport;	/* destination port */
+	uint32_t	th_seq;		/* sequence number */
+	uint32_t	th_ack;		/* acknowledgement number */
+	uint8_t		th_off;		/* data offset in the upper 4 bits */
+	uint8_t		th_flags;
+	uint16_t	th_win;		/* receive window */
+	uint16_t	th_sum;		/* tcp checksum */
+	uint16_t	th_urp;		/* urgent pointer */
+} __attribute__ ((packed));
+
+#define TCP_FIN		0x01
+#define TCP_SYN		0x02
+#define TCP_RST		0x04
+#define TCP_PSH		0x08
+#define TCP_ACK		0x10
+
 /*
  *	Address Resolution Protocol (ARP) header.
  */
@@ -227,6 +268,11 @@ static inline struct udphdr *net_eth_to_udphdr(char *pkt)
 	return (struct udphdr *)(net_eth_to_iphdr(pkt) + 1);
 }
 
+static inline struct tcphdr *net_eth_to_tcphdr(char *pkt)
+{
+	return (struct tcphdr *)(net_eth_to_iphdr(pkt) + 1);
+}
+
 static inline struct icmphdr *net_eth_to_icmphdr(char *pkt)
 {
 	return (struct icmphdr *)(net_eth_to_iphdr(pkt) + 1);
@@ -248,6 +294,15 @@ static inline int net_eth_to_udplen(char *pkt)
 	return ntohs(udp->uh_ulen) - 8;
 }
 
+#ifdef CONFIG_NET_IP_FRAGMENTS
+unsigned char *net_ip_defrag(unsigned char *pkt, int *len);
+#else
+static inline unsigned char *net_ip_defrag(unsigned char *pkt, int *len)
+{
+	return NULL;
+}
+#endif
+
 int net_checksum_ok(unsigned char *, int);	/* Return true if cksum OK	*/
 uint16_t net_checksum(unsigned char *, int);	/* Calculate the checksum	*/
 
@@ -418,10 +473,64 @@ struct eth_device *eth_get_byname(const char *name);
  */
 int net_receive(struct eth_device *edev, unsigned char *pkt, int len);
 
+/*
+ * A reference counted receive buffer. Drivers which can give up a receive
+ * buffer pass it to the stack with net_receive_buf() instead of copying the
+ * packet. Protocol handlers which want to keep the payload beyond their
+ * rx_handler take a reference with net_rx_buf_get(), the payload is then
+ * found between head and tail. When the last reference is dropped, ->release
+ * is called to hand the buffer back to its owner.
+ */
+struct net_buf {
+	unsigned char *data;
+	unsigned int head;		/* payload offset in data */
+	unsigned int tail;		/* payload end in data */
+	int refcount;
+	void (*release)(struct net_buf *nb);
+	void *priv;			/* for use by the owner */
+	struct list_head list;		/* for use by the current holder */
+};
+
+static inline void *net_buf_payload(struct net_buf *nb)
+{
+	return nb->data + nb->head;
+}
+
+static inline unsigned int net_buf_len(struct net_buf *nb)
+{
+	return nb->tail - nb->head;
+}
+
+/* true if the stack still holds a reference besides the caller's one */
+static inline int net_buf_shared(struct net_buf *nb)
+{
+	return nb->refcount > 1;
+}
+
+struct net_buf *net_buf_alloc(unsigned int size);
+struct net_buf *net_buf_get(struct net_buf *nb);
+void net_buf_put(struct net_buf *nb);
+
+/**
+ * net_receive_buf - Pass a received buffer from an ethernet driver to the protocol stack
+ * @edev: The device the packet was received on
+ * @nb: The buffer holding the packet between head and tail
+ *
+ * The driver keeps its reference. If net_buf_shared() is true afterwards,
+ * a protocol handler holds on to the buffer and the driver must drop its
+ * reference and use another buffer for the next packet.
+ *
+ * Return 0 if the packet is successfully handled. Can be ignored
+ */
+int net_receive_buf(struct eth_device *edev, struct net_buf *nb);
+
+struct net_buf *net_rx_buf_get(void *data, unsigned int len);
+
 struct net_connection {
 	struct ethernet *et;
 	struct iphdr *ip;
 	struct udphdr *udp;
+	struct tcphdr *tcp;
 	struct eth_device *edev;
 	struct icmphdr *icmp;
 	unsigned char *packet;
@@ -438,6 +547,9 @@ static inline char *net_alloc_packet(void)
 
 struct net_connection *net_udp_new(IPaddr_t dest, uint16_t dport,
 		rx_handler_f *handler, void *ctx);
+/* Like net_udp_new(), but use edev instead of the routing table */
+struct net_connection *net_udp_eth_new(struct eth_device *edev, IPaddr_t dest,
+		uint16_t dport, rx_handler_f *handler, void *ctx);
 
 struct net_connection *net_icmp_new(IPaddr_t dest, rx_handler_f *handler,
 		void *ctx);
@@ -459,6 +571,29 @@ static inline void *net_udp_get_payload(struct net_connection *con)
 int net_udp_send(struct net_connection *con, int len);
 int net_icmp_send(struct net_connection *con, int len);
 
+int arp_cache_lookup(struct eth_device *edev, IPaddr_t ip, u8 *ethaddr);
+void arp_cache_update(struct eth_device *edev, IPaddr_t ip, const u8 *ethaddr);
+void arp_cache_flush(struct eth_device *edev);
+
+struct eth_device *net_route(IPaddr_t dest, IPaddr_t *nexthop);
+int net_route_add(IPaddr_t net, IPaddr_t netmask, IPaddr_t gateway,
+		struct eth_device *edev);
+int net_route_del(IPaddr_t net, IPaddr_t netmask);
+void net_route_flush(struct eth_device *edev);
+
+struct net_connection *net_tcp_new(IPaddr_t dest, uint16_t dport,
+		rx_handler_f *handler, void *ctx);
+/* Send the segment at con->tcp, len includes the tcp header */
+int net_tcp_send(struct net_connection *con, int len);
+
+/* TCP streams, see net/tcp.c */
+struct tcp_connection;
+
+struct tcp_connection *tcp_connect(IPaddr_t dest, uint16_t port);
+int tcp_write(struct tcp_connection *t, const void *buf, int len);
+int tcp_read(struct tcp_connection *t, void *buf, int len);
+void tcp_close(struct tcp_connection *t);
+
 void led_trigger_network(enum led_trigger trigger);
 
 #define IFUP_FLAG_FORCE		(1 << 0)
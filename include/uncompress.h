@@ -1,6 +1,8 @@
 #ifndef __UNCOMPRESS_H
 #define __UNCOMPRESS_H
 
+#include <filetype.h>
+
 int uncompress(unsigned char *inbuf, int len,
 	   int(*fill)(void*, unsigned int),
 	   int(*flush)(void*, unsigned int),
@@ -11,9 +13,14 @@ int uncompress(unsigned char *inbuf, int len,
 int uncompress_fd_to_fd(int infd, int outfd,
 	   void(*error_fn)(char *x));
 
+int uncompress_fd_to_flush(int infd, int(*flush)(void*, unsigned int),
+	   void(*error_fn)(char *x));
+
 int uncompress_fd_to_buf(int infd, void *output,
 	   void(*error_fn)(char *x));
 
 void uncompress_err_stdout(char *);
 
+enum filetype uncompress_file_detect_type(const char *filename);
+
 #endif /* __UNCOMPRESS_H */
@@ -0,0 +1,258 @@
+/*
+ * Wrapper for decompressing zstd compressed images
+ *
+ * Based on the Linux kernel wrapper, Copyright (c) Facebook, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Without fill() and flush() the whole input is in memory and the output
+ * buffer is large enough for everything. This is what the PBL uses, only a
+ * decompression context of about 100 KiB is needed then.
+ *
+ * Otherwise input and output are streamed through buffers of
+ * ZSTD_IOBUF_SIZE. The decoder then has to keep the last window of output
+ * around, so memory usage is bounded by the window size the frame was
+ * compressed with. Frames with windows larger than ZSTD_WINDOWSIZE_MAX are
+ * refused.
+ */
+#ifdef STATIC
+#define PREBOOT
+#include <linux/decompress/mm.h>
+/*
+ * The PBL only decompresses barebox once, so trade the faster decoding
+ * variants for about a third less code.
+ */
+#define HUF_FORCE_DECOMPRESS_X1
+#define ZSTD_FORCE_DECOMPRESS_SEQUENCES_SHORT
+#include "zstd/decompress_sources.h"
+#else
+#include <linux/decompress/unzstd.h>
+#include <malloc.h>
+#define MALLOC malloc
+#define FREE free
+#endif
+
+#define ZSTD_STATIC_LINKING_ONLY
+#include <linux/zstd.h>
+
+#include <linux/decompress/mm.h>
+#include <linux/kernel.h>
+#include <linux/sizes.h>
+#include <linux/types.h>
+
+#ifndef STATIC
+#define STATIC
+#endif
+
+#define ZSTD_WINDOWSIZE_MAX	(1 << ZSTD_WINDOWLOG_LIMIT_DEFAULT)
+#define ZSTD_IOBUF_SIZE		SZ_128K
+
+static int handle_zstd_error(size_t ret, void (*error)(char *x))
+{
+	switch (ZSTD_getErrorCode(ret)) {
+	case ZSTD_error_memory_allocation:
+		error("ZSTD decompressor ran out of memory");
+		break;
+	case ZSTD_error_prefix_unknown:
+		error("Input is not in the ZSTD format (wrong magic bytes)");
+		break;
+	case ZSTD_error_dstSize_tooSmall:
+	case ZSTD_error_corruption_detected:
+	case ZSTD_error_checksum_wrong:
+		error("ZSTD-compressed data is corrupt");
+		break;
+	default:
+		error("ZSTD-compressed data is probably corrupt");
+		break;
+	}
+
+	return -1;
+}
+
+static int decompress_single(const u8 *in_buf, long in_len, u8 *out_buf,
+			     size_t out_len, int *in_pos,
+			     void (*error)(char *x))
+{
+	const size_t wksp_size = ZSTD_estimateDCtxSize();
+	void *wksp = MALLOC(wksp_size);
+	ZSTD_DCtx *dctx = ZSTD_initStaticDCtx(wksp, wksp_size);
+	size_t ret;
+	int err;
+
+	if (!dctx) {
+		error("Out of memory while allocating ZSTD_DCtx");
+		err = -1;
+		goto out;
+	}
+
+	/*
+	 * Find out how large the frame actually is, there may be junk at
+	 * the end of the frame that ZSTD_decompressDCtx() can't handle.
+	 */
+	ret = ZSTD_findFrameCompressedSize(in_buf, in_len);
+	if (ZSTD_isError(ret)) {
+		err = handle_zstd_error(ret, error);
+		goto out;
+	}
+	in_len = ret;
+
+	ret = ZSTD_decompressDCtx(dctx, out_buf, out_len, in_buf, in_len);
+	if (ZSTD_isError(ret)) {
+		err = handle_zstd_error(ret, error);
+		goto out;
+	}
+
+	if (in_pos)
+		*in_pos = in_len;
+
+	err = 0;
+out:
+	if (wksp)
+		FREE(wksp);
+
+	return err;
+}
+
+STATIC int decompress_unzstd(unsigned char *in_buf, int in_len,
+			     int (*fill)(void *, unsigned int),
+			     int (*flush)(void *, unsigned int),
+			     unsigned char *out_buf, int *in_pos,
+			     void (*error)(char *x))
+{
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+	ZSTD_FrameHeader header;
+	ZSTD_DStream *dstream;
+	void *in_allocated = NULL, *out_allocated = NULL, *wksp = NULL;
+	size_t wksp_size, ret;
+	size_t out_len;
+	int err = -1;
+
+	/*
+	 * The decoder must not see a buffer whose end address overflows.
+	 * Without a flush() the output buffer has no known size, so make it
+	 * as large as possible.
+	 */
+	out_len = (size_t)-1 - (uintptr_t)out_buf;
+
+	if (!fill && !flush)
+		return decompress_single(in_buf, in_len, out_buf, out_len,
+					 in_pos, error);
+
+	if (!in_buf) {
+		in_allocated = MALLOC(ZSTD_IOBUF_SIZE);
+		if (!in_allocated) {
+			error("Out of memory while allocating input buffer");
+			goto out;
+		}
+		in_buf = in_allocated;
+		in_len = 0;
+	}
+
+	if (flush) {
+		out_allocated = MALLOC(ZSTD_IOBUF_SIZE);
+		if (!out_allocated) {
+			error("Out of memory while allocating output buffer");
+			goto out;
+		}
+		out_buf = out_allocated;
+		out_len = ZSTD_IOBUF_SIZE;
+	}
+
+	if (fill) {
+		in_len = fill(in_buf, ZSTD_IOBUF_SIZE);
+		if (in_len < 0) {
+			error("ZSTD-compressed data is truncated");
+			goto out;
+		}
+	}
+
+	in.src = in_buf;
+	in.pos = 0;
+	in.size = in_len;
+	out.dst = out_buf;
+	out.pos = 0;
+	out.size = out_len;
+
+	/*
+	 * The frame header tells how large the window is, which is what the
+	 * decoder allocates besides its fixed size context.
+	 */
+	ret = ZSTD_getFrameHeader(&header, in.src, in.size);
+	if (ZSTD_isError(ret)) {
+		err = handle_zstd_error(ret, error);
+		goto out;
+	}
+	if (ret) {
+		error("ZSTD-compressed data is truncated");
+		goto out;
+	}
+	if (header.windowSize > ZSTD_WINDOWSIZE_MAX) {
+		error("ZSTD-compressed data has too large a window size");
+		goto out;
+	}
+
+	wksp_size = ZSTD_estimateDStreamSize(header.windowSize);
+	wksp = MALLOC(wksp_size);
+	dstream = ZSTD_initStaticDStream(wksp, wksp_size);
+	if (!dstream) {
+		error("Out of memory while allocating ZSTD_DStream");
+		goto out;
+	}
+
+	while (1) {
+		ret = ZSTD_decompressStream(dstream, &out, &in);
+		if (ZSTD_isError(ret)) {
+			err = handle_zstd_error(ret, error);
+			goto out;
+		}
+
+		if (flush && out.pos) {
+			if (flush(out.dst, out.pos) != out.pos) {
+				error("Failed to flush()");
+				goto out;
+			}
+			out.pos = 0;
+		}
+
+		/* The frame is complete */
+		if (!ret)
+			break;
+
+		if (in.pos < in.size)
+			continue;
+
+		if (!fill) {
+			error("ZSTD-compressed data is truncated");
+			goto out;
+		}
+
+		in_len = fill(in_buf, ZSTD_IOBUF_SIZE);
+		if (in_len <= 0) {
+			error("ZSTD-compressed data is truncated");
+			goto out;
+		}
+		in.pos = 0;
+		in.size = in_len;
+	}
+
+	if (in_pos)
+		*in_pos = in.pos;
+
+	err = 0;
+out:
+	if (in_allocated)
+		FREE(in_allocated);
+	if (out_allocated)
+		FREE(out_allocated);
+	if (wksp)
+		FREE(wksp);
+
+	return err;
+}
+
+#define decompress decompress_unzstd
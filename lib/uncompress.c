@@ -23,10 +23,13 @@
 #include <lzo.h>
 #include <linux/xz.h>
 #include <linux/decompress/unlz4.h>
+#include <linux/decompress/unzstd.h>
 #include <errno.h>
 #include <filetype.h>
 #include <malloc.h>
 #include <fs.h>
+#include <fcntl.h>
+#include <linux/sizes.h>
 
 static void *uncompress_buf;
 static unsigned int uncompress_size;
@@ -123,6 +126,11 @@ int uncompress(unsigned char *inbuf, int len,
 	case filetype_xz_compressed:
 		compfn = decompress_unxz;
 		break;
+#endif
+#ifdef CONFIG_ZSTD_DECOMPRESS
+	case filetype_zstd_compressed:
+		compfn = decompress_unzstd;
+		break;
 #endif
 	default:
 		err = asprintf("cannot handle filetype %s", file_type_to_string(ft));
@@ -142,9 +150,43 @@ err:
 
 static int uncompress_infd, uncompress_outfd;
 
+/*
+ * The decompressors ask for their input in pieces of a few bytes up to
+ * some KiB. Files are read in large chunks instead, which is much faster
+ * on network filesystems.
+ */
+#define UNCOMPRESS_READ_SIZE	SZ_256K
+
+static void *uncompress_rbuf;
+static unsigned int uncompress_rpos, uncompress_rlen;
+
 static int fill_fd(void *buf, unsigned int len)
 {
-	return read(uncompress_infd, buf, len);
+	unsigned int now, total = 0;
+	int ret;
+
+	while (len) {
+		if (uncompress_rpos == uncompress_rlen) {
+			ret = read(uncompress_infd, uncompress_rbuf,
+					UNCOMPRESS_READ_SIZE);
+			if (ret < 0)
+				return ret;
+			if (!ret)
+				break;
+
+			uncompress_rpos = 0;
+			uncompress_rlen = ret;
+		}
+
+		now = min(len, uncompress_rlen - uncompress_rpos);
+		memcpy(buf, uncompress_rbuf + uncompress_rpos, now);
+		uncompress_rpos += now;
+		buf += now;
+		len -= now;
+		total += now;
+	}
+
+	return total;
 }
 
 static int flush_fd(void *buf, unsigned int len)
@@ -152,24 +194,124 @@ static int flush_fd(void *buf, unsigned int len)
 	return write(uncompress_outfd, buf, len);
 }
 
-int uncompress_fd_to_fd(int infd, int outfd,
-	   void(*error_fn)(char *x))
+static void uncompress_fill_fd_init(int infd)
 {
 	uncompress_infd = infd;
-	uncompress_outfd = outfd;
+	uncompress_rbuf = xmalloc(UNCOMPRESS_READ_SIZE);
+	uncompress_rpos = uncompress_rlen = 0;
+}
+
+static void uncompress_fill_fd_done(void)
+{
+	free(uncompress_rbuf);
+	uncompress_rbuf = NULL;
+}
 
-	return uncompress(NULL, 0,
+/**
+ * uncompress_fd_to_flush - uncompress a file while it is read
+ * @infd: the compressed input
+ * @flush: called with each piece of the uncompressed output
+ * @error_fn: called with error messages
+ *
+ * The input is read in large chunks and handed to the decompressor
+ * directly, it is never held in memory as a whole.
+ *
+ * Return: 0 on success, negative error code otherwise
+ */
+int uncompress_fd_to_flush(int infd, int(*flush)(void*, unsigned int),
+	   void(*error_fn)(char *x))
+{
+	int ret;
+
+	uncompress_fill_fd_init(infd);
+
+	ret = uncompress(NULL, 0,
 	   fill_fd,
-	   flush_fd,
+	   flush,
 	   NULL,
 	   NULL,
 	   error_fn);
+
+	uncompress_fill_fd_done();
+
+	return ret;
+}
+
+int uncompress_fd_to_fd(int infd, int outfd,
+	   void(*error_fn)(char *x))
+{
+	uncompress_outfd = outfd;
+
+	return uncompress_fd_to_flush(infd, flush_fd, error_fn);
 }
 
 int uncompress_fd_to_buf(int infd, void *output,
 		void(*error_fn)(char *x))
 {
-	uncompress_infd = infd;
+	int ret;
+
+	uncompress_fill_fd_init(infd);
+
+	ret = uncompress(NULL, 0, fill_fd, NULL, output, NULL, error_fn);
+
+	uncompress_fill_fd_done();
+
+	return ret;
+}
+
+static char *uncompress_peek_buf;
+static unsigned int uncompress_peek_len;
+
+static int flush_peek(void *buf, unsigned int len)
+{
+	unsigned int now;
+
+	now = min(len, FILE_TYPE_SAFE_BUFSIZE - uncompress_peek_len);
+	memcpy(uncompress_peek_buf + uncompress_peek_len, buf, now);
+	uncompress_peek_len += now;
+
+	/* Stop the decompressor once we have enough */
+	if (uncompress_peek_len == FILE_TYPE_SAFE_BUFSIZE)
+		return -EINTR;
+
+	return len;
+}
+
+static void uncompress_err_ignore(char *x)
+{
+}
+
+/**
+ * uncompress_file_detect_type - detect the type of a compressed file's content
+ * @filename: the compressed file
+ *
+ * Only the start of the file is uncompressed.
+ *
+ * Return: the file type of the uncompressed content, negative error code
+ * if the file cannot be read
+ */
+enum filetype uncompress_file_detect_type(const char *filename)
+{
+	enum filetype type;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return fd;
+
+	uncompress_peek_buf = xzalloc(FILE_TYPE_SAFE_BUFSIZE);
+	uncompress_peek_len = 0;
+
+	uncompress_fd_to_flush(fd, flush_peek, uncompress_err_ignore);
+
+	if (uncompress_peek_len)
+		type = file_detect_type(uncompress_peek_buf,
+				uncompress_peek_len);
+	else
+		type = filetype_unknown;
+
+	free(uncompress_peek_buf);
+	close(fd);
 
-	return uncompress(NULL, 0, fill_fd, NULL, output, NULL, error_fn);
+	return type;
 }
@@ -0,0 +1,177 @@
+/*
+ * xxHash - Extremely Fast Hash algorithm
+ * Copyright (c) Yann Collet - Meta Platforms, Inc
+ *
+ * This source code is licensed under both the BSD-style license (found in the
+ * LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ * in the COPYING file in the root directory of this source tree).
+ * You may select, at your option, one of the above-listed licenses.
+ */
+
+#include "zstd_deps.h"
+#include "xxhash.h"
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define XXH_rotl64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static U64 XXH64_round(U64 acc, U64 input)
+{
+	acc += input * XXH_PRIME64_2;
+	acc = XXH_rotl64(acc, 31);
+	acc *= XXH_PRIME64_1;
+	return acc;
+}
+
+static U64 XXH64_mergeRound(U64 acc, U64 val)
+{
+	val = XXH64_round(0, val);
+	acc ^= val;
+	acc = acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+	return acc;
+}
+
+static U64 XXH64_finalize(U64 h64, const BYTE *p, size_t len)
+{
+	while (len >= 8) {
+		h64 ^= XXH64_round(0, MEM_readLE64(p));
+		h64 = XXH_rotl64(h64, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+		p += 8;
+		len -= 8;
+	}
+
+	if (len >= 4) {
+		h64 ^= (U64)MEM_readLE32(p) * XXH_PRIME64_1;
+		h64 = XXH_rotl64(h64, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+		p += 4;
+		len -= 4;
+	}
+
+	while (len > 0) {
+		h64 ^= (*p) * XXH_PRIME64_5;
+		h64 = XXH_rotl64(h64, 11) * XXH_PRIME64_1;
+		p++;
+		len--;
+	}
+
+	h64 ^= h64 >> 33;
+	h64 *= XXH_PRIME64_2;
+	h64 ^= h64 >> 29;
+	h64 *= XXH_PRIME64_3;
+	h64 ^= h64 >> 32;
+
+	return h64;
+}
+
+static void XXH64_init(U64 *v, XXH64_hash_t seed)
+{
+	v[0] = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+	v[1] = seed + XXH_PRIME64_2;
+	v[2] = seed;
+	v[3] = seed - XXH_PRIME64_1;
+}
+
+static const BYTE *XXH64_stripes(U64 *v, const BYTE *p, const BYTE *limit)
+{
+	do {
+		v[0] = XXH64_round(v[0], MEM_readLE64(p));
+		v[1] = XXH64_round(v[1], MEM_readLE64(p + 8));
+		v[2] = XXH64_round(v[2], MEM_readLE64(p + 16));
+		v[3] = XXH64_round(v[3], MEM_readLE64(p + 24));
+		p += 32;
+	} while (p <= limit);
+
+	return p;
+}
+
+static U64 XXH64_merge(const U64 *v)
+{
+	U64 h64;
+
+	h64 = XXH_rotl64(v[0], 1) + XXH_rotl64(v[1], 7) +
+	      XXH_rotl64(v[2], 12) + XXH_rotl64(v[3], 18);
+	h64 = XXH64_mergeRound(h64, v[0]);
+	h64 = XXH64_mergeRound(h64, v[1]);
+	h64 = XXH64_mergeRound(h64, v[2]);
+	h64 = XXH64_mergeRound(h64, v[3]);
+
+	return h64;
+}
+
+XXH64_hash_t XXH64(const void *input, size_t len, XXH64_hash_t seed)
+{
+	const BYTE *p = input;
+	U64 v[4];
+	U64 h64;
+
+	if (len >= 32) {
+		XXH64_init(v, seed);
+		p = XXH64_stripes(v, p, p + len - 32);
+		h64 = XXH64_merge(v);
+	} else {
+		h64 = seed + XXH_PRIME64_5;
+	}
+
+	h64 += len;
+
+	return XXH64_finalize(h64, p, len & 31);
+}
+
+void XXH64_reset(XXH64_state_t *state, XXH64_hash_t seed)
+{
+	ZSTD_memset(state, 0, sizeof(*state));
+	XXH64_init(state->v, seed);
+}
+
+void XXH64_update(XXH64_state_t *state, const void *input, size_t len)
+{
+	const BYTE *p = input;
+	const BYTE *end = p + len;
+
+	if (!input)
+		return;
+
+	state->total_len += len;
+
+	if (state->memsize + len < 32) {
+		ZSTD_memcpy((BYTE *)state->mem64 + state->memsize, input, len);
+		state->memsize += (U32)len;
+		return;
+	}
+
+	if (state->memsize) {
+		ZSTD_memcpy((BYTE *)state->mem64 + state->memsize, input,
+			    32 - state->memsize);
+		XXH64_stripes(state->v, (const BYTE *)state->mem64,
+			      (const BYTE *)state->mem64);
+		p += 32 - state->memsize;
+		state->memsize = 0;
+	}
+
+	if (p + 32 <= end)
+		p = XXH64_stripes(state->v, p, end - 32);
+
+	if (p < end) {
+		ZSTD_memcpy(state->mem64, p, (size_t)(end - p));
+		state->memsize = (U32)(end - p);
+	}
+}
+
+XXH64_hash_t XXH64_digest(const XXH64_state_t *state)
+{
+	U64 h64;
+
+	if (state->total_len >= 32)
+		h64 = XXH64_merge(state->v);
+	else
+		h64 = state->v[2] + XXH_PRIME64_5;
+
+	h64 += state->total_len;
+
+	return XXH64_finalize(h64, (const BYTE *)state->mem64,
+			      (size_t)state->total_len & 31);
+}
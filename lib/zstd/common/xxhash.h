@@ -0,0 +1,35 @@
+/*
+ * xxHash - Extremely Fast Hash algorithm
+ * Copyright (c) Yann Collet - Meta Platforms, Inc
+ *
+ * This source code is licensed under both the BSD-style license (found in the
+ * LICENSE file in the root directory of this source tree) and the GPLv2 (found
+ * in the COPYING file in the root directory of this source tree).
+ * You may select, at your option, one of the above-listed licenses.
+ */
+
+/*
+ * barebox only carries the XXH64 part of xxHash, which the decoder needs to
+ * check frame checksums.
+ */
+
+#ifndef XXHASH_H_5627135585666179
+#define XXHASH_H_5627135585666179
+
+#include "mem.h"
+
+typedef U64 XXH64_hash_t;
+
+typedef struct XXH64_state_s {
+	U64 total_len;
+	U64 v[4];
+	U64 mem64[4];
+	U32 memsize;
+} XXH64_state_t;
+
+XXH64_hash_t XXH64(const void *input, size_t length, XXH64_hash_t seed);
+void XXH64_reset(XXH64_state_t *state, XXH64_hash_t seed);
+void XXH64_update(XXH64_state_t *state, const void *input, size_t length);
+XXH64_hash_t XXH64_digest(const XXH64_state_t *state);
+
+#endif /* XXHASH_H_5627135585666179 */
@@ -0,0 +1,14 @@
+/*
+ * This file includes every .c file needed for decompression, so that the PBL
+ * can build the decoder into a single translation unit from pbl/decomp.c.
+ */
+
+#include "common/entropy_common.c"
+#include "common/error_private.c"
+#include "common/fse_decompress.c"
+#include "common/xxhash.c"
+#include "common/zstd_common.c"
+#include "decompress/huf_decompress.c"
+#include "decompress/zstd_ddict.c"
+#include "decompress/zstd_decompress.c"
+#include "decompress/zstd_decompress_block.c"
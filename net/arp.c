@@ -0,0 +1,176 @@
+/*
+ * arp.c - ARP neighbour cache
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define pr_fmt(fmt) "arp: " fmt
+
+#include <common.h>
+#include <command.h>
+#include <clock.h>
+#include <getopt.h>
+#include <net.h>
+#include <asm-generic/div64.h>
+
+/*
+ * The cache is filled from ARP requests and replies addressed to us and from
+ * unicast IP packets of hosts on the local network. When it is full the
+ * oldest entry is replaced.
+ */
+#define ARP_CACHE_SIZE		16
+#define ARP_CACHE_TIMEOUT	(300ULL * SECOND)
+
+struct arp_entry {
+	struct eth_device *edev;	/* NULL for unused entries */
+	IPaddr_t ip;
+	u8 ethaddr[6];
+	uint64_t updated;
+};
+
+static struct arp_entry arp_cache[ARP_CACHE_SIZE];
+
+static struct arp_entry *arp_cache_find(struct eth_device *edev, IPaddr_t ip)
+{
+	struct arp_entry *e;
+
+	for (e = arp_cache; e < arp_cache + ARP_CACHE_SIZE; e++) {
+		if (e->edev != edev || e->ip != ip)
+			continue;
+
+		if (is_timeout(e->updated, ARP_CACHE_TIMEOUT)) {
+			e->edev = NULL;
+			return NULL;
+		}
+
+		return e;
+	}
+
+	return NULL;
+}
+
+/**
+ * arp_cache_lookup - look up the hardware address of a neighbour
+ * @edev: the device the neighbour is connected to
+ * @ip: IP address of the neighbour
+ * @ethaddr: returns the hardware address
+ *
+ * Return: 0 on success, -ENOENT if the neighbour is not in the cache
+ */
+int arp_cache_lookup(struct eth_device *edev, IPaddr_t ip, u8 *ethaddr)
+{
+	struct arp_entry *e = arp_cache_find(edev, ip);
+
+	if (!e)
+		return -ENOENT;
+
+	memcpy(ethaddr, e->ethaddr, 6);
+
+	return 0;
+}
+
+/**
+ * arp_cache_update - learn the hardware address of a neighbour
+ * @edev: the device the neighbour is connected to
+ * @ip: IP address of the neighbour
+ * @ethaddr: hardware address of the neighbour
+ */
+void arp_cache_update(struct eth_device *edev, IPaddr_t ip, const u8 *ethaddr)
+{
+	struct arp_entry *e, *victim;
+
+	if (!ip || ip == 0xffffffff || !is_valid_ether_addr(ethaddr))
+		return;
+
+	e = arp_cache_find(edev, ip);
+	if (!e) {
+		victim = arp_cache;
+		for (e = arp_cache; e < arp_cache + ARP_CACHE_SIZE; e++) {
+			if (!e->edev) {
+				victim = e;
+				break;
+			}
+			if (e->updated < victim->updated)
+				victim = e;
+		}
+
+		e = victim;
+		e->edev = edev;
+		e->ip = ip;
+	}
+
+	memcpy(e->ethaddr, ethaddr, 6);
+	e->updated = get_time_ns();
+}
+
+/**
+ * arp_cache_flush - remove entries from the cache
+ * @edev: the device to remove the entries for, NULL for all entries
+ */
+void arp_cache_flush(struct eth_device *edev)
+{
+	struct arp_entry *e;
+
+	for (e = arp_cache; e < arp_cache + ARP_CACHE_SIZE; e++)
+		if (!edev || e->edev == edev)
+			e->edev = NULL;
+}
+
+#ifdef CONFIG_CMD_ARP
+static int do_arp(int argc, char *argv[])
+{
+	struct arp_entry *e;
+	char ethaddr[sizeof("xx:xx:xx:xx:xx:xx")];
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d")) > 0) {
+		switch (opt) {
+		case 'd':
+			arp_cache_flush(NULL);
+			return 0;
+		default:
+			return COMMAND_ERROR_USAGE;
+		}
+	}
+
+	printf("%-16s %-18s %-8s %s\n", "Address", "HWaddress", "Iface", "Age");
+
+	for (e = arp_cache; e < arp_cache + ARP_CACHE_SIZE; e++) {
+		uint64_t age;
+
+		if (!e->edev || is_timeout(e->updated, ARP_CACHE_TIMEOUT))
+			continue;
+
+		age = get_time_ns() - e->updated;
+		do_div(age, SECOND);
+
+		ethaddr_to_string(e->ethaddr, ethaddr);
+		printf("%-16s %-18s %-8s %llus\n", ip_to_string(e->ip), ethaddr,
+				dev_name(&e->edev->dev), age);
+	}
+
+	return 0;
+}
+
+BAREBOX_CMD_HELP_START(arp)
+BAREBOX_CMD_HELP_TEXT("Show the ARP neighbour cache.")
+BAREBOX_CMD_HELP_TEXT("")
+BAREBOX_CMD_HELP_TEXT("Options:")
+BAREBOX_CMD_HELP_OPT ("-d", "flush the cache")
+BAREBOX_CMD_HELP_END
+
+BAREBOX_CMD_START(arp)
+	.cmd		= do_arp,
+	BAREBOX_CMD_DESC("show or flush the ARP cache")
+	BAREBOX_CMD_OPTS("[-d]")
+	BAREBOX_CMD_GROUP(CMD_GRP_NET)
+	BAREBOX_CMD_HELP(cmd_arp_help)
+BAREBOX_CMD_END
+#endif
@@ -80,6 +80,7 @@ static uint32_t dhcp_leasetime;
 static IPaddr_t net_dhcp_server_ip;
 static uint64_t dhcp_start;
 static char dhcp_tftpname[256];
+static struct eth_device *dhcp_edev;	/* the device being configured */
 
 static const char* dhcp_get_barebox_global(const char * var)
 {
@@ -126,7 +127,7 @@ static void netmask_handle(struct dhcp_opt *opt, unsigned char *popt, int optlen
 	IPaddr_t ip;
 
 	ip = net_read_ip(popt);
-	net_set_netmask(ip);
+	dhcp_edev->netmask = ip;
 }
 
 static void gateway_handle(struct dhcp_opt *opt, unsigned char *popt, int optlen)
@@ -134,16 +135,23 @@ static void gateway_handle(struct dhcp_opt *opt, unsigned char *popt, int optlen
 	IPaddr_t ip;
 
 	ip = net_read_ip(popt);
-	net_set_gateway(ip);
+	dhcp_edev->gateway = ip;
 }
 
-static void env_ip_handle(struct dhcp_opt *opt, unsigned char *popt, int optlen)
+/* Option 6 may carry several nameservers, pass them all to resolv() */
+static void nameserver_handle(struct dhcp_opt *opt, unsigned char *popt, int optlen)
 {
-	IPaddr_t ip;
+	char str[4 * sizeof("xxx.xxx.xxx.xxx")];
+	int i, len = 0;
+
+	str[0] = 0;
+
+	for (i = 0; i + 4 <= optlen && i < 16; i += 4)
+		len += sprintf(str + len, "%s%s", len ? " " : "",
+				ip_to_string(net_read_ip(popt + i)));
 
-	ip = net_read_ip(popt);
 	if (IS_ENABLED(CONFIG_ENVIRONMENT_VARIABLES))
-		setenv_ip(opt->barebox_var_name, ip);
+		setenv(opt->barebox_var_name, str);
 }
 
 static void env_str_handle(struct dhcp_opt *opt, unsigned char *popt, int optlen)
@@ -241,7 +249,7 @@ struct dhcp_opt dhcp_options[] = {
 		.handle = gateway_handle,
 	}, {
 		.option = 6,
-		.handle = env_ip_handle,
+		.handle = nameserver_handle,
 		.barebox_var_name = "net.nameserver",
 	}, {
 		.option = DHCP_HOSTNAME,
@@ -369,11 +377,11 @@ static void bootp_copy_net_params(struct bootp *bp)
 	IPaddr_t tmp_ip;
 
 	tmp_ip = net_read_ip(&bp->bp_yiaddr);
-	net_set_ip(tmp_ip);
+	dhcp_edev->ipaddr = tmp_ip;
 
 	tmp_ip = net_read_ip(&bp->bp_siaddr);
 	if (tmp_ip != 0)
-		net_set_serverip(tmp_ip);
+		dhcp_edev->serverip = tmp_ip;
 
 	if (strlen(bp->bp_file) > 0) {
 		if (IS_ENABLED(CONFIG_ENVIRONMENT_VARIABLES))
@@ -618,7 +626,7 @@ static void dhcp_handler(void *ctx, char *packet, unsigned int len)
 			bootp_copy_net_params(bp); /* Store net params from reply */
 			dhcp_state = BOUND;
 			puts ("DHCP client bound to address ");
-			print_IPaddr(net_get_ip());
+			print_IPaddr(dhcp_edev->ipaddr);
 			putchar('\n');
 			return;
 		}
@@ -646,10 +654,23 @@ static void dhcp_reset_env(void)
 	}
 }
 
-int dhcp(int retries, struct dhcp_req_param *param)
+/**
+ * dhcp - configure a network device with DHCP
+ * @edev: the device to configure, NULL for the current device
+ * @retries: number of requests to send
+ * @param: options to send to the server
+ */
+int dhcp(struct eth_device *edev, int retries, struct dhcp_req_param *param)
 {
 	int ret = 0;
 
+	if (!edev)
+		edev = eth_get_current();
+	if (!edev)
+		return -ENETDOWN;
+
+	dhcp_edev = edev;
+
 	dhcp_reset_env();
 
 	dhcp_set_param_data(DHCP_HOSTNAME, param->hostname);
@@ -661,7 +682,8 @@ int dhcp(int retries, struct dhcp_req_param *param)
 	if (!retries)
 		retries = DHCP_DEFAULT_RETRY;
 
-	dhcp_con = net_udp_new(0xffffffff, PORT_BOOTPS, dhcp_handler, NULL);
+	dhcp_con = net_udp_eth_new(edev, 0xffffffff, PORT_BOOTPS, dhcp_handler,
+			NULL);
 	if (IS_ERR(dhcp_con)) {
 		ret = PTR_ERR(dhcp_con);
 		goto out;
@@ -671,7 +693,7 @@ int dhcp(int retries, struct dhcp_req_param *param)
 	if (ret)
 		goto out1;
 
-	net_set_ip(0);
+	edev->ipaddr = 0;
 
 	dhcp_start = get_time_ns();
 	ret = bootp_request(); /* Basically same as BOOTP */
@@ -702,7 +724,7 @@ int dhcp(int retries, struct dhcp_req_param *param)
 	if (dhcp_tftpname[0] != 0) {
 		IPaddr_t tftpserver = resolv(dhcp_tftpname);
 		if (tftpserver)
-			net_set_serverip(tftpserver);
+			edev->serverip = tftpserver;
 	}
 
 out1:
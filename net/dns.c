@@ -27,10 +27,25 @@
 #include <net.h>
 #include <clock.h>
 #include <environment.h>
+#include <getopt.h>
+#include <stdlib.h>
 #include <linux/err.h>
+#include <asm-generic/div64.h>
 
 #define DNS_PORT 53
 
+/* Queries go to up to this many servers from $net.nameserver at once */
+#define DNS_MAX_SERVERS		4
+#define DNS_TIMEOUT		(10ULL * SECOND)
+
+/*
+ * Answers are cached for the TTL given by the server, limited to
+ * DNS_MAX_TTL. Names which do not exist are cached for DNS_NEGATIVE_TTL.
+ */
+#define DNS_CACHE_SIZE		16
+#define DNS_MAX_TTL		(24 * 60 * 60)
+#define DNS_NEGATIVE_TTL	60
+
 /* http://en.wikipedia.org/wiki/List_of_DNS_record_types */
 enum dns_query_type {
 	DNS_A_RECORD = 0x01,
@@ -51,38 +66,117 @@ struct header {
 	unsigned char	data[1];	/* Data, variable length */
 };
 
+#define DNS_FLAG_RESPONSE	0x8000
+#define DNS_RCODE_MASK		0x000f
+#define DNS_RCODE_NXDOMAIN	3
+
 #define STATE_INIT	0
 #define STATE_DONE	1
 
-static struct net_connection *dns_con;
-static uint64_t dns_timer_start;
+struct dns_server {
+	struct net_connection *con;
+	int failed;		/* the server could not answer */
+};
+
+static struct dns_server dns_servers[DNS_MAX_SERVERS];
+static int dns_num_servers;
+static uint16_t dns_tid;
 static int dns_state;
+static int dns_err;
 static IPaddr_t dns_ip;
+static uint32_t dns_ttl;
+
+struct dns_cache_entry {
+	char *name;		/* NULL for unused entries */
+	IPaddr_t ip;		/* 0 if the name does not exist */
+	uint64_t updated;
+	uint32_t ttl;		/* in seconds */
+};
+
+static struct dns_cache_entry dns_cache[DNS_CACHE_SIZE];
+
+static void dns_cache_free(struct dns_cache_entry *e)
+{
+	free(e->name);
+	e->name = NULL;
+}
+
+static int dns_cache_expired(struct dns_cache_entry *e)
+{
+	return is_timeout(e->updated, (uint64_t)e->ttl * SECOND);
+}
 
-static int dns_send(const char *name)
+static struct dns_cache_entry *dns_cache_find(const char *name)
+{
+	struct dns_cache_entry *e;
+
+	for (e = dns_cache; e < dns_cache + DNS_CACHE_SIZE; e++) {
+		if (!e->name || strcmp(e->name, name))
+			continue;
+
+		if (dns_cache_expired(e)) {
+			dns_cache_free(e);
+			return NULL;
+		}
+
+		return e;
+	}
+
+	return NULL;
+}
+
+static void dns_cache_add(const char *name, IPaddr_t ip, uint32_t ttl)
+{
+	struct dns_cache_entry *e, *victim = dns_cache;
+
+	if (!ttl)
+		return;
+
+	for (e = dns_cache; e < dns_cache + DNS_CACHE_SIZE; e++) {
+		if (!e->name || dns_cache_expired(e)) {
+			victim = e;
+			break;
+		}
+		if (e->updated < victim->updated)
+			victim = e;
+	}
+
+	dns_cache_free(victim);
+	victim->name = xstrdup(name);
+	victim->ip = ip;
+	victim->ttl = min_t(uint32_t, ttl, DNS_MAX_TTL);
+	victim->updated = get_time_ns();
+}
+
+/* Append the domain to names without a dot */
+static char *dns_fqdn(const char *name)
+{
+	const char *domain = getenv("net.domainname");
+
+	if (!strchr(name, '.') && domain && *domain)
+		return xasprintf("%s.%s", name, domain);
+
+	return xstrdup(name);
+}
+
+static int dns_send(struct net_connection *con, const char *name)
 {
 	int ret;
 	struct header *header;
 	enum dns_query_type qtype = DNS_A_RECORD;
-	unsigned char *packet = net_udp_get_payload(dns_con);
+	unsigned char *packet = net_udp_get_payload(con);
 	unsigned char *p, *s, *fullname, *dotptr;
-	const unsigned char *domain;
 
 	/* Prepare DNS packet header */
 	header           = (struct header *)packet;
-	header->tid      = 1;
+	header->tid      = dns_tid;
 	header->flags    = htons(0x100);	/* standard query */
 	header->nqueries = htons(1);		/* Just one query */
 	header->nanswers = 0;
 	header->nauth    = 0;
 	header->nother   = 0;
 
-	domain = getenv("net.domainname");
-
-	if (!strchr(name, '.') && domain && *domain)
-		fullname = asprintf(".%s.%s.", name, domain);
-	else
-		fullname = asprintf(".%s.", name);
+	fullname = asprintf(".%s.", name);
 
 	/* replace dots in fullname with chunk len */
 	dotptr = fullname;
@@ -109,30 +203,78 @@ static int dns_send(const char *name)
 	*p++ = 0;
 	*p++ = 1;				/* Class: inet, 0x0001 */
 
-	ret = net_udp_send(dns_con, p - packet);
+	ret = net_udp_send(con, p - packet);
 
 	free(fullname);
 
 	return ret;
 }
 
-static void dns_recv(struct header *header, unsigned len)
+static uint32_t dns_read_ttl(const unsigned char *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* The first answer wins, positive or not */
+static void dns_done(int err)
+{
+	dns_err = err;
+	dns_state = STATE_DONE;
+}
+
+/* A server could not answer, give up when all of them failed */
+static void dns_server_failed(struct dns_server *server)
+{
+	int i;
+
+	server->failed = 1;
+
+	for (i = 0; i < dns_num_servers; i++)
+		if (!dns_servers[i].failed)
+			return;
+
+	dns_done(-EIO);
+}
+
+static void dns_recv(struct dns_server *server, struct header *header,
+		unsigned len)
 {
 	unsigned char *p, *e, *s;
-	u16 type;
+	u16 type, flags;
 	int found, stop, dlen;
+	uint32_t ttl = DNS_MAX_TTL;
 	short tmp;
 
 	debug("%s\n", __func__);
 
+	if (len < sizeof(*header) || header->tid != dns_tid ||
+	    dns_state == STATE_DONE || server->failed)
+		return;
+
+	flags = ntohs(header->flags);
+	if (!(flags & DNS_FLAG_RESPONSE))
+		return;
+
+	if ((flags & DNS_RCODE_MASK) == DNS_RCODE_NXDOMAIN) {
+		debug("DNS server: no such name\n");
+		dns_done(-ENOENT);
+		return;
+	}
+
+	if (flags & DNS_RCODE_MASK) {
+		debug("DNS server error %d\n", flags & DNS_RCODE_MASK);
+		dns_server_failed(server);
+		return;
+	}
+
 	/* We sent 1 query. We want to see more that 1 answer. */
 	if (ntohs(header->nqueries) != 1)
 		return;
 
 	/* Received 0 answers */
 	if (header->nanswers == 0) {
-		dns_state = STATE_DONE;
 		debug("DNS server returned no answers\n");
+		dns_done(-ENOENT);
 		return;
 	}
 
@@ -169,6 +311,7 @@ static void dns_recv(struct header *header, unsigned len)
 		if (type == DNS_CNAME_RECORD) {
 			/* CNAME answer. shift to the next section */
 			debug("Found canonical name\n");
+			ttl = min(ttl, dns_read_ttl(&p[6]));
 			tmp = p[10] | (p[11] << 8);
 			dlen = ntohs(tmp);
 			debug("dlen = %d\n", dlen);
@@ -186,64 +329,132 @@ static void dns_recv(struct header *header, unsigned len)
 
 		tmp = p[10] | (p[11] << 8);
 		dlen = ntohs(tmp);
+		dns_ttl = min(ttl, dns_read_ttl(&p[6]));
 		p += 12;
 		dns_ip = net_read_ip(p);
-		dns_state = STATE_DONE;
+		dns_done(0);
 	}
 }
 
 static void dns_handler(void *ctx, char *packet, unsigned len)
 {
-	(void)ctx;
-	dns_recv((struct header *)net_eth_to_udp_payload(packet),
+	dns_recv(ctx, (struct header *)net_eth_to_udp_payload(packet),
 		net_eth_to_udplen(packet));
 }
 
-IPaddr_t resolv(const char *host)
+static void dns_send_all(const char *name)
 {
-	IPaddr_t ip;
-	const char *ns;
-
-	if (!string_to_ip(host, &ip))
-		return ip;
+	int i;
 
-	dns_ip = 0;
+	for (i = 0; i < dns_num_servers; i++)
+		if (!dns_servers[i].failed)
+			dns_send(dns_servers[i].con, name);
+}
 
-	dns_state = STATE_INIT;
+/*
+ * Ask all nameservers in $net.nameserver (separated by spaces or commas) at
+ * once, the first answer wins.
+ */
+static int dns_query(const char *name)
+{
+	const char *ns;
+	char *list, *s, *tok;
+	uint64_t start, resend;
+	IPaddr_t ip;
+	int i;
 
 	ns = getenv("net.nameserver");
 	if (!ns || !*ns) {
 		printk("%s: no nameserver specified in $net.nameserver\n",
 				__func__);
-		return 0;
+		return -ENOENT;
 	}
 
-	if (string_to_ip(ns, &ip))
-		return 0;
+	dns_num_servers = 0;
 
-	debug("resolving host %s via nameserver %s\n", host, ip_to_string(ip));
+	list = s = xstrdup(ns);
+	while ((tok = strsep(&s, " ,")) && dns_num_servers < DNS_MAX_SERVERS) {
+		struct dns_server *server = &dns_servers[dns_num_servers];
 
-	dns_con = net_udp_new(ip, DNS_PORT, dns_handler, NULL);
-	if (IS_ERR(dns_con))
-		return PTR_ERR(dns_con);
-	dns_timer_start = get_time_ns();
-	dns_send(host);
+		if (string_to_ip(tok, &ip))
+			continue;
+
+		debug("resolving host %s via nameserver %s\n", name,
+				ip_to_string(ip));
+
+		server->con = net_udp_new(ip, DNS_PORT, dns_handler, server);
+		if (IS_ERR(server->con))
+			continue;
+
+		server->failed = 0;
+		dns_num_servers++;
+	}
+	free(list);
+
+	if (!dns_num_servers)
+		return -ENOENT;
+
+	dns_ip = 0;
+	dns_err = -ETIMEDOUT;
+	dns_tid = random32();
+	dns_state = STATE_INIT;
+
+	start = resend = get_time_ns();
+	dns_send_all(name);
 
 	while (dns_state != STATE_DONE) {
 		if (ctrlc()) {
+			dns_err = -EINTR;
 			break;
 		}
 		net_poll();
-		if (is_timeout(dns_timer_start, SECOND)) {
-			dns_timer_start = get_time_ns();
+		if (is_timeout(start, DNS_TIMEOUT))
+			break;
+		if (is_timeout(resend, SECOND)) {
+			resend = get_time_ns();
 			printf("T ");
-			dns_send(host);
+			dns_send_all(name);
 		}
 	}
 
-	net_unregister(dns_con);
+	for (i = 0; i < dns_num_servers; i++)
+		net_unregister(dns_servers[i].con);
+
+	return dns_err;
+}
+
+IPaddr_t resolv(const char *host)
+{
+	struct dns_cache_entry *e;
+	IPaddr_t ip;
+	char *name;
+	int ret;
+
+	if (!string_to_ip(host, &ip))
+		return ip;
+
+	name = dns_fqdn(host);
+
+	e = dns_cache_find(name);
+	if (e) {
+		ip = e->ip;
+		goto out;
+	}
+
+	ret = dns_query(name);
+	if (!ret) {
+		ip = dns_ip;
+		dns_cache_add(name, ip, dns_ttl);
+	} else {
+		ip = 0;
+		/* Timeouts and server failures are not cached */
+		if (ret == -ENOENT && dns_num_servers)
+			dns_cache_add(name, 0, DNS_NEGATIVE_TTL);
+	}
+out:
+	free(name);
 
-	return dns_ip;
+	return ip;
 }
 
 #ifdef CONFIG_CMD_HOST
@@ -273,3 +484,63 @@ BAREBOX_CMD_START(host)
 	BAREBOX_CMD_GROUP(CMD_GRP_NET)
 BAREBOX_CMD_END
 #endif
+
+#ifdef CONFIG_CMD_DNSCACHE
+static void dns_cache_flush(void)
+{
+	struct dns_cache_entry *e;
+
+	for (e = dns_cache; e < dns_cache + DNS_CACHE_SIZE; e++)
+		dns_cache_free(e);
+}
+
+static int do_dnscache(int argc, char *argv[])
+{
+	struct dns_cache_entry *e;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d")) > 0) {
+		switch (opt) {
+		case 'd':
+			dns_cache_flush();
+			return 0;
+		default:
+			return COMMAND_ERROR_USAGE;
+		}
+	}
+
+	printf("%-32s %-16s %s\n", "Name", "Address", "TTL");
+
+	for (e = dns_cache; e < dns_cache + DNS_CACHE_SIZE; e++) {
+		uint64_t age;
+
+		if (!e->name || dns_cache_expired(e))
+			continue;
+
+		age = get_time_ns() - e->updated;
+		do_div(age, SECOND);
+
+		printf("%-32s %-16s %llus\n", e->name,
+				e->ip ? ip_to_string(e->ip) : "-",
+				e->ttl - age);
+	}
+
+	return 0;
+}
+
+BAREBOX_CMD_HELP_START(dnscache)
+BAREBOX_CMD_HELP_TEXT("Show the DNS cache. Names which do not exist are shown")
+BAREBOX_CMD_HELP_TEXT("with address '-'.")
+BAREBOX_CMD_HELP_TEXT("")
+BAREBOX_CMD_HELP_TEXT("Options:")
+BAREBOX_CMD_HELP_OPT ("-d", "flush the cache")
+BAREBOX_CMD_HELP_END
+
+BAREBOX_CMD_START(dnscache)
+	.cmd		= do_dnscache,
+	BAREBOX_CMD_DESC("show or flush the DNS cache")
+	BAREBOX_CMD_OPTS("[-d]")
+	BAREBOX_CMD_GROUP(CMD_GRP_NET)
+	BAREBOX_CMD_HELP(cmd_dnscache_help)
+BAREBOX_CMD_END
+#endif
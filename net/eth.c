@@ -29,9 +29,19 @@
 #include <malloc.h>
 
 static struct eth_device *eth_current;
-static uint64_t last_link_check;
 
-static LIST_HEAD(netdev_list);
+/*
+ * Maximum number of frames taken from a device in one eth_rx() call. Drivers
+ * hand over a single frame per recv call, so eth_rx() calls it until no more
+ * frames arrive to keep the rx ring from overflowing under bulk traffic.
+ */
+#define ETH_RX_BUDGET		32
+
+/* Intervals in which the link state is checked while it is up or down */
+#define ETH_LINK_CHECK_UP	(5 * SECOND)
+#define ETH_LINK_CHECK_DOWN	(100 * MSECOND)
+
+LIST_HEAD(netdev_list);
 
 struct eth_ethaddr {
 	struct list_head list;
@@ -191,7 +201,8 @@ int eth_complete(struct string_list *sl, char *instr)
 #endif
 
 /*
- * Check for link if we haven't done so for longer.
+ * Check for link if we haven't done so for longer. Talking to the phy is slow,
+ * so this is rate limited even while the link is down.
  */
 static int eth_carrier_check(struct eth_device *edev, int force)
 {
@@ -206,12 +217,12 @@ static int eth_carrier_check(struct eth_device *edev, int force)
 	if (force)
 		phy_wait_aneg_done(edev->phydev);
 
-	if (force || is_timeout(last_link_check, 5 * SECOND) ||
-			!edev->phydev->link) {
+	if (force || is_timeout(edev->last_link_check, edev->phydev->link ?
+			ETH_LINK_CHECK_UP : ETH_LINK_CHECK_DOWN)) {
 		ret = phy_update_status(edev->phydev);
 		if (ret)
 			return ret;
-		last_link_check = get_time_ns();
+		edev->last_link_check = get_time_ns();
 	}
 
 	return edev->phydev->link ? 0 : -ENETDOWN;
@@ -228,7 +239,7 @@ static int eth_check_open(struct eth_device *edev)
 	if (edev->active)
 		return 0;
 
-	ret = edev->open(eth_current);
+	ret = edev->open(edev);
 	if (ret)
 		return ret;
 
@@ -256,7 +267,7 @@ int eth_send(struct eth_device *edev, void *packet, int length)
 
 static int __eth_rx(struct eth_device *edev)
 {
-	int ret;
+	int ret, budget, rx_frames;
 
 	ret = eth_check_open(edev);
 	if (ret)
@@ -266,7 +277,22 @@ static int __eth_rx(struct eth_device *edev)
 	if (ret)
 		return ret;
 
-	return edev->recv(edev);
+	for (budget = ETH_RX_BUDGET; budget; budget--) {
+		rx_frames = edev->rx_packets + edev->rx_dropped;
+
+		ret = edev->recv(edev);
+		if (ret < 0)
+			return ret;
+
+		/*
+		 * Neither passed to net_receive() nor dropped as bad, the
+		 * ring is empty
+		 */
+		if (edev->rx_packets + edev->rx_dropped == rx_frames)
+			break;
+	}
+
+	return 0;
 }
 
 int eth_rx(void)
@@ -384,6 +410,12 @@ int eth_register(struct eth_device *edev)
 	dev_add_param_ip(dev, "netmask", NULL, NULL, &edev->netmask, edev);
 	dev_add_param_mac(dev, "ethaddr", eth_param_set_ethaddr, NULL,
 			edev->ethaddr, edev);
+	dev_add_param_int(dev, "rx_packets", NULL, NULL, &edev->rx_packets,
+			"%u", NULL);
+	dev_add_param_int(dev, "rx_dropped", NULL, NULL, &edev->rx_dropped,
+			"%u", NULL);
+	dev_add_param_int(dev, "rx_overruns", NULL, NULL, &edev->rx_overruns,
+			"%u", NULL);
 
 	if (edev->init)
 		edev->init(edev);
@@ -421,6 +453,9 @@ void eth_unregister(struct eth_device *edev)
 	if (edev->active)
 		edev->halt(edev);
 
+	arp_cache_flush(edev);
+	net_route_flush(edev);
+
 	if (IS_ENABLED(CONFIG_OFDEVICE))
 		free(edev->nodepath);
 
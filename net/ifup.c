@@ -97,7 +97,10 @@ int ifup(const char *name, unsigned flags)
 
 	ip = getenv("ip");
 	if (!strcmp(ip, "dhcp")) {
-		ret = run_command("dhcp");
+		char *dhcp_cmd = asprintf("dhcp %s", name);
+
+		ret = run_command(dhcp_cmd);
+		free(dhcp_cmd);
 		if (ret)
 			goto out;
 		ret = eth_set_param(dev, "serverip");
@@ -0,0 +1,190 @@
+/*
+ * ipfrag.c - IPv4 fragment reassembly
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define pr_fmt(fmt) "ipfrag: " fmt
+
+#include <common.h>
+#include <clock.h>
+#include <net.h>
+#include <malloc.h>
+#include <linux/bitmap.h>
+
+/*
+ * Number of datagrams which can be reassembled at the same time. Each of
+ * them takes a buffer of up to 64KiB. When all slots are busy the oldest
+ * datagram is dropped.
+ */
+#define IPFRAG_SLOTS		4
+#define IPFRAG_TIMEOUT		(5 * SECOND)
+
+/* Largest payload of an IP datagram without options */
+#define IPFRAG_MAX_PAYLOAD	(0xffff - sizeof(struct iphdr))
+/* Fragments are counted in units of 8 bytes */
+#define IPFRAG_UNITS		DIV_ROUND_UP(IPFRAG_MAX_PAYLOAD, 8)
+
+struct ipfrag {
+	unsigned char *buf;	/* ethernet frame under construction */
+	uint64_t start;
+	IPaddr_t saddr;
+	uint16_t id;
+	uint8_t protocol;
+	int total;		/* payload length, -1 until the last fragment */
+	int end;		/* highest payload offset received so far */
+	int units;		/* 8 byte units received */
+	DECLARE_BITMAP(map, IPFRAG_UNITS);
+};
+
+static struct ipfrag ipfrags[IPFRAG_SLOTS];
+
+static void ipfrag_drop(struct ipfrag *f)
+{
+	free(f->buf);
+	f->buf = NULL;
+}
+
+static struct ipfrag *ipfrag_find(struct iphdr *ip)
+{
+	struct ipfrag *f, *oldest = NULL;
+	IPaddr_t saddr = net_read_ip(&ip->saddr);
+	int i;
+
+	for (i = 0; i < IPFRAG_SLOTS; i++) {
+		f = &ipfrags[i];
+
+		if (f->buf && is_timeout(f->start, IPFRAG_TIMEOUT)) {
+			pr_debug("timeout on id 0x%04x\n", ntohs(f->id));
+			ipfrag_drop(f);
+		}
+
+		if (f->buf && f->saddr == saddr && f->id == ip->id &&
+		    f->protocol == ip->protocol)
+			return f;
+	}
+
+	for (i = 0; i < IPFRAG_SLOTS; i++) {
+		f = &ipfrags[i];
+		if (!f->buf)
+			break;
+		if (!oldest || f->start < oldest->start)
+			oldest = f;
+		f = NULL;
+	}
+
+	if (!f) {
+		pr_debug("dropping id 0x%04x\n", ntohs(oldest->id));
+		ipfrag_drop(oldest);
+		f = oldest;
+	}
+
+	f->buf = malloc(ETHER_HDR_SIZE + sizeof(struct iphdr) +
+			IPFRAG_MAX_PAYLOAD);
+	if (!f->buf)
+		return NULL;
+
+	f->start = get_time_ns();
+	f->saddr = saddr;
+	f->id = ip->id;
+	f->protocol = ip->protocol;
+	f->total = -1;
+	f->end = 0;
+	f->units = 0;
+	bitmap_zero(f->map, IPFRAG_UNITS);
+
+	return f;
+}
+
+/**
+ * net_ip_defrag - add a fragment to its datagram
+ * @pkt: ethernet frame containing the fragment
+ * @len: length of @pkt, updated to the length of the datagram
+ *
+ * The checksum of the IP header must have been checked already.
+ *
+ * Return: the reassembled datagram as ethernet frame once all of its
+ * fragments are received, NULL otherwise. The caller must free the
+ * returned buffer.
+ */
+unsigned char *net_ip_defrag(unsigned char *pkt, int *len)
+{
+	struct iphdr *ip = (struct iphdr *)(pkt + ETHER_HDR_SIZE);
+	int hlen = (ip->hl_v & 0x0f) * 4;
+	int iplen = ntohs(ip->tot_len);
+	int frag_off = ntohs(ip->frag_off);
+	int offset = (frag_off & IP_OFFSET) * 8;
+	int flen = iplen - hlen;
+	struct ipfrag *f;
+	struct iphdr *dip;
+	unsigned char *buf;
+	int i;
+
+	if (hlen < sizeof(struct iphdr) || flen <= 0 ||
+	    ETHER_HDR_SIZE + iplen > *len)
+		return NULL;
+
+	if (offset + flen > IPFRAG_MAX_PAYLOAD)
+		return NULL;
+
+	/* All but the last fragment carry a multiple of 8 bytes */
+	if ((frag_off & IP_MF) && (flen & 7))
+		return NULL;
+
+	f = ipfrag_find(ip);
+	if (!f)
+		return NULL;
+
+	if (!(frag_off & IP_MF)) {
+		if (f->total >= 0 && f->total != offset + flen)
+			goto invalid;
+		f->total = offset + flen;
+	}
+
+	f->end = max(f->end, offset + flen);
+	if (f->total >= 0 && f->end > f->total)
+		goto invalid;
+
+	/* The headers are taken from the first fragment, options are dropped */
+	if (!offset)
+		memcpy(f->buf, pkt, ETHER_HDR_SIZE + sizeof(struct iphdr));
+
+	memcpy(f->buf + ETHER_HDR_SIZE + sizeof(struct iphdr) + offset,
+			(unsigned char *)ip + hlen, flen);
+
+	for (i = offset / 8; i < DIV_ROUND_UP(offset + flen, 8); i++)
+		if (!test_and_set_bit(i, f->map))
+			f->units++;
+
+	if (f->total < 0 || f->units != DIV_ROUND_UP(f->total, 8))
+		return NULL;
+
+	buf = f->buf;
+	f->buf = NULL;
+
+	dip = (struct iphdr *)(buf + ETHER_HDR_SIZE);
+	dip->hl_v = 0x45;
+	dip->tot_len = htons(sizeof(struct iphdr) + f->total);
+	dip->frag_off = 0;
+	dip->check = 0;
+	dip->check = ~net_checksum((unsigned char *)dip, sizeof(struct iphdr));
+
+	*len = ETHER_HDR_SIZE + sizeof(struct iphdr) + f->total;
+
+	pr_debug("reassembled id 0x%04x, %d bytes\n", ntohs(f->id), f->total);
+
+	return buf;
+
+invalid:
+	pr_debug("inconsistent fragments for id 0x%04x\n", ntohs(f->id));
+	ipfrag_drop(f);
+
+	return NULL;
+}
@@ -44,22 +44,75 @@ int net_checksum_ok(unsigned char *ptr, int len)
 	return net_checksum(ptr, len) == 0xffff;
 }
 
+/*
+ * Internet checksum (RFC 1071), not complemented. The data is summed up 32
+ * bits at a time in memory order, which gives the same result on little and
+ * big endian machines. When the buffer starts at an odd address the sum over
+ * the aligned words is byte swapped.
+ */
 uint16_t net_checksum(unsigned char *ptr, int len)
 {
-	uint32_t xsum = 0;
-	uint16_t *p = (uint16_t *)ptr;
+	uint64_t sum = 0;
+	uint32_t *p;
+	uint16_t w;
+	int odd = (unsigned long)ptr & 1;
 
-	if (len & 1)
-		ptr[len] = 0;
+	if (len <= 0)
+		return 0;
 
-	len = (len + 1) >> 1;
+	if (odd) {
+		w = 0;
+		memcpy((unsigned char *)&w + 1, ptr, 1);
+		sum += w;
+		ptr++;
+		len--;
+	}
 
-	while (len-- > 0)
-		xsum += *p++;
+	if (((unsigned long)ptr & 2) && len >= 2) {
+		sum += *(uint16_t *)ptr;
+		ptr += 2;
+		len -= 2;
+	}
 
-	xsum = (xsum & 0xffff) + (xsum >> 16);
-	xsum = (xsum & 0xffff) + (xsum >> 16);
-	return xsum & 0xffff;
+	p = (uint32_t *)ptr;
+
+	while (len >= 16) {
+		sum += p[0];
+		sum += p[1];
+		sum += p[2];
+		sum += p[3];
+		p += 4;
+		len -= 16;
+	}
+
+	while (len >= 4) {
+		sum += *p++;
+		len -= 4;
+	}
+
+	ptr = (unsigned char *)p;
+
+	if (len >= 2) {
+		sum += *(uint16_t *)ptr;
+		ptr += 2;
+		len -= 2;
+	}
+
+	if (len) {
+		w = 0;
+		memcpy(&w, ptr, 1);
+		sum += w;
+	}
+
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+
+	if (odd)
+		sum = ((sum & 0xff) << 8) | (sum >> 8);
+
+	return sum;
 }
 
 IPaddr_t getenv_ip(const char *name)
@@ -89,19 +142,22 @@ int setenv_ip(const char *name, IPaddr_t ip)
 
 static unsigned char *arp_ether;
 static IPaddr_t arp_wait_ip;
+static struct eth_device *arp_wait_edev;
 
-static void arp_handler(struct arprequest *arp)
+static void arp_handler(struct eth_device *edev, struct arprequest *arp)
 {
 	IPaddr_t tmp;
 
+	tmp = net_read_ip(&arp->ar_data[6]);
+
+	arp_cache_update(edev, tmp, &arp->ar_data[0]);
+
 	/* are we waiting for a reply */
 	if (!arp_wait_ip)
 		return;
 
-	tmp = net_read_ip(&arp->ar_data[6]);
-
 	/* matched waiting packet's address */
-	if (tmp == arp_wait_ip) {
+	if (tmp == arp_wait_ip && edev == arp_wait_edev) {
 		/* save address for later use */
 		memcpy(arp_ether, &arp->ar_data[0], 6);
 
@@ -110,9 +166,9 @@ static void arp_handler(struct arprequest *arp)
 	}
 }
 
-static int arp_request(IPaddr_t dest, unsigned char *ether)
+static int arp_request(struct eth_device *edev, IPaddr_t nexthop,
+		unsigned char *ether)
 {
-	struct eth_device *edev = eth_get_current();
 	char *pkt;
 	struct arprequest *arp;
 	uint64_t arp_start;
@@ -121,6 +177,9 @@ static int arp_request(IPaddr_t dest, unsigned char *ether)
 	unsigned retries = 0;
 	int ret;
 
+	if (!arp_cache_lookup(edev, nexthop, ether))
+		return 0;
+
 	if (!arp_packet) {
 		arp_packet = net_alloc_packet();
 		if (!arp_packet)
@@ -130,8 +189,6 @@ static int arp_request(IPaddr_t dest, unsigned char *ether)
 	pkt = arp_packet;
 	et = (struct ethernet *)arp_packet;
 
-	arp_wait_ip = dest;
-
 	pr_debug("ARP broadcast\n");
 
 	memset(et->et_dest, 0xff, 6);
@@ -150,14 +207,8 @@ static int arp_request(IPaddr_t dest, unsigned char *ether)
 	net_write_ip(arp->ar_data + 6, edev->ipaddr);	/* source IP addr	*/
 	memset(arp->ar_data + 10, 0, 6);	/* dest ET addr = 0     */
 
-	if ((dest & edev->netmask) != (edev->ipaddr & edev->netmask)) {
-		if (!edev->gateway)
-			arp_wait_ip = dest;
-		else
-			arp_wait_ip = edev->gateway;
-	} else {
-		arp_wait_ip = dest;
-	}
+	arp_wait_ip = nexthop;
+	arp_wait_edev = edev;
 
 	net_write_ip(arp->ar_data + 16, arp_wait_ip);
 
@@ -181,8 +232,10 @@ static int arp_request(IPaddr_t dest, unsigned char *ether)
 			retries++;
 		}
 
-		if (retries > PKT_NUM_RETRIES)
+		if (retries > PKT_NUM_RETRIES) {
+			arp_wait_ip = 0;
 			return -ETIMEDOUT;
+		}
 
 		net_poll();
 	}
@@ -255,13 +308,24 @@ void net_set_gateway(IPaddr_t gw)
 
 static LIST_HEAD(connection_list);
 
-static struct net_connection *net_new(IPaddr_t dest, rx_handler_f *handler,
-		void *ctx)
+/*
+ * Create a connection to dest. Without edev the device is chosen by the
+ * routing table, see net_route().
+ */
+static struct net_connection *net_new(struct eth_device *edev, IPaddr_t dest,
+		rx_handler_f *handler, void *ctx)
 {
-	struct eth_device *edev = eth_get_current();
 	struct net_connection *con;
+	IPaddr_t nexthop = dest;
 	int ret;
 
+	if (!edev) {
+		edev = net_route(dest, &nexthop);
+	} else if (dest != 0xffffffff && edev->gateway &&
+		   ((dest ^ edev->ipaddr) & edev->netmask)) {
+		nexthop = edev->gateway;
+	}
+
 	if (!edev)
 		return ERR_PTR(-ENETDOWN);
 
@@ -286,13 +350,14 @@ static struct net_connection *net_new(IPaddr_t dest, rx_handler_f *handler,
 	con->et = (struct ethernet *)con->packet;
 	con->ip = (struct iphdr *)(con->packet + ETHER_HDR_SIZE);
 	con->udp = (struct udphdr *)(con->packet + ETHER_HDR_SIZE + sizeof(struct iphdr));
+	con->tcp = (struct tcphdr *)(con->packet + ETHER_HDR_SIZE + sizeof(struct iphdr));
 	con->icmp = (struct icmphdr *)(con->packet + ETHER_HDR_SIZE + sizeof(struct iphdr));
 	con->handler = handler;
 
 	if (dest == 0xffffffff) {
 		memset(con->et->et_dest, 0xff, 6);
 	} else {
-		ret = arp_request(dest, con->et->et_dest);
+		ret = arp_request(edev, nexthop, con->et->et_dest);
 		if (ret)
 			goto out;
 	}
@@ -302,7 +367,7 @@ static struct net_connection *net_new(IPaddr_t dest, rx_handler_f *handler,
 
 	con->ip->hl_v = 0x45;
 	con->ip->tos = 0;
-	con->ip->frag_off = htons(0x4000);	/* No fragmentation */;
+	con->ip->frag_off = htons(IP_DF);	/* No fragmentation */;
 	con->ip->ttl = 255;
 	net_copy_ip(&con->ip->daddr, &dest);
 	net_copy_ip(&con->ip->saddr, &edev->ipaddr);
@@ -316,10 +381,10 @@ out:
 	return ERR_PTR(ret);
 }
 
-struct net_connection *net_udp_new(IPaddr_t dest, uint16_t dport,
-		rx_handler_f *handler, void *ctx)
+struct net_connection *net_udp_eth_new(struct eth_device *edev, IPaddr_t dest,
+		uint16_t dport, rx_handler_f *handler, void *ctx)
 {
-	struct net_connection *con = net_new(dest, handler, ctx);
+	struct net_connection *con = net_new(edev, dest, handler, ctx);
 
 	if (IS_ERR(con))
 		return con;
@@ -332,10 +397,32 @@ struct net_connection *net_udp_new(IPaddr_t dest, uint16_t dport,
 	return con;
 }
 
+struct net_connection *net_udp_new(IPaddr_t dest, uint16_t dport,
+		rx_handler_f *handler, void *ctx)
+{
+	return net_udp_eth_new(NULL, dest, dport, handler, ctx);
+}
+
+struct net_connection *net_tcp_new(IPaddr_t dest, uint16_t dport,
+		rx_handler_f *handler, void *ctx)
+{
+	struct net_connection *con = net_new(NULL, dest, handler, ctx);
+
+	if (IS_ERR(con))
+		return con;
+
+	con->proto = IPPROTO_TCP;
+	con->tcp->th_dport = htons(dport);
+	con->tcp->th_sport = htons(net_udp_new_localport());
+	con->ip->protocol = IPPROTO_TCP;
+
+	return con;
+}
+
 struct net_connection *net_icmp_new(IPaddr_t dest, rx_handler_f *handler,
 		void *ctx)
 {
-	struct net_connection *con = net_new(dest, handler, ctx);
+	struct net_connection *con = net_new(NULL, dest, handler, ctx);
 
 	if (IS_ERR(con))
 		return con;
@@ -363,14 +450,50 @@ static int net_ip_send(struct net_connection *con, int len)
 	return eth_send(con->edev, con->packet, ETHER_HDR_SIZE + sizeof(struct iphdr) + len);
 }
 
+/*
+ * Checksum over the UDP or TCP data following ip and the pseudo header,
+ * not yet complemented.
+ */
+static uint16_t net_ip_proto_checksum(struct iphdr *ip, int len)
+{
+	uint32_t xsum;
+
+	xsum = net_checksum((unsigned char *)(ip + 1), len);
+	xsum += (ip->saddr & 0xffff) + (ip->saddr >> 16);
+	xsum += (ip->daddr & 0xffff) + (ip->daddr >> 16);
+	xsum += htons(ip->protocol) + htons(len);
+
+	xsum = (xsum & 0xffff) + (xsum >> 16);
+	xsum = (xsum & 0xffff) + (xsum >> 16);
+	return xsum;
+}
+
 int net_udp_send(struct net_connection *con, int len)
 {
+	uint16_t sum;
+
 	con->udp->uh_ulen = htons(len + 8);
 	con->udp->uh_sum = 0;
 
+	if (!(con->edev->features & ETH_FEATURE_TX_CSUM)) {
+		sum = ~net_ip_proto_checksum(con->ip, sizeof(struct udphdr) + len);
+		/* 0 means no checksum, send it as 0xffff */
+		con->udp->uh_sum = sum ? sum : 0xffff;
+	}
+
 	return net_ip_send(con, sizeof(struct udphdr) + len);
 }
 
+int net_tcp_send(struct net_connection *con, int len)
+{
+	con->tcp->th_sum = 0;
+
+	if (!(con->edev->features & ETH_FEATURE_TX_CSUM))
+		con->tcp->th_sum = ~net_ip_proto_checksum(con->ip, len);
+
+	return net_ip_send(con, len);
+}
+
 int net_icmp_send(struct net_connection *con, int len)
 {
 	con->icmp->checksum = ~net_checksum((unsigned char *)con->icmp,
@@ -379,11 +502,10 @@ int net_icmp_send(struct net_connection *con, int len)
 	return net_ip_send(con, sizeof(struct icmphdr) + len);
 }
 
-static int net_answer_arp(unsigned char *pkt, int len)
+static int net_answer_arp(struct eth_device *edev, unsigned char *pkt, int len)
 {
 	struct arprequest *arp = (struct arprequest *)(pkt + ETHER_HDR_SIZE);
 	struct ethernet *et = (struct ethernet *)pkt;
-	struct eth_device *edev = eth_get_current();
 	unsigned char *packet;
 	int ret;
 
@@ -453,9 +575,12 @@ static int net_handle_arp(struct eth_device *edev, unsigned char *pkt, int len)
 
 	switch (ntohs(arp->ar_op)) {
 	case ARPOP_REQUEST:
-		return net_answer_arp(pkt, len);
+		/* the sender is going to talk to us, remember it */
+		arp_cache_update(edev, net_read_ip(&arp->ar_data[6]),
+				&arp->ar_data[0]);
+		return net_answer_arp(edev, pkt, len);
 	case ARPOP_REPLY:
-		arp_handler(arp);
+		arp_handler(edev, arp);
 		return 1;
 	default:
 		pr_debug("Unexpected ARP opcode 0x%x\n", ntohs(arp->ar_op));
@@ -469,14 +594,27 @@ bad:
 	return -EINVAL;
 }
 
-static int net_handle_udp(unsigned char *pkt, int len)
+static int net_handle_udp(unsigned char *pkt, int len, int csum_ok)
 {
 	struct iphdr *ip = (struct iphdr *)(pkt + ETHER_HDR_SIZE);
 	struct net_connection *con;
 	struct udphdr *udp;
-	int port;
+	int port, ulen;
 
 	udp = (struct udphdr *)(ip + 1);
+	ulen = ntohs(udp->uh_ulen);
+
+	if (ulen < sizeof(struct udphdr) ||
+	    ulen > ntohs(ip->tot_len) - sizeof(struct iphdr))
+		return -EINVAL;
+
+	/* A checksum of 0 means the sender did not compute one */
+	if (!csum_ok && udp->uh_sum &&
+	    net_ip_proto_checksum(ip, ulen) != 0xffff) {
+		debug("%s: bad checksum\n", __func__);
+		return -EINVAL;
+	}
+
 	port = ntohs(udp->uh_dport);
 	list_for_each_entry(con, &connection_list, list) {
 		if (con->proto == IPPROTO_UDP && port == ntohs(con->udp->uh_sport)) {
@@ -487,6 +625,32 @@ static int net_handle_udp(unsigned char *pkt, int len)
 	return -EINVAL;
 }
 
+static int net_handle_tcp(unsigned char *pkt, int len, int csum_ok)
+{
+	struct iphdr *ip = (struct iphdr *)(pkt + ETHER_HDR_SIZE);
+	struct tcphdr *tcp = (struct tcphdr *)(ip + 1);
+	struct net_connection *con;
+	int tcplen = ntohs(ip->tot_len) - sizeof(struct iphdr);
+
+	if (tcplen < (int)sizeof(struct tcphdr) ||
+	    ETHER_HDR_SIZE + sizeof(struct iphdr) + tcplen > len)
+		return -EINVAL;
+
+	if (!csum_ok && net_ip_proto_checksum(ip, tcplen) != 0xffff)
+		return -EINVAL;
+
+	list_for_each_entry(con, &connection_list, list) {
+		if (con->proto == IPPROTO_TCP &&
+		    tcp->th_dport == con->tcp->th_sport &&
+		    tcp->th_sport == con->tcp->th_dport &&
+		    net_read_ip(&ip->saddr) == net_read_ip(&con->ip->daddr)) {
+			con->handler(con->priv, pkt, len);
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
 static int net_handle_icmp(unsigned char *pkt, int len)
 {
 	struct net_connection *con;
@@ -502,6 +666,106 @@ static int net_handle_icmp(unsigned char *pkt, int len)
 	return 0;
 }
 
+/*
+ * csum_ok is set when the hardware has already verified the UDP or TCP
+ * checksum of the packet.
+ */
+static int net_handle_ip_proto(unsigned char *pkt, int len, int csum_ok)
+{
+	struct iphdr *ip = (struct iphdr *)(pkt + ETHER_HDR_SIZE);
+
+	switch (ip->protocol) {
+	case IPPROTO_ICMP:
+		return net_handle_icmp(pkt, len);
+	case IPPROTO_UDP:
+		return net_handle_udp(pkt, len, csum_ok);
+	case IPPROTO_TCP:
+		if (IS_ENABLED(CONFIG_NET_TCP))
+			return net_handle_tcp(pkt, len, csum_ok);
+		break;
+	}
+
+	return 0;
+}
+
+/* The buffer of the packet currently passed up the stack */
+static struct net_buf *net_rx_current;
+
+static void net_buf_free(struct net_buf *nb)
+{
+	free(nb);
+}
+
+/**
+ * net_buf_alloc - allocate a buffer with its release function
+ * @size: size of the data area
+ *
+ * The buffer is freed when the last reference is dropped.
+ */
+struct net_buf *net_buf_alloc(unsigned int size)
+{
+	struct net_buf *nb;
+	size_t hdr = ALIGN(sizeof(*nb), 32);
+
+	nb = xmemalign(32, hdr + size);
+	memset(nb, 0, sizeof(*nb));
+	nb->data = (unsigned char *)nb + hdr;
+	nb->tail = size;
+	nb->refcount = 1;
+	nb->release = net_buf_free;
+
+	return nb;
+}
+
+struct net_buf *net_buf_get(struct net_buf *nb)
+{
+	nb->refcount++;
+
+	return nb;
+}
+
+void net_buf_put(struct net_buf *nb)
+{
+	if (--nb->refcount)
+		return;
+
+	if (nb->release)
+		nb->release(nb);
+}
+
+/**
+ * net_rx_buf_get - keep a part of the packet currently being handled
+ * @data: start of the part in the packet
+ * @len: length of the part
+ *
+ * To be called from an rx_handler. Returns a reference to a buffer holding
+ * the part between head and tail. This is the receive buffer itself when the
+ * driver handed it over with net_receive_buf(), a copy otherwise.
+ */
+struct net_buf *net_rx_buf_get(void *data, unsigned int len)
+{
+	struct net_buf *nb = net_rx_current;
+	unsigned char *p = data;
+
+	if (nb && nb->release && !net_buf_shared(nb) &&
+	    p >= nb->data && p + len <= nb->data + nb->tail) {
+		nb->head = p - nb->data;
+		nb->tail = nb->head + len;
+		return net_buf_get(nb);
+	}
+
+	nb = net_buf_alloc(len);
+	memcpy(nb->data, data, len);
+
+	return nb;
+}
+
+static void net_buf_free_dgram(struct net_buf *nb)
+{
+	free(nb->data);
+	free(nb);
+}
+
 static int net_handle_ip(struct eth_device *edev, unsigned char *pkt, int len)
 {
 	struct iphdr *ip = (struct iphdr *)(pkt + ETHER_HDR_SIZE);
@@ -518,29 +782,60 @@ static int net_handle_ip(struct eth_device *edev, unsigned char *pkt, int len)
 	if ((ip->hl_v & 0xf0) != 0x40)
 		goto bad;
 
-	if (ip->frag_off & htons(0x1fff)) /* Can't deal w/ fragments */
-		goto bad;
-	if (!net_checksum_ok((unsigned char *)ip, sizeof(struct iphdr)))
+	if (!(edev->features & ETH_FEATURE_RX_CSUM) &&
+	    !net_checksum_ok((unsigned char *)ip, sizeof(struct iphdr)))
 		goto bad;
 
 	tmp = net_read_ip(&ip->daddr);
 	if (edev->ipaddr && tmp != edev->ipaddr && tmp != 0xffffffff)
 		return 0;
 
-	switch (ip->protocol) {
-	case IPPROTO_ICMP:
-		return net_handle_icmp(pkt, len);
-	case IPPROTO_UDP:
-		return net_handle_udp(pkt, len);
+	/* learn the hardware address of hosts on our network talking to us */
+	if (edev->ipaddr && tmp == edev->ipaddr) {
+		struct ethernet *et = (struct ethernet *)pkt;
+		IPaddr_t saddr = net_read_ip(&ip->saddr);
+
+		if ((saddr & edev->netmask) == (edev->ipaddr & edev->netmask))
+			arp_cache_update(edev, saddr, et->et_src);
 	}
 
-	return 0;
+	if (ip->frag_off & htons(IP_MF | IP_OFFSET)) {
+		struct net_buf *nb, *prev = net_rx_current;
+		unsigned char *dgram;
+		int ret;
+
+		if (!IS_ENABLED(CONFIG_NET_IP_FRAGMENTS))
+			goto bad; /* Can't deal w/ fragments */
+
+		dgram = net_ip_defrag(pkt, &len);
+		if (!dgram)
+			return 0;
+
+		/* let handlers keep the reassembled datagram without a copy */
+		nb = xzalloc(sizeof(*nb));
+		nb->data = dgram;
+		nb->tail = len;
+		nb->refcount = 1;
+		nb->release = net_buf_free_dgram;
+
+		net_rx_current = nb;
+		/* hardware does not check the payload of fragments */
+		ret = net_handle_ip_proto(dgram, len, 0);
+		net_rx_current = prev;
+
+		net_buf_put(nb);
+
+		return ret;
+	}
+
+	return net_handle_ip_proto(pkt, len,
+			edev->features & ETH_FEATURE_RX_CSUM);
 bad:
 	net_bad_packet(pkt, len);
 	return 0;
 }
 
-int net_receive(struct eth_device *edev, unsigned char *pkt, int len)
+static int __net_receive(struct eth_device *edev, unsigned char *pkt, int len)
 {
 	struct ethernet *et = (struct ethernet *)pkt;
 	int et_protlen = ntohs(et->et_protlen);
@@ -548,6 +843,8 @@ int net_receive(struct eth_device *edev, unsigned char *pkt, int len)
 
 	led_trigger_network(LED_TRIGGER_NET_RX);
 
+	edev->rx_packets++;
+
 	if (len < ETHER_HDR_SIZE) {
 		ret = 0;
 		goto out;
@@ -569,6 +866,30 @@ out:
 	return ret;
 }
 
+int net_receive_buf(struct eth_device *edev, struct net_buf *nb)
+{
+	struct net_buf *prev = net_rx_current;
+	int ret;
+
+	net_rx_current = nb;
+	ret = __net_receive(edev, net_buf_payload(nb), net_buf_len(nb));
+	net_rx_current = prev;
+
+	return ret;
+}
+
+int net_receive(struct eth_device *edev, unsigned char *pkt, int len)
+{
+	struct net_buf nb = {
+		.data = pkt,
+		.tail = len,
+		.refcount = 1,
+	};
+
+	/* without a release function handlers get a copy of the data */
+	return net_receive_buf(edev, &nb);
+}
+
 static struct device_d net_device = {
 	.name = "net",
 	.id = DEVICE_ID_SINGLE,
@@ -0,0 +1,285 @@
+/*
+ * route.c - select the network device for a destination
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#define pr_fmt(fmt) "route: " fmt
+
+#include <common.h>
+#include <command.h>
+#include <complete.h>
+#include <getopt.h>
+#include <net.h>
+#include <linux/phy.h>
+
+/*
+ * A destination is reached through the device with the most specific
+ * matching network, either a static route or the network a device is
+ * configured for. Static routes win over device networks of the same size.
+ * Everything else goes to the gateway of a device which has one. When
+ * several devices qualify the one with the fastest link is used, then the
+ * current device, then the first one.
+ */
+struct net_route {
+	IPaddr_t net;
+	IPaddr_t netmask;
+	IPaddr_t gateway;	/* 0 if the network is directly connected */
+	struct eth_device *edev;
+	struct list_head list;
+};
+
+static LIST_HEAD(route_list);
+
+/* The link speed in Mbit/s, 0 if the device has no phy or the link is down */
+static int net_route_speed(struct eth_device *edev)
+{
+	if (!edev->phydev || !edev->phydev->link)
+		return 0;
+
+	return edev->phydev->speed;
+}
+
+/* Whether @edev is to be used instead of @best for the same destination */
+static int net_route_prefer(struct eth_device *edev, struct eth_device *best,
+		struct eth_device *cur)
+{
+	int speed = net_route_speed(edev), best_speed = net_route_speed(best);
+
+	if (speed != best_speed)
+		return speed > best_speed;
+
+	return edev == cur;
+}
+
+/**
+ * net_route - find the device and next hop for a destination
+ * @dest: the destination address
+ * @nexthop: returns the address to send the packets to
+ *
+ * Return: the device to use, NULL if there is none
+ */
+struct eth_device *net_route(IPaddr_t dest, IPaddr_t *nexthop)
+{
+	struct eth_device *edev, *cur = eth_get_current(), *best = NULL;
+	struct net_route *r;
+	IPaddr_t gateway = 0;
+	u32 mask, best_mask = 0;
+
+	if (dest == 0xffffffff)
+		goto out_current;
+
+	for_each_netdev(edev) {
+		if (!edev->ipaddr || ((dest ^ edev->ipaddr) & edev->netmask))
+			continue;
+
+		mask = ntohl(edev->netmask);
+		if (best && (mask < best_mask || (mask == best_mask &&
+				!net_route_prefer(edev, best, cur))))
+			continue;
+
+		best = edev;
+		best_mask = mask;
+	}
+
+	list_for_each_entry(r, &route_list, list) {
+		if ((dest & r->netmask) != r->net)
+			continue;
+
+		mask = ntohl(r->netmask);
+		if (best && mask < best_mask)
+			continue;
+
+		best = r->edev;
+		best_mask = mask;
+		gateway = r->gateway;
+	}
+
+	if (best)
+		goto out;
+
+	for_each_netdev(edev) {
+		if (!edev->ipaddr || !edev->gateway)
+			continue;
+
+		if (best && !net_route_prefer(edev, best, cur))
+			continue;
+
+		best = edev;
+	}
+
+	if (best) {
+		gateway = best->gateway;
+		goto out;
+	}
+
+out_current:
+	best = cur;
+out:
+	*nexthop = gateway ? gateway : dest;
+
+	return best;
+}
+
+/**
+ * net_route_add - add a static route
+ * @net: the destination network
+ * @netmask: netmask of the destination network
+ * @gateway: the gateway to use, 0 for a directly connected network
+ * @edev: the device to use
+ *
+ * A route to the same network replaces the existing one.
+ */
+int net_route_add(IPaddr_t net, IPaddr_t netmask, IPaddr_t gateway,
+		struct eth_device *edev)
+{
+	struct net_route *r;
+
+	if (net & ~netmask)
+		return -EINVAL;
+
+	net_route_del(net, netmask);
+
+	r = xzalloc(sizeof(*r));
+	r->net = net;
+	r->netmask = netmask;
+	r->gateway = gateway;
+	r->edev = edev;
+	list_add_tail(&r->list, &route_list);
+
+	return 0;
+}
+
+int net_route_del(IPaddr_t net, IPaddr_t netmask)
+{
+	struct net_route *r;
+
+	list_for_each_entry(r, &route_list, list) {
+		if (r->net == net && r->netmask == netmask) {
+			list_del(&r->list);
+			free(r);
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+/**
+ * net_route_flush - remove static routes
+ * @edev: the device to remove the routes for, NULL for all routes
+ */
+void net_route_flush(struct eth_device *edev)
+{
+	struct net_route *r, *tmp;
+
+	list_for_each_entry_safe(r, tmp, &route_list, list) {
+		if (!edev || r->edev == edev) {
+			list_del(&r->list);
+			free(r);
+		}
+	}
+}
+
+#ifdef CONFIG_CMD_ROUTE
+static void route_print(IPaddr_t net, IPaddr_t netmask, IPaddr_t gateway,
+		struct eth_device *edev)
+{
+	printf("%-16s", ip_to_string(net));
+	printf("%-16s", ip_to_string(netmask));
+	printf("%-16s%s\n", ip_to_string(gateway), dev_name(&edev->dev));
+}
+
+static int do_route(int argc, char *argv[])
+{
+	struct eth_device *edev;
+	struct net_route *r;
+	IPaddr_t net, netmask, gateway;
+	int opt, del = 0;
+
+	while ((opt = getopt(argc, argv, "d")) > 0) {
+		switch (opt) {
+		case 'd':
+			del = 1;
+			break;
+		default:
+			return COMMAND_ERROR_USAGE;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (!argc) {
+		printf("%-16s%-16s%-16s%s\n", "Destination", "Netmask",
+				"Gateway", "Iface");
+
+		list_for_each_entry(r, &route_list, list)
+			route_print(r->net, r->netmask, r->gateway, r->edev);
+
+		for_each_netdev(edev) {
+			if (!edev->ipaddr)
+				continue;
+			route_print(edev->ipaddr & edev->netmask, edev->netmask,
+					0, edev);
+			if (edev->gateway)
+				route_print(0, 0, edev->gateway, edev);
+		}
+
+		return 0;
+	}
+
+	if (argc < 2 || string_to_ip(argv[0], &net) ||
+	    string_to_ip(argv[1], &netmask))
+		return COMMAND_ERROR_USAGE;
+
+	if (del) {
+		if (net_route_del(net, netmask)) {
+			printf("no such route\n");
+			return 1;
+		}
+		return 0;
+	}
+
+	if (argc != 4 || string_to_ip(argv[2], &gateway))
+		return COMMAND_ERROR_USAGE;
+
+	edev = eth_get_byname(argv[3]);
+	if (!edev) {
+		printf("no such device: %s\n", argv[3]);
+		return 1;
+	}
+
+	if (net_route_add(net, netmask, gateway, edev)) {
+		printf("network %s does not match the netmask\n", argv[0]);
+		return 1;
+	}
+
+	return 0;
+}
+
+BAREBOX_CMD_HELP_START(route)
+BAREBOX_CMD_HELP_TEXT("Without arguments show the routing table, including the networks")
+BAREBOX_CMD_HELP_TEXT("and gateways of the network devices. Otherwise add a static route")
+BAREBOX_CMD_HELP_TEXT("to NETWORK through DEVICE. Use GATEWAY 0.0.0.0 for directly")
+BAREBOX_CMD_HELP_TEXT("connected networks.")
+BAREBOX_CMD_HELP_TEXT("")
+BAREBOX_CMD_HELP_TEXT("Options:")
+BAREBOX_CMD_HELP_OPT ("-d", "delete the route to NETWORK")
+BAREBOX_CMD_HELP_END
+
+BAREBOX_CMD_START(route)
+	.cmd		= do_route,
+	BAREBOX_CMD_DESC("show or change the routing table")
+	BAREBOX_CMD_OPTS("[-d] [NETWORK NETMASK [GATEWAY DEVICE]]")
+	BAREBOX_CMD_GROUP(CMD_GRP_NET)
+	BAREBOX_CMD_HELP(cmd_route_help)
+BAREBOX_CMD_END
+#endif
@@ -0,0 +1,764 @@
+/*
+ * tcp.c - minimal TCP client
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Only active opens are supported, which is all a client for protocols
+ * like HTTP needs. The receive side advertises a window of up to 64KiB,
+ * out of order segments are queued and reported to the peer with SACK
+ * (RFC 2018), so that a lost segment costs a single retransmission. The
+ * send side does slow start and congestion avoidance (RFC 5681), fast
+ * retransmit and exponential retransmission backoff, but does not act
+ * on SACK blocks from the peer. Window scaling is not implemented.
+ *
+ * There is no background processing: received segments and timers are
+ * handled while one of tcp_connect(), tcp_write(), tcp_read() or
+ * tcp_close() waits for the network.
+ */
+#define pr_fmt(fmt) "tcp: " fmt
+
+#include <common.h>
+#include <clock.h>
+#include <net.h>
+#include <malloc.h>
+#include <kfifo.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <linux/err.h>
+#include <linux/sizes.h>
+#include <linux/list.h>
+
+#define TCP_MSS			1460
+#define TCP_RX_BUF		SZ_64K
+#define TCP_TX_BUF		SZ_4K
+#define TCP_INIT_CWND		10		/* segments, RFC 6928 */
+#define TCP_RTO_INIT		(1 * SECOND)
+#define TCP_RTO_MAX		(8 * SECOND)
+#define TCP_RETRIES		6
+#define TCP_TIMEOUT		(30 * SECOND)	/* without any progress */
+#define TCP_CLOSE_TIMEOUT	(1 * SECOND)
+#define TCP_OOO_MAX		32		/* queued out of order segments */
+#define TCP_SACK_BLOCKS		3
+
+#define TCPOPT_NOP		1
+#define TCPOPT_MSS		2
+#define TCPOPT_SACK_PERM	4
+#define TCPOPT_SACK		5
+
+enum tcp_state {
+	TCP_SYN_SENT,
+	TCP_ESTABLISHED,
+	TCP_CLOSED,
+};
+
+struct tcp_segment {
+	struct list_head list;
+	uint32_t seq;
+	unsigned int len;
+	bool fin;
+	unsigned char data[];
+};
+
+struct tcp_connection {
+	struct net_connection *con;
+	enum tcp_state state;
+	int err;
+
+	/* send side */
+	uint32_t snd_una;	/* oldest unacknowledged sequence number */
+	uint32_t snd_nxt;	/* next sequence number to send */
+	uint32_t snd_wnd;	/* window advertised by the peer */
+	unsigned int mss;
+	unsigned int cwnd;
+	unsigned int ssthresh;
+	int dupacks;
+	unsigned char *txbuf;	/* data from snd_una on */
+	unsigned int txlen;
+	bool fin_sent;
+	bool fin_acked;
+
+	/* receive side */
+	uint32_t rcv_nxt;	/* next sequence number expected */
+	uint32_t rcv_adv;	/* right edge of the advertised window */
+	struct kfifo *rx;
+	int unacked;		/* segments received but not acknowledged */
+	bool fin_rcvd;
+	bool sack_ok;		/* peer accepts SACK options */
+	struct list_head ooo;	/* out of order segments, sorted */
+	int ooo_cnt;
+	uint32_t ooo_last;	/* start of the latest out of order segment */
+
+	/* timers */
+	uint64_t rto_start;
+	uint64_t rto;
+	int retries;
+	uint64_t progress;
+};
+
+#define seq_lt(a, b)	((int32_t)((a) - (b)) < 0)
+
+static unsigned int tcp_window(struct tcp_connection *t)
+{
+	return min(t->rx->size - kfifo_len(t->rx), 0xffffU);
+}
+
+/*
+ * Add SACK blocks for the out of order queue, the block with the latest
+ * segment goes first. Returns the length of the option.
+ */
+static int tcp_sack_option(struct tcp_connection *t, unsigned char *opt)
+{
+	struct tcp_segment *s;
+	uint32_t start[TCP_OOO_MAX], end[TCP_OOO_MAX];
+	int i, n = 0, first = 0, len;
+	__be32 *p;
+
+	list_for_each_entry(s, &t->ooo, list) {
+		if (n && !seq_lt(end[n - 1], s->seq)) {
+			if (seq_lt(end[n - 1], s->seq + s->len))
+				end[n - 1] = s->seq + s->len;
+		} else {
+			start[n] = s->seq;
+			end[n] = s->seq + s->len;
+			n++;
+		}
+		if (s->seq == t->ooo_last)
+			first = n - 1;
+	}
+
+	opt[0] = TCPOPT_NOP;
+	opt[1] = TCPOPT_NOP;
+	opt[2] = TCPOPT_SACK;
+	p = (__be32 *)(opt + 4);
+
+	*p++ = htonl(start[first]);
+	*p++ = htonl(end[first]);
+	len = 1;
+
+	for (i = 0; i < n && len < TCP_SACK_BLOCKS; i++) {
+		if (i == first)
+			continue;
+		*p++ = htonl(start[i]);
+		*p++ = htonl(end[i]);
+		len++;
+	}
+
+	opt[3] = 2 + len * 8;
+
+	return 4 + len * 8;
+}
+
+static int tcp_send(struct tcp_connection *t, uint32_t seq, int flags,
+		const void *data, int len)
+{
+	struct tcphdr *th = t->con->tcp;
+	unsigned char *opt = (unsigned char *)(th + 1);
+	int hlen = sizeof(*th);
+	unsigned int win = tcp_window(t);
+
+	if (flags & TCP_SYN) {
+		opt[0] = TCPOPT_MSS;
+		opt[1] = 4;
+		opt[2] = TCP_MSS >> 8;
+		opt[3] = TCP_MSS & 0xff;
+		opt[4] = TCPOPT_NOP;
+		opt[5] = TCPOPT_NOP;
+		opt[6] = TCPOPT_SACK_PERM;
+		opt[7] = 2;
+		hlen += 8;
+	} else if ((flags & TCP_ACK) && t->sack_ok && t->ooo_cnt) {
+		hlen += tcp_sack_option(t, opt);
+	}
+
+	th->th_seq = htonl(seq);
+	th->th_ack = (flags & TCP_ACK) ? htonl(t->rcv_nxt) : 0;
+	th->th_off = (hlen / 4) << 4;
+	th->th_flags = flags;
+	th->th_win = htons(win);
+	th->th_urp = 0;
+
+	if (len)
+		memcpy((unsigned char *)th + hlen, data, len);
+
+	if (flags & TCP_ACK) {
+		t->rcv_adv = t->rcv_nxt + win;
+		t->unacked = 0;
+	}
+
+	return net_tcp_send(t->con, hlen + len);
+}
+
+static void tcp_send_ack(struct tcp_connection *t)
+{
+	tcp_send(t, t->snd_nxt, TCP_ACK, NULL, 0);
+}
+
+static void tcp_start_timer(struct tcp_connection *t)
+{
+	t->rto_start = get_time_ns();
+}
+
+/* Send as much of the queued data as the windows allow */
+static void tcp_output(struct tcp_connection *t)
+{
+	while (1) {
+		unsigned int inflight = t->snd_nxt - t->snd_una;
+		unsigned int wnd = min(t->snd_wnd, t->cwnd);
+		unsigned int len;
+
+		if (inflight >= t->txlen)
+			break;
+
+		if (inflight >= wnd) {
+			/* probe a zero window with a single byte */
+			if (inflight || t->snd_wnd)
+				break;
+			wnd = 1;
+		}
+
+		len = min3(t->txlen - inflight, wnd - inflight, t->mss);
+
+		if (!inflight)
+			tcp_start_timer(t);
+
+		tcp_send(t, t->snd_nxt, TCP_ACK | TCP_PSH,
+				t->txbuf + inflight, len);
+		t->snd_nxt += len;
+	}
+}
+
+static void tcp_retransmit(struct tcp_connection *t)
+{
+	unsigned int len = min(t->txlen, t->mss);
+
+	tcp_start_timer(t);
+
+	if (t->state == TCP_SYN_SENT) {
+		tcp_send(t, t->snd_una, TCP_SYN, NULL, 0);
+		return;
+	}
+
+	if (len) {
+		tcp_send(t, t->snd_una, TCP_ACK | TCP_PSH, t->txbuf, len);
+		return;
+	}
+
+	if (t->fin_sent && !t->fin_acked)
+		tcp_send(t, t->snd_una, TCP_FIN | TCP_ACK, NULL, 0);
+}
+
+static void tcp_timeout(struct tcp_connection *t)
+{
+	unsigned int inflight = t->snd_nxt - t->snd_una;
+
+	if (++t->retries > TCP_RETRIES) {
+		pr_debug("too many retransmissions\n");
+		t->err = -ETIMEDOUT;
+		t->state = TCP_CLOSED;
+		return;
+	}
+
+	t->rto = min(t->rto * 2, (uint64_t)TCP_RTO_MAX);
+	t->ssthresh = max(inflight / 2, 2 * t->mss);
+	t->cwnd = t->mss;
+	t->dupacks = 0;
+
+	/* go back to the first unacknowledged byte */
+	if (t->state == TCP_ESTABLISHED && !t->fin_sent)
+		t->snd_nxt = t->snd_una;
+
+	pr_debug("retransmit %u\n", t->snd_una);
+
+	tcp_retransmit(t);
+
+	if (t->state == TCP_ESTABLISHED && !t->fin_sent)
+		t->snd_nxt = t->snd_una + min(t->txlen, t->mss);
+}
+
+static void tcp_parse_options(struct tcp_connection *t, struct tcphdr *th,
+		int hlen)
+{
+	unsigned char *opt = (unsigned char *)(th + 1);
+	unsigned char *end = (unsigned char *)th + hlen;
+
+	while (opt < end) {
+		if (*opt == 0)
+			break;
+		if (*opt == 1) {
+			opt++;
+			continue;
+		}
+		if (opt + 1 >= end || opt[1] < 2 || opt + opt[1] > end)
+			break;
+		if (opt[0] == TCPOPT_MSS && opt[1] == 4)
+			t->mss = min(t->mss, (unsigned int)(opt[2] << 8 | opt[3]));
+		if (opt[0] == TCPOPT_SACK_PERM)
+			t->sack_ok = true;
+		opt += opt[1];
+	}
+}
+
+static void tcp_ack(struct tcp_connection *t, struct tcphdr *th,
+		int dlen)
+{
+	uint32_t ack = ntohl(th->th_ack);
+	unsigned int acked;
+
+	if (seq_lt(t->snd_nxt, ack))
+		return;
+
+	if (!seq_lt(t->snd_una, ack)) {
+		/* duplicate ACK */
+		if (ack == t->snd_una && !dlen && t->snd_nxt != t->snd_una &&
+		    ntohs(th->th_win) == t->snd_wnd && ++t->dupacks == 3) {
+			t->ssthresh = max((t->snd_nxt - t->snd_una) / 2,
+					2 * t->mss);
+			t->cwnd = t->ssthresh;
+			tcp_retransmit(t);
+		}
+		if (ack == t->snd_una)
+			t->snd_wnd = ntohs(th->th_win);
+		return;
+	}
+
+	acked = ack - t->snd_una;
+
+	if (t->fin_sent && ack == t->snd_nxt) {
+		t->fin_acked = true;
+		acked--;
+	}
+
+	acked = min(acked, t->txlen);
+	t->txlen -= acked;
+	memmove(t->txbuf, t->txbuf + acked, t->txlen);
+
+	if (t->cwnd < t->ssthresh)
+		t->cwnd += min(acked, t->mss);
+	else
+		t->cwnd += max(t->mss * t->mss / t->cwnd, 1U);
+
+	t->snd_una = ack;
+	t->snd_wnd = ntohs(th->th_win);
+	t->dupacks = 0;
+	t->retries = 0;
+	t->rto = TCP_RTO_INIT;
+	t->progress = get_time_ns();
+	tcp_start_timer(t);
+}
+
+/* Pass in order data to the reader, returns false when out of space */
+static bool tcp_receive(struct tcp_connection *t, uint32_t seq,
+		const unsigned char *data, unsigned int len, bool fin)
+{
+	unsigned int off = t->rcv_nxt - seq, n = 0;
+
+	if (off < len) {
+		n = kfifo_put(t->rx, data + off, len - off);
+		t->rcv_nxt += n;
+		t->progress = get_time_ns();
+	}
+
+	if (off + n < len)
+		return false;
+
+	if (fin) {
+		t->rcv_nxt++;
+		t->fin_rcvd = true;
+	}
+
+	return true;
+}
+
+static void tcp_ooo_add(struct tcp_connection *t, uint32_t seq,
+		const unsigned char *data, unsigned int len, bool fin)
+{
+	struct tcp_segment *s, *new;
+
+	if (t->ooo_cnt >= TCP_OOO_MAX || seq_lt(t->rcv_adv, seq + len))
+		return;
+
+	list_for_each_entry(s, &t->ooo, list) {
+		if (s->seq == seq && s->len >= len)
+			return;
+		if (seq_lt(seq, s->seq))
+			break;
+	}
+
+	new = malloc(sizeof(*new) + len);
+	if (!new)
+		return;
+
+	new->seq = seq;
+	new->len = len;
+	new->fin = fin;
+	memcpy(new->data, data, len);
+
+	/* insert before s, or at the tail if the loop did not break */
+	list_add_tail(&new->list, &s->list);
+	t->ooo_cnt++;
+	t->ooo_last = seq;
+}
+
+/* Move out of order segments which are in order now to the reader */
+static void tcp_ooo_drain(struct tcp_connection *t)
+{
+	struct tcp_segment *s, *tmp;
+
+	list_for_each_entry_safe(s, tmp, &t->ooo, list) {
+		if (seq_lt(t->rcv_nxt, s->seq) || t->fin_rcvd)
+			break;
+		if (!tcp_receive(t, s->seq, s->data, s->len, s->fin))
+			break;
+		list_del(&s->list);
+		free(s);
+		t->ooo_cnt--;
+	}
+}
+
+static void tcp_ooo_free(struct tcp_connection *t)
+{
+	struct tcp_segment *s, *tmp;
+
+	list_for_each_entry_safe(s, tmp, &t->ooo, list)
+		free(s);
+
+	INIT_LIST_HEAD(&t->ooo);
+	t->ooo_cnt = 0;
+}
+
+static void tcp_data(struct tcp_connection *t, struct tcphdr *th,
+		unsigned char *data, int dlen)
+{
+	uint32_t seq = ntohl(th->th_seq);
+	bool fin = th->th_flags & TCP_FIN;
+
+	if (!dlen && !fin)
+		return;
+
+	if (t->fin_rcvd || !seq_lt(t->rcv_nxt, seq + dlen + fin)) {
+		/* duplicate */
+		tcp_send_ack(t);
+		return;
+	}
+
+	if (seq_lt(t->rcv_nxt, seq)) {
+		/* a segment is missing, let the peer know at once */
+		tcp_ooo_add(t, seq, data, dlen, fin);
+		tcp_send_ack(t);
+		return;
+	}
+
+	if (!tcp_receive(t, seq, data, dlen, fin)) {
+		/* beyond our window */
+		tcp_send_ack(t);
+		return;
+	}
+
+	if (t->ooo_cnt) {
+		/* a hole got filled, acknowledge immediately */
+		tcp_ooo_drain(t);
+		tcp_send_ack(t);
+		return;
+	}
+
+	if (fin || ++t->unacked >= 2)
+		tcp_send_ack(t);
+}
+
+static void tcp_handler(void *ctx, char *pkt, unsigned int len)
+{
+	struct tcp_connection *t = ctx;
+	struct iphdr *ip = net_eth_to_iphdr(pkt);
+	struct tcphdr *th = net_eth_to_tcphdr(pkt);
+	int tcplen = ntohs(ip->tot_len) - sizeof(struct iphdr);
+	int hlen = (th->th_off >> 4) * 4;
+	uint32_t seq = ntohl(th->th_seq);
+	uint32_t ack = ntohl(th->th_ack);
+
+	if (hlen < sizeof(*th) || hlen > tcplen)
+		return;
+
+	switch (t->state) {
+	case TCP_SYN_SENT:
+		if (!(th->th_flags & TCP_ACK))
+			return;
+
+		if (ack != t->snd_nxt) {
+			/*
+			 * Most likely the peer still has a connection from a
+			 * previous boot with the same ports, reset it.
+			 */
+			if (!(th->th_flags & TCP_RST))
+				tcp_send(t, ack, TCP_RST, NULL, 0);
+			return;
+		}
+
+		if (th->th_flags & TCP_RST) {
+			t->err = -ECONNREFUSED;
+			t->state = TCP_CLOSED;
+			return;
+		}
+
+		if (!(th->th_flags & TCP_SYN))
+			return;
+
+		tcp_parse_options(t, th, hlen);
+
+		t->rcv_nxt = seq + 1;
+		t->snd_una = ack;
+		t->snd_wnd = ntohs(th->th_win);
+		t->cwnd = TCP_INIT_CWND * t->mss;
+		t->ssthresh = 0xffff;
+		t->retries = 0;
+		t->rto = TCP_RTO_INIT;
+		t->state = TCP_ESTABLISHED;
+		t->progress = get_time_ns();
+
+		tcp_send_ack(t);
+		break;
+
+	case TCP_ESTABLISHED:
+		if (th->th_flags & TCP_RST) {
+			if (seq - t->rcv_nxt > t->rcv_adv - t->rcv_nxt)
+				return;
+			pr_debug("connection reset\n");
+			t->err = -ECONNRESET;
+			t->state = TCP_CLOSED;
+			return;
+		}
+
+		if (th->th_flags & TCP_ACK)
+			tcp_ack(t, th, tcplen - hlen);
+
+		tcp_data(t, th, (unsigned char *)th + hlen, tcplen - hlen);
+
+		tcp_output(t);
+		break;
+
+	case TCP_CLOSED:
+		break;
+	}
+}
+
+/*
+ * Process incoming packets and expired timers once. Returns a negative
+ * error code when the connection is dead or the user interrupted.
+ */
+static int tcp_poll(struct tcp_connection *t)
+{
+	if (ctrlc())
+		return -EINTR;
+
+	net_poll();
+
+	if (t->state == TCP_CLOSED)
+		return t->err ? t->err : -ENOTCONN;
+
+	if ((t->state == TCP_SYN_SENT || t->snd_nxt != t->snd_una ||
+	     t->txlen) && is_timeout(t->rto_start, t->rto))
+		tcp_timeout(t);
+
+	if (is_timeout(t->progress, TCP_TIMEOUT)) {
+		pr_debug("timeout\n");
+		t->err = -ETIMEDOUT;
+		t->state = TCP_CLOSED;
+	}
+
+	if (t->state == TCP_CLOSED)
+		return t->err;
+
+	return 0;
+}
+
+static void tcp_free(struct tcp_connection *t)
+{
+	net_unregister(t->con);
+	tcp_ooo_free(t);
+	kfifo_free(t->rx);
+	free(t->txbuf);
+	free(t);
+}
+
+/**
+ * tcp_connect - open a TCP connection
+ * @dest: IP address of the peer
+ * @port: TCP port of the peer
+ *
+ * Return: the connection or an ERR_PTR() on failure
+ */
+struct tcp_connection *tcp_connect(IPaddr_t dest, uint16_t port)
+{
+	struct tcp_connection *t;
+	int ret;
+
+	t = xzalloc(sizeof(*t));
+	INIT_LIST_HEAD(&t->ooo);
+	t->rx = kfifo_alloc(TCP_RX_BUF);
+	t->txbuf = malloc(TCP_TX_BUF);
+	if (!t->rx || !t->txbuf) {
+		ret = -ENOMEM;
+		goto err_free;
+	}
+
+	t->con = net_tcp_new(dest, port, tcp_handler, t);
+	if (IS_ERR(t->con)) {
+		ret = PTR_ERR(t->con);
+		goto err_free;
+	}
+
+	t->state = TCP_SYN_SENT;
+	t->mss = TCP_MSS;
+	/* clock driven as in RFC 793, our PRNG starts the same on each boot */
+	t->snd_una = random32() + (uint32_t)(get_time_ns() >> 12);
+	t->snd_nxt = t->snd_una + 1;
+	t->rto = TCP_RTO_INIT;
+	t->progress = get_time_ns();
+
+	tcp_retransmit(t);
+
+	while (t->state == TCP_SYN_SENT) {
+		ret = tcp_poll(t);
+		if (ret)
+			goto err_unregister;
+	}
+
+	return t;
+
+err_unregister:
+	net_unregister(t->con);
+err_free:
+	if (t->rx)
+		kfifo_free(t->rx);
+	free(t->txbuf);
+	free(t);
+
+	return ERR_PTR(ret);
+}
+
+/**
+ * tcp_write - send data
+ * @t: the connection
+ * @buf: the data
+ * @len: length of @buf
+ *
+ * Returns once all data is queued for transmission.
+ *
+ * Return: @len or a negative error code
+ */
+int tcp_write(struct tcp_connection *t, const void *buf, int len)
+{
+	int done = 0, ret;
+
+	if (t->state != TCP_ESTABLISHED)
+		return t->err ? t->err : -ENOTCONN;
+
+	if (t->fin_sent)
+		return -EPIPE;
+
+	t->progress = get_time_ns();
+
+	while (done < len) {
+		int now = min(len - done, (int)(TCP_TX_BUF - t->txlen));
+
+		memcpy(t->txbuf + t->txlen, buf + done, now);
+		t->txlen += now;
+		done += now;
+
+		tcp_output(t);
+
+		if (done == len)
+			break;
+
+		ret = tcp_poll(t);
+		if (ret)
+			return ret;
+	}
+
+	return len;
+}
+
+/**
+ * tcp_read - receive data
+ * @t: the connection
+ * @buf: buffer for the data
+ * @len: size of @buf
+ *
+ * Blocks until at least one byte is available.
+ *
+ * Return: number of bytes read, 0 when the peer closed the connection, or
+ * a negative error code
+ */
+int tcp_read(struct tcp_connection *t, void *buf, int len)
+{
+	int ret;
+
+	t->progress = get_time_ns();
+
+	while (1) {
+		ret = kfifo_get(t->rx, buf, len);
+		if (ret) {
+			/* open the window again once half of the buffer is free */
+			if (t->state == TCP_ESTABLISHED &&
+			    tcp_window(t) - (t->rcv_adv - t->rcv_nxt) >=
+			    TCP_RX_BUF / 2)
+				tcp_send_ack(t);
+			return ret;
+		}
+
+		if (t->fin_rcvd)
+			return 0;
+
+		if (t->state != TCP_ESTABLISHED)
+			return t->err ? t->err : -ENOTCONN;
+
+		/* don't let the peer wait for the delayed ACK */
+		if (t->unacked)
+			tcp_send_ack(t);
+
+		ret = tcp_poll(t);
+		if (ret)
+			return ret;
+	}
+}
+
+/**
+ * tcp_close - close a connection and free its resources
+ * @t: the connection
+ *
+ * When the peer has not finished sending or data is left unread the
+ * connection is reset, otherwise it is closed gracefully.
+ */
+void tcp_close(struct tcp_connection *t)
+{
+	uint64_t start = get_time_ns();
+
+	if (t->state != TCP_ESTABLISHED)
+		goto out;
+
+	if (!t->fin_rcvd || kfifo_len(t->rx) || t->txlen) {
+		tcp_send(t, t->snd_nxt, TCP_RST | TCP_ACK, NULL, 0);
+		goto out;
+	}
+
+	tcp_send(t, t->snd_nxt, TCP_FIN | TCP_ACK, NULL, 0);
+	t->fin_sent = true;
+	t->snd_nxt++;
+	tcp_start_timer(t);
+
+	while (!t->fin_acked && !is_timeout(start, TCP_CLOSE_TIMEOUT)) {
+		if (tcp_poll(t))
+			break;
+	}
+out:
+	tcp_free(t);
+}